@@ -20,14 +20,47 @@
 
 #include "DockRegistry_p.h"
 #include "DockWidget.h"
+#include "Frame_p.h"
 #include "Logging_p.h"
 #include "DebugWindow_p.h"
 
 #include <QPointer>
 #include <QDebug>
+#include <QTimer>
 
 using namespace KDDockWidgets;
 
+// Not members, the registry is deleted whenever it becomes empty
+static DockWidgetFactoryFunc s_dockWidgetFactory = nullptr;
+typedef QHash<QString, QRect> PendingGeometries;
+Q_GLOBAL_STATIC(PendingGeometries, s_pendingFloatingGeometries)
+
+static DockWidget *createWithFactory(const QString &name)
+{
+    if (!s_dockWidgetFactory)
+        return nullptr;
+
+    qCDebug(creation) << Q_FUNC_INFO << "Creating" << name;
+    DockWidget *dock = s_dockWidgetFactory(name);
+    if (dock && dock->name() != name) {
+        qWarning() << Q_FUNC_INFO << "Factory created" << dock->name() << "instead of" << name;
+        return nullptr;
+    }
+
+    return dock;
+}
+
+// The content of a placeholder, created when its tab becomes current. That's when the real dock
+// widget is created, but only afterwards, as the placeholder is still being shown.
+static QWidget *placeholderWidgetFactory(DockWidget *placeholder)
+{
+    QTimer::singleShot(0, placeholder, [placeholder] {
+        DockRegistry::self()->dockByNameOrCreate(placeholder->name());
+    });
+
+    return new QWidget();
+}
+
 DockRegistry::DockRegistry(QObject *parent)
     : QObject(parent)
 {
@@ -52,6 +85,17 @@ bool DockRegistry::isEmpty() const
     return m_dockWidgets.isEmpty() && m_mainWindows.isEmpty() && m_nestedWindows.isEmpty();
 }
 
+///@brief returns the first registered value for @p name, QMultiHash iterates the latest first
+template <typename T>
+static T *firstByName(const QMultiHash<QString, T*> &hash, const QString &name)
+{
+    T *result = nullptr;
+    for (auto it = hash.constFind(name), end = hash.cend(); it != end && it.key() == name; ++it)
+        result = it.value();
+
+    return result;
+}
+
 DockRegistry *DockRegistry::self()
 {
     static QPointer<DockRegistry> s_dockRegistry;
@@ -68,66 +112,161 @@ void DockRegistry::registerDockWidget(DockWidget *dock)
     if (dock->name().isEmpty()) {
         qWarning() << Q_FUNC_INFO << "Dock " << dock << " doesn't have an ID";
     } else {
-        if (auto other = dockByName(dock->name())) {
+        auto other = dockByName(dock->name());
+        if (other && !m_placeholders.contains(other)) {
             qWarning() << Q_FUNC_INFO << "Another dock" << other << "with name" << dock->name() << " already exists." << dock;
         }
     }
 
-    m_dockWidgets << dock;
+    m_dockWidgets.add(dock);
+    m_dockWidgetsByName.insert(dock->name(), dock);
+
+    const auto it = s_pendingFloatingGeometries->find(dock->name());
+    if (it != s_pendingFloatingGeometries->end()) {
+        dock->setGeometry(*it);
+        s_pendingFloatingGeometries->erase(it);
+    }
+
+    Q_EMIT registryChanged();
 }
 
 void DockRegistry::unregisterDockWidget(DockWidget *dock)
 {
-    m_dockWidgets.removeOne(dock);
+    m_placeholders.remove(dock);
+    m_dockWidgets.remove(dock);
+    m_dockWidgetsByName.remove(dock->name(), dock);
+    Q_EMIT registryChanged();
     maybeDelete();
 }
 
 void DockRegistry::registerMainWindow(MainWindow *mainWindow)
 {
-    m_mainWindows << mainWindow;
+    m_mainWindows.add(mainWindow);
+    m_mainWindowsByName.insert(mainWindow->name(), mainWindow);
+    Q_EMIT registryChanged();
 }
 
 void DockRegistry::unregisterMainWindow(MainWindow *mainWindow)
 {
-    m_mainWindows.removeOne(mainWindow);
+    m_mainWindows.remove(mainWindow);
+    m_mainWindowsByName.remove(mainWindow->name(), mainWindow);
+    Q_EMIT registryChanged();
     maybeDelete();
 }
 
 void DockRegistry::registerNestedWindow(FloatingWindow *window)
 {
     m_nestedWindows << window;
+    Q_EMIT registryChanged();
 }
 
 void DockRegistry::unregisterNestedWindow(FloatingWindow *window)
 {
     m_nestedWindows.removeOne(window);
+    Q_EMIT registryChanged();
     maybeDelete();
 }
 
 DockWidget *DockRegistry::dockByName(const QString &name) const
 {
-    for (auto dock : qAsConst(m_dockWidgets)) {
-        if (dock->name() == name)
-            return dock;
-    }
+    return firstByName(m_dockWidgetsByName, name);
+}
 
-    return nullptr;
+void DockRegistry::setDockWidgetFactory(DockWidgetFactoryFunc func)
+{
+    s_dockWidgetFactory = func;
 }
 
-MainWindow *DockRegistry::mainWindowByName(const QString &name) const
+DockWidgetFactoryFunc DockRegistry::dockWidgetFactory()
+{
+    return s_dockWidgetFactory;
+}
+
+DockWidget *DockRegistry::dockByNameOrCreate(const QString &name)
+{
+    if (DockWidget *dock = dockByName(name))
+        return m_placeholders.contains(dock) ? replacePlaceholder(dock) : dock;
+
+    return createWithFactory(name);
+}
+
+DockWidget *DockRegistry::dockByNameOrPlaceholder(const QString &name)
+{
+    if (DockWidget *dock = dockByName(name))
+        return dock;
+
+    if (!s_dockWidgetFactory)
+        return nullptr;
+
+    qCDebug(creation) << Q_FUNC_INFO << "Deferring" << name;
+    auto placeholder = new DockWidget(name);
+    m_placeholders.insert(placeholder);
+    placeholder->setWidgetFactory(placeholderWidgetFactory);
+    return placeholder;
+}
+
+bool DockRegistry::isPlaceholder(DockWidget *dock) const
+{
+    return m_placeholders.contains(dock);
+}
+
+DockWidget *DockRegistry::replacePlaceholder(DockWidget *placeholder)
 {
-    for (auto mainWindow : qAsConst(m_mainWindows)) {
-        if (mainWindow->name() == name)
-            return mainWindow;
+    // The application might have created the dock widget meanwhile
+    const QString name = placeholder->name();
+    DockWidget *dock = nullptr;
+    for (auto it = m_dockWidgetsByName.constFind(name), end = m_dockWidgetsByName.cend(); it != end && it.key() == name; ++it) {
+        if (!m_placeholders.contains(it.value()))
+            dock = it.value();
+    }
+
+    if (!dock)
+        dock = createWithFactory(name);
+
+    if (!dock) {
+        qWarning() << Q_FUNC_INFO << "Couldn't create" << name;
+        return nullptr;
+    }
+
+    // Takes the placeholder's tab
+    if (Frame *frame = placeholder->frame()) {
+        const int index = frame->dockWidgets().indexOf(placeholder);
+        const bool wasCurrent = frame->currentTabIndex() == index;
+        frame->insertWidget(dock, index);
+        if (wasCurrent)
+            frame->setCurrentTabIndex(index);
+        frame->removeWidget(placeholder);
     }
 
-    return nullptr;
+    delete placeholder;
+    return dock;
+}
+
+void DockRegistry::setPendingFloatingGeometry(const QString &name, QRect geometry)
+{
+    s_pendingFloatingGeometries->insert(name, geometry);
+}
+
+void DockRegistry::clearPendingFloatingGeometries()
+{
+    s_pendingFloatingGeometries->clear();
+}
+
+QHash<QString, QRect> DockRegistry::pendingFloatingGeometries() const
+{
+    return *s_pendingFloatingGeometries;
+}
+
+MainWindow *DockRegistry::mainWindowByName(const QString &name) const
+{
+    return firstByName(m_mainWindowsByName, name);
 }
 
 bool DockRegistry::isSane() const
 {
     QSet<QString> names;
-    for (auto dock : qAsConst(m_dockWidgets)) {
+    const DockWidget::List docks = m_dockWidgets.toList();
+    for (auto dock : docks) {
         const QString name = dock->name();
         if (name.isEmpty()) {
             qWarning() << "DockRegistry::isSane: DockWidget" << dock << "is missing a name";
@@ -144,12 +283,12 @@ bool DockRegistry::isSane() const
 
 DockWidget::List DockRegistry::dockwidgets() const
 {
-    return m_dockWidgets;
+    return m_dockWidgets.toList();
 }
 
 MainWindow::List DockRegistry::mainwindows() const
 {
-    return m_mainWindows;
+    return m_mainWindows.toList();
 }
 
 QVector<FloatingWindow *> DockRegistry::nestedwindows() const
@@ -159,7 +298,8 @@ QVector<FloatingWindow *> DockRegistry::nestedwindows() const
 
 void DockRegistry::closeAllDockWidgets()
 {
-    for (auto dw : qAsConst(m_dockWidgets)) {
+    const DockWidget::List docks = m_dockWidgets.toList();
+    for (auto dw : docks) {
         dw->close();
     }
 
@@ -25,6 +25,9 @@
 #include "MainWindow.h"
 #include "FloatingWindow_p.h"
 
+#include <QHash>
+#include <QRect>
+#include <QSet>
 #include <QVector>
 #include <QObject>
 
@@ -36,6 +39,65 @@
 namespace KDDockWidgets
 {
 
+/**
+ * @brief A list which keeps insertion order, with O(1) removal.
+ *
+ * Removed entries are nulled and only compacted once they're half of the list.
+ */
+template <typename T>
+class RegistryList
+{
+public:
+    void add(T *t)
+    {
+        m_indexes.insert(t, m_items.size());
+        m_items.push_back(t);
+    }
+
+    void remove(T *t)
+    {
+        const auto it = m_indexes.find(t);
+        if (it == m_indexes.end())
+            return;
+
+        m_items[*it] = nullptr;
+        m_indexes.erase(it);
+        m_numRemoved++;
+        if (m_numRemoved > 16 && m_numRemoved > m_items.size() / 2)
+            compact();
+    }
+
+    QVector<T*> toList() const
+    {
+        QVector<T*> result;
+        result.reserve(m_indexes.size());
+        for (T *t : m_items) {
+            if (t)
+                result.push_back(t);
+        }
+
+        return result;
+    }
+
+    bool contains(T *t) const { return m_indexes.contains(t); }
+    bool isEmpty() const { return m_indexes.isEmpty(); }
+    int size() const { return m_indexes.size(); }
+
+private:
+    void compact()
+    {
+        m_items = toList();
+        m_indexes.clear();
+        for (int i = 0, end = m_items.size(); i < end; ++i)
+            m_indexes.insert(m_items.at(i), i);
+        m_numRemoved = 0;
+    }
+
+    QVector<T*> m_items;
+    QHash<const T*, int> m_indexes;
+    int m_numRemoved = 0;
+};
+
 class DOCKS_EXPORT DockRegistry : public QObject
 {
     Q_OBJECT
@@ -52,6 +114,38 @@ public:
     void unregisterNestedWindow(FloatingWindow *);
 
     DockWidget *dockByName(const QString &) const;
+
+    /**
+     * @brief Sets the function that creates the dock widgets a restored layout needs but which
+     * don't exist yet. Dock widgets that are restored hidden are only created when asked for.
+     * Applications use LayoutSaver::setDockWidgetFactory(), this header isn't installed.
+     */
+    static void setDockWidgetFactory(DockWidgetFactoryFunc);
+    static DockWidgetFactoryFunc dockWidgetFactory();
+
+    /**
+     * @brief like dockByName(), but creates the dock widget with the factory if it doesn't exist yet
+     * If there's a placeholder for it, the dock widget is created in the placeholder's place.
+     */
+    DockWidget *dockByNameOrCreate(const QString &name);
+
+    /**
+     * @brief like dockByName(), but if the dock widget doesn't exist yet and there's a factory,
+     * returns a placeholder for it. Used for tabs which aren't current. The factory only creates the
+     * dock widget once the placeholder's tab becomes current, or when dockByNameOrCreate() asks for it.
+     */
+    DockWidget *dockByNameOrPlaceholder(const QString &name);
+
+    ///@brief returns whether @p dock is a placeholder made by dockByNameOrPlaceholder()
+    bool isPlaceholder(DockWidget *dock) const;
+
+    /**
+     * @brief Remembers the floating geometry of a dock widget not created yet, set when it's registered
+     * Pending geometries are saved with the layout, like the dock widget would have been.
+     */
+    void setPendingFloatingGeometry(const QString &name, QRect geometry);
+    void clearPendingFloatingGeometries();
+    QHash<QString, QRect> pendingFloatingGeometries() const;
     MainWindow *mainWindowByName(const QString &) const;
     bool isSane() const;
 
@@ -66,13 +160,23 @@ public:
      */
     void closeAllDockWidgets();
 
+Q_SIGNALS:
+    ///@brief emitted when a DockWidget, MainWindow or FloatingWindow is registered or unregistered
+    void registryChanged();
+
 private:
     explicit DockRegistry(QObject *parent = nullptr);
+    DockWidget *replacePlaceholder(DockWidget *placeholder);
     void maybeDelete();
     bool isEmpty() const;
-    DockWidget::List m_dockWidgets;
-    MainWindow::List m_mainWindows;
+    RegistryList<DockWidget> m_dockWidgets;
+    RegistryList<MainWindow> m_mainWindows;
+
+    // Multi, to cope with duplicate names. Those are an error, but the first one registered wins.
+    QMultiHash<QString, DockWidget*> m_dockWidgetsByName;
+    QMultiHash<QString, MainWindow*> m_mainWindowsByName;
     QVector<FloatingWindow*> m_nestedWindows;
+    QSet<DockWidget*> m_placeholders;
 };
 
 }
@@ -36,6 +36,7 @@
 #include <QVBoxLayout>
 #include <QSignalBlocker>
 #include <QCloseEvent>
+#include <QTimer>
 
 /**
  * @file
@@ -84,6 +85,8 @@ public:
     void updateToggleAction();
     void onDockWidgetShown();
     void onDockWidgetHidden();
+    void ensureWidget();
+    void maybeUnloadWidget();
     TabWidget *parentTabWidget() const;
     void show();
     void close();
@@ -108,6 +111,9 @@ public:
     TitleBar *titlebar = nullptr;
     QAction *const toggleAction;
     LastPosition m_lastPosition;
+    WidgetFactoryFunc widgetFactory = nullptr;
+    WidgetUnloadFunc canUnloadWidget = nullptr;
+    QTimer *unloadTimer = nullptr;
 };
 
 DockWidget::DockWidget(const QString &name, Options options, QWidget *parent, Qt::WindowFlags flags)
@@ -201,6 +207,34 @@ QWidget *DockWidget::widget() const
     return d->widget;
 }
 
+void DockWidget::setWidgetFactory(WidgetFactoryFunc factory)
+{
+    Q_ASSERT(factory && !d->widget);
+    d->widgetFactory = factory;
+    if (isVisible())
+        d->ensureWidget();
+}
+
+void DockWidget::setWidgetUnloadPolicy(int timeoutMs, WidgetUnloadFunc canUnload)
+{
+    d->canUnloadWidget = canUnload;
+    if (timeoutMs < 0) {
+        delete d->unloadTimer;
+        d->unloadTimer = nullptr;
+        return;
+    }
+
+    if (!d->unloadTimer) {
+        d->unloadTimer = new QTimer(this);
+        d->unloadTimer->setSingleShot(true);
+        connect(d->unloadTimer, &QTimer::timeout, this, [this] {
+            d->maybeUnloadWidget();
+        });
+    }
+
+    d->unloadTimer->setInterval(timeoutMs);
+}
+
 bool DockWidget::isFloating() const
 {
     if (isWindow())
@@ -345,7 +379,8 @@ bool DockWidget::event(QEvent *e)
 void DockWidget::closeEvent(QCloseEvent *e)
 {
     e->accept(); // By default we accept, means DockWidget closes
-    qApp->sendEvent(d->widget, e); // Give a change for the widget to ignore
+    if (d->widget)
+        qApp->sendEvent(d->widget, e); // Give a change for the widget to ignore
 
     if (e->isAccepted()) {
         d->close();
@@ -458,15 +493,55 @@ void DockWidget::Private::onDockWidgetShown()
     updateTitleBarVisibility();
     updateToggleAction();
 
+    if (unloadTimer)
+        unloadTimer->stop();
+    ensureWidget();
+
     qCDebug(hiding) << Q_FUNC_INFO << "parent=" << q->parentWidget();
 }
 
 void DockWidget::Private::onDockWidgetHidden()
 {
     updateToggleAction();
+
+    if (unloadTimer && widgetFactory && widget)
+        unloadTimer->start();
+
     qCDebug(hiding) << Q_FUNC_INFO << "parent=" << q->parentWidget();
 }
 
+void DockWidget::Private::ensureWidget()
+{
+    if (widget || !widgetFactory)
+        return;
+
+    qCDebug(creation) << Q_FUNC_INFO << "Creating the widget of" << name;
+    QWidget *w = widgetFactory(q);
+    if (!w) {
+        qWarning() << Q_FUNC_INFO << "Widget factory returned null for" << name;
+        return;
+    }
+
+    q->setWidget(w);
+
+    // Children added to an already visible parent aren't shown automatically
+    w->show();
+}
+
+void DockWidget::Private::maybeUnloadWidget()
+{
+    // Could have been shown again meanwhile
+    if (!widget || !widgetFactory || q->isVisible())
+        return;
+
+    if (canUnloadWidget && !canUnloadWidget(q, widget))
+        return;
+
+    qCDebug(creation) << Q_FUNC_INFO << "Unloading the widget of" << name;
+    delete widget;
+    widget = nullptr;
+}
+
 TabWidget *DockWidget::Private::parentTabWidget() const
 {
     QWidget *p= q->parentWidget();
@@ -57,6 +57,12 @@ class DOCKS_EXPORT DockWidget : public QWidget
 public:
     typedef QVector<DockWidget *> List;
 
+    ///@brief Creates the content widget of @p dockWidget, see setWidgetFactory()
+    typedef QWidget *(*WidgetFactoryFunc)(DockWidget *dockWidget);
+
+    ///@brief Returns whether @p widget, the content of the hidden @p dockWidget, can be unloaded
+    typedef bool (*WidgetUnloadFunc)(DockWidget *dockWidget, QWidget *widget);
+
     enum Option {
         Option_None = 0,
         Option_NotClosable = 1 /// The DockWidget can't be closed on the [x], only programatically
@@ -103,6 +109,25 @@ public:
      */
     QWidget *widget() const;
 
+    /**
+     * @brief sets a factory which creates the widget this dock widget contains, instead of setWidget()
+     *
+     * The widget is only created when the dock widget is first shown, for example when its tab
+     * becomes current. Until then widget() returns nullptr.
+     * @param factory the function creating the widget
+     */
+    void setWidgetFactory(WidgetFactoryFunc factory);
+
+    /**
+     * @brief unloads the widget once this dock widget has been hidden for @p timeoutMs
+     *
+     * Only applies to widgets created through setWidgetFactory(), they're created again when the
+     * dock widget is shown. Unloading is disabled by default.
+     * @param timeoutMs how long to wait after hiding, a negative value disables unloading
+     * @param canUnload optional function to veto unloading
+     */
+    void setWidgetUnloadPolicy(int timeoutMs, WidgetUnloadFunc canUnload = nullptr);
+
     /**
      * @brief checks if the dock widget is floating. Floating means it's not docked and has a window of it's own.
      * Note that if you dock a floating dock widget into another floating one then they don't count
@@ -230,6 +255,7 @@ private:
     friend class Frame;
     friend class DropArea;
     friend class TestDocks;
+    friend class DockRegistry;
     friend class KDDockWidgets::DragController;
     friend class KDDockWidgets::TitleBar;
     friend struct KDDockWidgets::WindowBeingDragged;
@@ -24,11 +24,14 @@
 #include "DropArea_p.h"
 #include "FloatingWindow_p.h"
 #include "Draggable_p.h"
+#include "EventRouter_p.h"
 #include "WidgetResizeHandler_p.h"
 
 #include <QMouseEvent>
 #include <QApplication>
 #include <QCursor>
+#include <QRubberBand>
+#include <QScreen>
 
 #if defined(Q_OS_WIN)
 # include <QWindow>
@@ -37,8 +40,59 @@
 
 using namespace KDDockWidgets;
 
+namespace KDDockWidgets {
+/**
+ * @brief Application-wide filter, installed only while dragging, which invalidates the hover
+ * snapshot when a window or DropArea is shown, hidden, moved or resized.
+ */
+class HoverSnapshotInvalidator : public QObject
+{
+public:
+    explicit HoverSnapshotInvalidator(DragController *dc)
+        : m_dragController(dc)
+    {
+    }
+
+    bool eventFilter(QObject *o, QEvent *e) override
+    {
+        switch (e->type()) {
+        case QEvent::Show:
+        case QEvent::Hide:
+        case QEvent::Move:
+        case QEvent::Resize:
+        case QEvent::WindowStateChange:
+            break;
+        default:
+            return false;
+        }
+
+        if (!o->isWidgetType())
+            return false;
+
+        auto w = static_cast<QWidget *>(o);
+        if (w->isWindow()) {
+            // The window being dragged moves with every mouse move, and the drop indicators follow
+            // the hover. None of them are candidates.
+            WindowBeingDragged *wbd = m_dragController->m_windowBeingDragged.get();
+            if ((wbd && w == wbd->window()) || qobject_cast<QRubberBand *>(w) ||
+                w->objectName() == QLatin1String("_docks_IndicatorWindow_Overlay"))
+                return false;
+
+            m_dragController->invalidateHoverSnapshot();
+        } else if (qobject_cast<DropArea *>(w)) {
+            m_dragController->invalidateHoverSnapshot();
+        }
+
+        return false;
+    }
+
+private:
+    DragController *const m_dragController;
+};
+}
+
 StateBase::StateBase(DragController *parent)
-    : QState(parent)
+    : QObject(parent)
     , q(parent)
 {
 }
@@ -50,12 +104,14 @@ StateNone::StateNone(DragController *parent)
 {
 }
 
-void StateNone::onEntry(QEvent *)
+void StateNone::onEntry()
 {
     qCDebug(state) << "StateNone entered";
     q->m_pressPos = QPoint();
     q->m_offset = QPoint();
     q->m_draggable = nullptr;
+    qApp->removeEventFilter(q->m_hoverSnapshotInvalidator.get());
+    q->invalidateHoverSnapshot();
     q->m_windowBeingDragged.reset();
     WidgetResizeHandler::s_disableAllHandlers = false; // Re-enable resize handlers
 
@@ -87,7 +143,7 @@ StatePreDrag::StatePreDrag(DragController *parent)
 
 StatePreDrag::~StatePreDrag() = default;
 
-void StatePreDrag::onEntry(QEvent *)
+void StatePreDrag::onEntry()
 {
     qCDebug(state) << "StatePreDrag entered";
     WidgetResizeHandler::s_disableAllHandlers = true; // Disable the resize handler during dragging
@@ -108,23 +164,50 @@ bool StatePreDrag::handleMouseButtonRelease(QPoint, QPoint)
 }
 
 
+static int displayFrameInterval()
+{
+    const QScreen *screen = QGuiApplication::primaryScreen();
+    const qreal refreshRate = screen ? screen->refreshRate() : 0;
+    return refreshRate > 0 ? qMax(1, qRound(1000 / refreshRate)) : 16;
+}
+
 StateDragging::StateDragging(DragController *parent)
     : StateBase(parent)
 {
+    m_moveTimer.setTimerType(Qt::PreciseTimer);
+    connect(&m_moveTimer, &QTimer::timeout, this, [this] {
+        if (m_hasPendingMove)
+            processPendingMove();
+        else
+            m_moveTimer.stop(); // The mouse stopped, the next move is processed right away
+    });
 }
 
 StateDragging::~StateDragging() = default;
 
-void StateDragging::onEntry(QEvent *)
+void StateDragging::onEntry()
 {
     q->m_windowBeingDragged = q->m_draggable->makeWindow();
     qCDebug(state) << "StateDragging entered. m_draggable=" << q->m_draggable << "; m_windowBeingDragged=" << q->m_windowBeingDragged->window();
+    q->updateHoverSnapshot();
+    qApp->installEventFilter(q->m_hoverSnapshotInvalidator.get());
+    m_moveTimer.setInterval(displayFrameInterval());
+}
+
+void StateDragging::onExit()
+{
+    m_moveTimer.stop();
+    m_hasPendingMove = false;
 }
 
 bool StateDragging::handleMouseButtonRelease(QPoint globalPos, QPoint)
 {
     qCDebug(state) << "StateDragging: handleMouseButtonRelease";
 
+    // Honour the last position before dropping
+    if (m_hasPendingMove && !processPendingMove())
+        return true;
+
     Draggable *draggable = q->m_windowBeingDragged->draggable();
     if (!draggable) {
         // It was deleted externally
@@ -149,16 +232,34 @@ bool StateDragging::handleMouseButtonRelease(QPoint globalPos, QPoint)
 
 bool StateDragging::handleMouseMove(QPoint globalPos)
 {
+    m_pendingMovePos = globalPos;
+    m_hasPendingMove = true;
+
+    // The first move after a pause is processed immediately, the ones following it once per frame
+    if (!m_moveTimer.isActive()) {
+        if (processPendingMove())
+            m_moveTimer.start();
+    }
+
+    return true;
+}
+
+bool StateDragging::processPendingMove()
+{
+    m_hasPendingMove = false;
+
     if (!q->m_windowBeingDragged->window()) {
         qCDebug(state) << "Canceling drag, window was deleted";
+        m_moveTimer.stop();
         Q_EMIT q->dragCanceled();
-        return true;
+        return false;
     }
 
+    const QPoint globalPos = m_pendingMovePos;
     if (!q->m_nonClientDrag)
         q->m_windowBeingDragged->window()->move(globalPos - q->m_offset);
 
-    DropArea *dropArea = q->dropAreaUnderCursor();
+    DropArea *dropArea = q->dropAreaUnderCursor(globalPos);
     if (q->m_currentDropArea && dropArea != q->m_currentDropArea)
         q->m_currentDropArea->removeHover();
 
@@ -171,21 +272,48 @@ bool StateDragging::handleMouseMove(QPoint globalPos)
 }
 
 DragController::DragController(QObject *)
+    : m_hoverSnapshotInvalidator(new HoverSnapshotInvalidator(this))
 {
     qCDebug(creation) << "DragController()";
 
-    auto stateNone = new StateNone(this);
-    auto statepreDrag = new StatePreDrag(this);
-    auto stateDragging = new StateDragging(this);
-
-    stateNone->addTransition(this, &DragController::mousePressed, statepreDrag);
-    statepreDrag->addTransition(this, &DragController::dragCanceled, stateNone);
-    statepreDrag->addTransition(this, &DragController::manhattanLengthMove, stateDragging);
-    stateDragging->addTransition(this, &DragController::dragCanceled, stateNone);
-    stateDragging->addTransition(this, &DragController::dropped, stateNone);
+    m_states[State_None] = new StateNone(this);
+    m_states[State_PreDrag] = new StatePreDrag(this);
+    m_states[State_Dragging] = new StateDragging(this);
+
+    // Transitions happen synchronously, before any other receiver sees the signal
+    connect(this, &DragController::mousePressed, this, [this] {
+        if (m_state == State_None)
+            setState(State_PreDrag);
+    });
+    connect(this, &DragController::manhattanLengthMove, this, [this] {
+        if (m_state == State_PreDrag)
+            setState(State_Dragging);
+    });
+    connect(this, &DragController::dragCanceled, this, [this] {
+        setState(State_None);
+    });
+    connect(this, &DragController::dropped, this, [this] {
+        if (m_state == State_Dragging)
+            setState(State_None);
+    });
+
+    activeState()->onEntry();
+}
 
-    setInitialState(stateNone);
-    start();
+void DragController::setState(State newState)
+{
+    if (m_state == newState)
+        return;
+
+    qCDebug(state) << "DragController::setState" << m_state << "->" << newState;
+    StateBase *oldState = activeState();
+    oldState->onExit();
+    Q_EMIT oldState->exited();
+
+    m_state = newState;
+    StateBase *enteredState = activeState();
+    enteredState->onEntry();
+    Q_EMIT enteredState->entered();
 }
 
 DragController *DragController::instance()
@@ -197,13 +325,14 @@ DragController *DragController::instance()
 void DragController::registerDraggable(Draggable *drg)
 {
     m_draggables << drg;
-    drg->asWidget()->installEventFilter(this);
+    // Move events are only needed for non-client drags, see eventFilter()
+    EventRouter::instance()->addRoute(drg->asWidget(), this, EventRouter::EventTypes(EventRouter::MouseEvents) | EventRouter::MoveEvents);
 }
 
 void DragController::unregisterDraggable(Draggable *drg)
 {
     m_draggables.removeOne(drg);
-    drg->asWidget()->removeEventFilter(this);
+    EventRouter::instance()->removeRoute(drg->asWidget(), this);
 }
 
 bool DragController::isDragging() const
@@ -233,12 +362,12 @@ bool DragController::eventFilter(QObject *o, QEvent *e)
     if (m_nonClientDrag && e->type() == QEvent::Move) {
         // On Windows, non-client mouse moves are only sent at the end, so we must fake it:
         activeState()->handleMouseMove(QCursor::pos());
-        return QStateMachine::eventFilter(o, e);
+        return QObject::eventFilter(o, e);
     }
 
     QMouseEvent *me = mouseEvent(e);
     if (!me)
-        return QStateMachine::eventFilter(o, e);
+        return QObject::eventFilter(o, e);
 
     qCDebug(mouseevents) << "DragController::eventFilter e=" << e->type() << "; o=" << o;
 
@@ -254,127 +383,141 @@ bool DragController::eventFilter(QObject *o, QEvent *e)
     case QEvent::MouseMove:
         return activeState()->handleMouseMove(me->globalPos());
     default:
-        return QStateMachine::eventFilter(o, e);
+        return QObject::eventFilter(o, e);
     }
 }
 
-StateBase *DragController::activeState() const
+void DragController::updateHoverSnapshot() const
 {
-    auto set = configuration();
-    if (set.isEmpty())
-        return nullptr;
-    return static_cast<StateBase *>(*(set.begin()));
-}
+    m_hoverCandidates.clear();
+    QWidget *draggedWindow = m_windowBeingDragged ? m_windowBeingDragged->window() : nullptr;
+
+    const auto topLevels = qApp->topLevelWidgets();
+    for (QWidget *tl : topLevels) {
+        if (!tl->isVisible() || tl == draggedWindow || tl->isMinimized() || tl->objectName() == QLatin1String("_docks_IndicatorWindow_Overlay"))
+            continue;
 
+        if (tl->objectName() == QLatin1String("_docks_IndicatorWindow")) {
+            qWarning() << "Indicator window should be hidden " << tl << tl->isVisible();
+            Q_ASSERT(false);
+        }
+
+        HoverCandidate candidate;
+        candidate.window = tl;
+        candidate.geometry = tl->geometry();
 #if defined(Q_OS_WIN)
-static QWidget *qtTopLevelForHWND(HWND hwnd)
-{
-    auto topLevels = qApp->topLevelWidgets();
-    for (auto topLevel : topLevels) {
-        if (hwnd == (HWND)topLevel->winId())
-            return topLevel;
+        candidate.nativeWindow = tl->winId();
+        if (QLatin1String(tl->metaObject()->className()) == QLatin1String("QWinWidget")) {
+            // Embedded, the native window under the cursor is its parent
+            candidate.nativeParentWindow = WId(GetParent(HWND(tl->windowHandle()->winId())));
+        }
+#endif
+
+        if (auto da = qobject_cast<DropArea *>(tl)) {
+            candidate.dropAreas.push_back({ da, candidate.geometry });
+        } else if (auto fw = qobject_cast<FloatingWindow *>(tl)) {
+            // The whole floating window accepts drops, title bar included
+            candidate.dropAreas.push_back({ fw->dropArea(), candidate.geometry });
+        } else if (qobject_cast<DockWidget *>(tl)) {
+            // Gets morphed into a FloatingWindow once it's hovered
+            candidate.isDockWidget = true;
+        } else {
+            // findChildren() is depth-first, so nested DropAreas come after their ancestors
+            const auto dropAreas = tl->findChildren<DropArea *>();
+            for (DropArea *da : dropAreas) {
+                if (da->isVisible())
+                    candidate.dropAreas.push_back({ da, QRect(da->mapToGlobal(QPoint(0, 0)), da->size()) });
+            }
+        }
+
+        m_hoverCandidates.push_back(candidate);
     }
 
-    qCDebug(toplevels) << Q_FUNC_INFO << "Couldn't find hwnd for top-level" << hwnd;
-    return nullptr;
+    qCDebug(toplevels) << Q_FUNC_INFO << "Hover candidates:" << m_hoverCandidates.size();
+    m_hoverSnapshotValid = true;
+    m_numHoverSnapshots++;
+}
+
+void DragController::invalidateHoverSnapshot()
+{
+    m_hoverSnapshotValid = false;
 }
-#endif
 
-QWidget *DragController::qtTopLevelUnderCursor() const
+const DragController::HoverCandidate *DragController::hoverCandidateAt(QPoint globalPos) const
 {
-    QPoint globalPos = QCursor::pos();
-    auto topLevels = qApp->topLevelWidgets();
 #if defined(Q_OS_WIN)
+    Q_UNUSED(globalPos);
     POINT globalNativePos;
     if (!GetCursorPos(&globalNativePos))
         return nullptr;
 
-    // There might be windows that don't belong to our app in between, so use win32 to travel by z-order.
-    // Another solution is to set a parent on all top-levels. But this code is orthogonal.
-    HWND hwnd = (HWND)m_windowBeingDragged->window()->winId();
+    // The z-order can only be known natively. There might be windows that don't belong to our app
+    // in between, so use win32 to travel by z-order, matching against the snapshot's native handles.
+    const QPoint cursorPos = QCursor::pos();
+    const DWORD processId = GetCurrentProcessId();
+    HWND hwnd = HWND(m_windowBeingDragged->window()->winId());
     while (hwnd) {
         hwnd = GetWindow(hwnd, GW_HWNDNEXT);
         RECT r;
-        if (!GetWindowRect(hwnd, &r) || !IsWindowVisible(hwnd))
-            continue;
-
-        if (!PtInRect(&r, globalNativePos)) // Check if window is under cursor
+        if (!GetWindowRect(hwnd, &r) || !IsWindowVisible(hwnd) || !PtInRect(&r, globalNativePos))
             continue;
 
-        if (auto tl = qtTopLevelForHWND(hwnd)) {
-            if (tl->geometry().contains(globalPos) && tl->objectName() != QStringLiteral("_docks_IndicatorWindow_Overlay")) {
-                qCDebug(toplevels) << Q_FUNC_INFO << "Found top-level" << tl;
-                return tl;
-            }
-        } else {
-            // Maybe it's embedded in a QWinWidget:
-            for (auto topLevel : topLevels) {
-                if (QLatin1String(topLevel->metaObject()->className()) == QLatin1String("QWinWidget")) {
-                    if (hwnd == GetParent((HWND)topLevel->windowHandle()->winId())) {
-                        if (topLevel->rect().contains(topLevel->mapFromGlobal(globalPos)) && topLevel->objectName() != QStringLiteral("_docks_IndicatorWindow_Overlay")) {
-                            qCDebug(toplevels) << Q_FUNC_INFO << "Found top-level" << topLevel;
-                            return topLevel;
-                        }
-                    }
-                }
+        const WId nativeWindow = WId(hwnd);
+        for (const HoverCandidate &candidate : qAsConst(m_hoverCandidates)) {
+            if (candidate.nativeWindow == nativeWindow || candidate.nativeParentWindow == nativeWindow) {
+                if (candidate.window && candidate.geometry.contains(cursorPos))
+                    return &candidate;
             }
+        }
 
-            // A window belonging to another app is below the cursor
+        // Our own windows which aren't candidates, like the drop indicators, are skipped
+        DWORD windowProcessId = 0;
+        GetWindowThreadProcessId(hwnd, &windowProcessId);
+        if (windowProcessId != processId) {
             qCDebug(toplevels) << Q_FUNC_INFO << "Window from another app is under cursor" << hwnd;
             return nullptr;
         }
     }
 #else
-    for (auto tl : topLevels) {
-        if (!tl->isVisible() || tl == m_windowBeingDragged->window() || tl->isMinimized() || tl->objectName() == QLatin1String("_docks_IndicatorWindow_Overlay"))
-            continue;
-        if (tl->geometry().contains(globalPos)) {
-            qCDebug(toplevels) << Q_FUNC_INFO << "Found top-level" << tl;
-            return tl;
-        }
+    for (const HoverCandidate &candidate : qAsConst(m_hoverCandidates)) {
+        if (candidate.window && candidate.geometry.contains(globalPos))
+            return &candidate;
     }
 #endif
-    qCDebug(toplevels) << Q_FUNC_INFO << "No top-level found";
+
     return nullptr;
 }
 
-DropArea *DragController::dropAreaUnderCursor() const
+DropArea *DragController::dropAreaUnderCursor(QPoint globalPos) const
 {
-    QWidget *topLevel = qtTopLevelUnderCursor();
-    if (!topLevel) {
+    if (!m_hoverSnapshotValid)
+        updateHoverSnapshot();
+
+    const HoverCandidate *candidate = hoverCandidateAt(globalPos);
+    if (!candidate) {
         //qCDebug(state) << "DragController::dropAreaUnderCursor: null";
         return nullptr;
     }
 
-    if (auto dt = qobject_cast<DropArea *>(topLevel)) {
-        return dt;
-    }
-
-    if (auto fw = qobject_cast<FloatingWindow *>(topLevel)) {
-        return fw->dropArea();
-    }
-
-    if (topLevel->objectName() == QStringLiteral("_docks_IndicatorWindow")) {
-        qWarning() << "Indicator window should be hidden " << topLevel << topLevel->isVisible();
-        Q_ASSERT(false);
-    }
-
-    if (auto dock = qobject_cast<DockWidget *>(topLevel)) {
+    if (candidate->isDockWidget) {
+        auto dock = static_cast<DockWidget *>(candidate->window.data());
         FloatingWindow *fw = dock->morphIntoFloatingWindow();
         m_windowBeingDragged->window()->raise();
+        m_hoverSnapshotValid = false; // There's a new top-level now
         return fw->dropArea();
     }
 
-    QWidget *w = topLevel->childAt(topLevel->mapFromGlobal(QCursor::pos()));
-    while (w) {
-        if (auto dt = qobject_cast<DropArea *>(w)) {
-            return dt;
-        }
-        w = w->parentWidget();
+    DropArea *dropArea = nullptr;
+    for (const auto &candidateDropArea : candidate->dropAreas) {
+        // The last hit is the innermost DropArea
+        if (candidateDropArea.first && candidateDropArea.second.contains(globalPos))
+            dropArea = candidateDropArea.first;
     }
 
-    qCDebug(state) << "DragController::dropAreaUnderCursor: null2";
-    return nullptr;
+    if (!dropArea)
+        qCDebug(state) << "DragController::dropAreaUnderCursor: null2";
+
+    return dropArea;
 }
 
 Draggable *DragController::draggableForQObject(QObject *o) const
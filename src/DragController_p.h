@@ -21,12 +21,17 @@
 #ifndef KD_DRAGCONTROLLER_P_H
 #define KD_DRAGCONTROLLER_P_H
 
+#include "docks_export.h"
 #include "TitleBar_p.h"
 #include "TabWidget_p.h"
 #include "WindowBeingDragged_p.h"
 
-#include <QStateMachine>
+#include <QObject>
 #include <QPoint>
+#include <QPointer>
+#include <QRect>
+#include <QTimer>
+#include <QVector>
 #include <memory>
 
 namespace KDDockWidgets {
@@ -34,8 +39,9 @@ namespace KDDockWidgets {
 class StateBase;
 class DropArea;
 class Draggable;
+class HoverSnapshotInvalidator;
 
-class DragController : public QStateMachine
+class DOCKS_EXPORT_FOR_UNIT_TESTS DragController : public QObject
 {
     Q_OBJECT
 public:
@@ -54,6 +60,15 @@ public:
 
     bool isDragging() const;
 
+    ///@brief For tests-only. Returns how many times the hover snapshot was taken.
+    int dbg_numHoverSnapshots() const { return m_numHoverSnapshots; }
+
+    ///@brief For tests-only. Returns the current state.
+    State dbg_state() const { return m_state; }
+
+    ///@brief For tests-only. Returns the object implementing state @p s.
+    StateBase *dbg_stateObject(State s) const { return m_states[s]; }
+
 Q_SIGNALS:
     void mousePressed();
     void manhattanLengthMove();
@@ -69,35 +84,74 @@ private:
     friend class StatePreDrag;
     friend class StateDragging;
     friend class StateDropped;
+    friend class HoverSnapshotInvalidator;
+
+    /**
+     * @brief A top-level that can be hovered during a drag, as it was when the hover snapshot was taken.
+     * Nested DropAreas are listed after their ancestors, with their rects in global coordinates.
+     */
+    struct HoverCandidate {
+        QPointer<QWidget> window;
+        QRect geometry;
+        bool isDockWidget = false;
+        QVector<QPair<QPointer<DropArea>, QRect>> dropAreas;
+#if defined(Q_OS_WIN)
+        WId nativeWindow = 0;
+        WId nativeParentWindow = 0; // Set for QWinWidget, which is embedded
+#endif
+    };
 
     DragController(QObject * = nullptr);
-    StateBase *activeState() const;
-    QWidget *qtTopLevelUnderCursor() const;
-    DropArea *dropAreaUnderCursor() const;
+    StateBase *activeState() const { return m_states[m_state]; }
+    void setState(State);
+    DropArea *dropAreaUnderCursor(QPoint globalPos) const;
+    void updateHoverSnapshot() const;
+    void invalidateHoverSnapshot();
+    const HoverCandidate *hoverCandidateAt(QPoint globalPos) const;
     Draggable *draggableForQObject(QObject *o) const;
     QPoint m_pressPos;
     QPoint m_offset;
 
+    State m_state = State_None;
+    StateBase *m_states[State_Dragging + 1] = {};
+
     Draggable::List m_draggables;
     Draggable *m_draggable = nullptr;
     std::unique_ptr<WindowBeingDragged> m_windowBeingDragged;
     DropArea *m_currentDropArea = nullptr;
     bool m_nonClientDrag = false;
+
+    // Hit-testing data for hovering, taken when the drag starts and rebuilt when a window is
+    // shown, hidden, moved or resized. Keeps mouse moves free of top-level walks and allocations.
+    mutable QVector<HoverCandidate> m_hoverCandidates;
+    mutable bool m_hoverSnapshotValid = false;
+    mutable int m_numHoverSnapshots = 0;
+    std::unique_ptr<QObject> m_hoverSnapshotInvalidator;
 };
 
-class StateBase : public QState
+class DOCKS_EXPORT_FOR_UNIT_TESTS StateBase : public QObject
 {
     Q_OBJECT
 public:
     explicit StateBase(DragController *parent);
     ~StateBase();
 
+    virtual void onEntry() {}
+    virtual void onExit() {}
+
     // Not using QEvent here, to abstract platform differences regarding production of such events
     virtual bool handleMouseButtonPress(Draggable * /*receiver*/, QPoint /*globalPos*/, QPoint /*pos*/) { return false; }
     virtual bool handleMouseMove(QPoint /*globalPos*/) { return false; }
     virtual bool handleMouseButtonRelease(QPoint /*globalPos*/, QPoint /*pos*/) { return false; }
 
     DragController *const q;
+
+Q_SIGNALS:
+    ///@brief emitted after onEntry()
+    void entered();
+
+    ///@brief emitted after onExit()
+    void exited();
 };
 
 class StateNone : public StateBase
@@ -106,7 +160,7 @@ class StateNone : public StateBase
 public:
     explicit StateNone(DragController *parent);
     ~StateNone() override;
-    void onEntry(QEvent *) override;
+    void onEntry() override;
     bool handleMouseButtonPress(Draggable *draggable, QPoint globalPos, QPoint pos) override;
 };
 
@@ -116,7 +170,7 @@ class StatePreDrag : public StateBase
 public:
     explicit StatePreDrag(DragController *parent);
     ~StatePreDrag() override;
-    void onEntry(QEvent *) override;
+    void onEntry() override;
     bool handleMouseMove(QPoint globalPos) override;
     bool handleMouseButtonRelease(QPoint, QPoint) override;
 };
@@ -127,9 +181,19 @@ class StateDragging : public StateBase
 public:
     explicit StateDragging(DragController *parent);
     ~StateDragging() override;
-    void onEntry(QEvent *) override;
+    void onEntry() override;
+    void onExit() override;
     bool handleMouseButtonRelease(QPoint globalPos, QPoint) override;
     bool handleMouseMove(QPoint globalPos) override;
+
+private:
+    ///@brief Moves the window and hovers at the latest mouse position. Returns false if the drag was canceled.
+    bool processPendingMove();
+
+    // Mouse moves are coalesced and processed at most once per display frame
+    QTimer m_moveTimer;
+    QPoint m_pendingMovePos;
+    bool m_hasPendingMove = false;
 };
 
 }
@@ -95,28 +95,19 @@ Anchor::List DropArea::nonStaticAnchors(bool includePlaceholders) const
 
 Frame *DropArea::frameContainingPos(QPoint globalPos) const
 {
-    const ItemList &items = m_layout->items();
-    for (Item *item : items) {
-        auto frame = item->frame();
-        if (!frame || !frame->isVisible()) {
-            continue;
-        }
-
-        if (frame->containsMouse(globalPos))
-            return frame;
-    }
-    return nullptr;
+    // Item geometries are in our coordinates, so map once and use the layout's spatial index,
+    // instead of mapping per frame. This runs on every mouse move while dragging.
+    Item *item = m_layout->itemAt(mapFromGlobal(globalPos));
+    Frame *frame = item ? item->frame() : nullptr;
+    if (!frame || !frame->isVisible())
+        return nullptr;
+
+    return frame;
 }
 
 Item *DropArea::centralFrame() const
 {
-    for (Item *item : m_layout->items()) {
-        if (auto f = item->frame()) {
-            if (f->isCentralFrame())
-                return item;
-        }
-    }
-    return nullptr;
+    return m_layout->centralFrameItem();
 }
 
 void DropArea::addDockWidget(DockWidget *dw, Location location, DockWidget *relativeTo, AddingOption option)
@@ -181,6 +172,11 @@ bool DropArea::checkSanity(MultiSplitterLayout::AnchorSanityOption o)
     return m_layout->checkSanity(o);
 }
 
+bool DropArea::verifySanity(MultiSplitterLayout::AnchorSanityOption o)
+{
+    return m_layout->verifySanity(o);
+}
+
 QWidget *DropArea::window() const
 {
     if (auto pw = parentWidget())
@@ -73,6 +73,7 @@ public:
     void debug_updateItemNamesForGammaray();
 
     bool checkSanity(MultiSplitterLayout::AnchorSanityOption o = MultiSplitterLayout::AnchorSanity_All);
+    bool verifySanity(MultiSplitterLayout::AnchorSanityOption o = MultiSplitterLayout::AnchorSanity_All);
     QWidget *window() const;
     bool contains(DockWidget *) const;
 private:
@@ -0,0 +1,180 @@
+/*
+  This file is part of KDDockWidgets.
+
+  Copyright (C) 2018-2019 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com
+  Author: Sérgio Martins <sergio.martins@kdab.com>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "EventRouter_p.h"
+#include "Logging_p.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+
+using namespace KDDockWidgets;
+
+EventRouter::EventRouter()
+{
+    qCDebug(creation) << "EventRouter()";
+}
+
+EventRouter *EventRouter::instance()
+{
+    // Never deleted, like DockRegistry. WidgetResizeHandlers and the DragController remove their
+    // routes when destroyed, which can be during static destruction.
+    static EventRouter *s_router = new EventRouter();
+    return s_router;
+}
+
+EventRouter::Category EventRouter::categoryForEvent(QEvent::Type type)
+{
+    switch (type) {
+    case QEvent::MouseButtonPress:
+    case QEvent::MouseButtonRelease:
+    case QEvent::MouseMove:
+    case QEvent::NonClientAreaMouseButtonPress:
+    case QEvent::NonClientAreaMouseButtonRelease:
+    case QEvent::NonClientAreaMouseMove:
+        return Category_Mouse;
+    case QEvent::Move:
+        return Category_Move;
+    case QEvent::ParentChange:
+        return Category_ParentChange;
+    default:
+        return Category_None;
+    }
+}
+
+EventRouter::Category EventRouter::categoryForType(EventType type)
+{
+    switch (type) {
+    case MouseEvents:
+        return Category_Mouse;
+    case MoveEvents:
+        return Category_Move;
+    case ParentChangeEvents:
+        return Category_ParentChange;
+    }
+
+    return Category_None;
+}
+
+void EventRouter::addRoute(QObject *receiver, QObject *listener, EventTypes types)
+{
+    if (!receiver || !listener) {
+        qWarning() << Q_FUNC_INFO << "Invalid route" << receiver << listener;
+        return;
+    }
+
+    QCoreApplication *app = QCoreApplication::instance();
+    if (app && app != m_installedOn) {
+        app->installEventFilter(this);
+        m_installedOn = app;
+    }
+
+    for (EventType type : { MouseEvents, MoveEvents, ParentChangeEvents }) {
+        if (!(types & type))
+            continue;
+
+        Listeners &listeners = m_routes[categoryForType(type)][receiver];
+        if (!listeners.contains(listener))
+            listeners.push_back(listener);
+    }
+
+    m_receiversByListener[listener].insert(receiver);
+
+    // So neither dangles, nor gets events routed to it if its address is reused
+    connect(receiver, &QObject::destroyed, this, &EventRouter::onObjectDestroyed, Qt::UniqueConnection);
+    connect(listener, &QObject::destroyed, this, &EventRouter::onObjectDestroyed, Qt::UniqueConnection);
+}
+
+void EventRouter::removeRoute(QObject *receiver, QObject *listener)
+{
+    auto it = m_receiversByListener.find(listener);
+    if (it == m_receiversByListener.end())
+        return;
+
+    it->remove(receiver);
+    if (it->isEmpty())
+        m_receiversByListener.erase(it);
+
+    removeListenerFromReceiver(receiver, listener);
+}
+
+void EventRouter::removeListenerFromReceiver(QObject *receiver, QObject *listener)
+{
+    for (QHash<QObject *, Listeners> &routes : m_routes) {
+        auto it = routes.find(receiver);
+        if (it == routes.end())
+            continue;
+
+        it->removeAll(listener);
+        if (it->isEmpty())
+            routes.erase(it);
+    }
+}
+
+bool EventRouter::hasRoute(QObject *receiver, QObject *listener, EventType type) const
+{
+    return m_routes[categoryForType(type)].value(receiver).contains(listener);
+}
+
+void EventRouter::onObjectDestroyed(QObject *obj)
+{
+    // As a receiver
+    for (QHash<QObject *, Listeners> &routes : m_routes) {
+        const Listeners listeners = routes.take(obj);
+        for (QObject *listener : listeners) {
+            auto it = m_receiversByListener.find(listener);
+            if (it == m_receiversByListener.end())
+                continue;
+
+            it->remove(obj);
+            if (it->isEmpty())
+                m_receiversByListener.erase(it);
+        }
+    }
+
+    // As a listener
+    const QSet<QObject *> receivers = m_receiversByListener.take(obj);
+    for (QObject *receiver : receivers)
+        removeListenerFromReceiver(receiver, obj);
+}
+
+bool EventRouter::eventFilter(QObject *o, QEvent *e)
+{
+    const Category category = categoryForEvent(e->type());
+    if (category == Category_None)
+        return false;
+
+    const QHash<QObject *, Listeners> &routes = m_routes[category];
+    auto it = routes.constFind(o);
+    if (it == routes.cend())
+        return false;
+
+    // Listeners might add or remove routes while handling the event. The copy is implicitly shared.
+    const Listeners listeners = *it;
+    for (int i = listeners.size() - 1; i >= 0; --i) {
+        QObject *listener = listeners.at(i);
+        if (i != listeners.size() - 1 && !m_routes[category].value(o).contains(listener))
+            continue; // Removed by the previous listener
+
+        if (listener->eventFilter(o, e))
+            return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,96 @@
+/*
+  This file is part of KDDockWidgets.
+
+  Copyright (C) 2018-2019 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com
+  Author: Sérgio Martins <sergio.martins@kdab.com>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef KD_EVENTROUTER_P_H
+#define KD_EVENTROUTER_P_H
+
+#include "docks_export.h"
+
+#include <QObject>
+#include <QEvent>
+#include <QHash>
+#include <QPointer>
+#include <QSet>
+#include <QVector>
+
+class QCoreApplication;
+
+namespace KDDockWidgets {
+
+/**
+ * @brief Routes the few event types the docking widgets care about to the components listening to them.
+ *
+ * A single application event filter replaces the event filters that used to be installed on each
+ * TitleBar, TabBar, Frame and floating window. Any other event type is rejected by a switch, while
+ * the listeners of a receiver are found with one hash lookup, in the table of the event's category.
+ *
+ * Listeners get the events through their QObject::eventFilter(), the most recently added first,
+ * and can stop further handling by returning true, just like with installEventFilter().
+ */
+class DOCKS_EXPORT_FOR_UNIT_TESTS EventRouter : public QObject
+{
+    Q_OBJECT
+public:
+    enum EventType {
+        MouseEvents = 1, ///< Mouse press, release and move, including the non-client area ones
+        MoveEvents = 2,
+        ParentChangeEvents = 4
+    };
+    Q_DECLARE_FLAGS(EventTypes, EventType)
+
+    static EventRouter *instance();
+
+    ///@brief Routes the events of @p types received by @p receiver to @p listener
+    void addRoute(QObject *receiver, QObject *listener, EventTypes types);
+
+    ///@brief Stops routing events received by @p receiver to @p listener
+    void removeRoute(QObject *receiver, QObject *listener);
+
+    ///@brief returns whether events of @p type received by @p receiver are routed to @p listener
+    bool hasRoute(QObject *receiver, QObject *listener, EventType type) const;
+
+protected:
+    bool eventFilter(QObject *, QEvent *) override;
+
+private:
+    enum Category {
+        Category_None = -1,
+        Category_Mouse = 0,
+        Category_Move,
+        Category_ParentChange,
+        Category_Count
+    };
+
+    typedef QVector<QObject *> Listeners;
+
+    EventRouter();
+    static Category categoryForEvent(QEvent::Type);
+    static Category categoryForType(EventType);
+    void onObjectDestroyed(QObject *);
+    void removeListenerFromReceiver(QObject *receiver, QObject *listener);
+
+    QHash<QObject *, Listeners> m_routes[Category_Count];
+    QHash<QObject *, QSet<QObject *>> m_receiversByListener; // The reverse index, so destroying a listener is cheap
+    QPointer<QCoreApplication> m_installedOn; // So the filter is reinstalled if the application is recreated
+};
+
+}
+
+#endif
@@ -178,12 +178,18 @@ void FloatingWindow::onFrameCountChanged(int count)
 {
     qCDebug(docking) << "FloatingWindow::onFrameCountChanged" << count;
     if (count == 0) {
-        deleteLater();
+        if (m_deletesItselfWhenEmpty)
+            deleteLater();
     } else {
         updateTitleBarVisibility();
     }
 }
 
+void FloatingWindow::setDeletesItselfWhenEmpty(bool deletes)
+{
+    m_deletesItselfWhenEmpty = deletes;
+}
+
 void FloatingWindow::onVisibleFrameCountChanged(int count)
 {
     if (!m_disableSetVisible) {
@@ -70,6 +70,12 @@ public:
      */
     bool hasSingleDockWidget() const;
 
+    /**
+     * @brief Sets whether the FloatingWindow deletes itself when its last Frame is removed, which
+     * is the default. Used to keep empty FloatingWindows for reuse when restoring layouts.
+     */
+    void setDeletesItselfWhenEmpty(bool);
+
     ///@brief For tests-only. Returns the number of Frame instances in the whole application.
     static int dbg_numFrames();
 
@@ -92,6 +98,7 @@ private:
     QVBoxLayout *const m_vlayout;
     DropArea *const m_dropArea;
     bool m_disableSetVisible = false;
+    bool m_deletesItselfWhenEmpty = true;
 };
 }
 
@@ -158,7 +158,7 @@ void Frame::removeWidget(DockWidget *dw)
 void Frame::onDockWidgetCountChanged()
 {
     qCDebug(docking) << "Frame::onDockWidgetCountChanged:" << this << "; widgetCount=" << dockWidgetCount();
-    if (isEmpty() && !isCentralFrame()) {
+    if (isEmpty() && !isCentralFrame() && m_deletesItselfWhenEmpty) {
         qCDebug(creation) << "Frame::onDockWidgetCountChanged: deleteLater on" << this;
         deleteLater();
     } else {
@@ -166,6 +166,11 @@ void Frame::onDockWidgetCountChanged()
     }
 }
 
+void Frame::setDeletesItselfWhenEmpty(bool deletes)
+{
+    m_deletesItselfWhenEmpty = deletes;
+}
+
 void Frame::updateTitleBarVisibility()
 {
     if (!m_dropArea)
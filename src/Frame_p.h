@@ -153,6 +153,12 @@ public:
     ///@brief returns whether there's 0 dock widgets. If not persistent then the Frame will delete itself.
     bool isEmpty() const { return dockWidgetCount() == 0; }
 
+    /**
+     * @brief Sets whether the Frame deletes itself when its last dock widget is removed, which is the default.
+     * Central frames never do. Used to keep empty Frames for reuse when restoring layouts.
+     */
+    void setDeletesItselfWhenEmpty(bool);
+
     ///@brief returns whether there's only 1 dock widget.
     bool hasSingleDockWidget() const { return dockWidgetCount() == 1; }
 
@@ -191,6 +197,7 @@ private:
     const Options m_options;
     const quint64 m_id;
     QPointer<Item> m_layoutItem;
+    bool m_deletesItselfWhenEmpty = true;
 };
 }
 
@@ -46,6 +46,11 @@ namespace KDDockWidgets
     };
     Q_DECLARE_FLAGS(MainWindowOptions, MainWindowOption)
 
+    class DockWidget;
+
+    ///@brief Creates the DockWidget called @p name, see LayoutSaver::setDockWidgetFactory()
+    typedef DockWidget *(*DockWidgetFactoryFunc)(const QString &name);
+
     enum AddingOption {
         AddingOption_None = 0,
         AddingOption_StartHidden ///< Don't show the dock widget when adding it
@@ -26,19 +26,37 @@
  */
 
 #include "LayoutSaver.h"
+#include "LayoutSaver_p.h"
 #include "DockRegistry_p.h"
 #include "DockWidget.h"
 #include "DropArea_p.h"
 #include "Logging_p.h"
 #include "Frame_p.h"
+#include "FloatingWindow_p.h"
 #include "multisplitter/Anchor_p.h"
 #include "multisplitter/Item_p.h"
+#include "multisplitter/LayoutEngineAdapter_p.h"
 
 #include <QDataStream>
 #include <QDebug>
 #include <QSettings>
 #include <QApplication>
-
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QPointer>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QSet>
+#include <QStringList>
+#include <QThreadPool>
+#include <QTimer>
+#include <QStandardPaths>
+
+#include <limits>
 #include <memory>
 
 using namespace KDDockWidgets;
@@ -70,7 +88,7 @@ struct WindowState {
 
     WindowState() = default;
 
-    void restore(QWidget *w)
+    void restore(QWidget *w) const
     {
         if (isTopLevel)
             w->setWindowFlag(Qt::Window, true);
@@ -86,6 +104,114 @@ struct WindowState {
     bool isVisible = false;
 };
 
+// Keys describing the structure of a layout, so a saved layout can be matched against a live one.
+// A Frame is identified by its dock widgets, an Anchor by the Frames at each of its sides.
+static QString frameKey(const QStringList &dockWidgetNames)
+{
+    return dockWidgetNames.join(QChar(0x1f));
+}
+
+static QStringList dockWidgetNames(const Frame *frame)
+{
+    QStringList names;
+    const DockWidget::List docks = frame->dockWidgets();
+    names.reserve(docks.size());
+    for (DockWidget *dw : docks)
+        names.push_back(dw->name());
+
+    return names;
+}
+
+static QString sideKey(QStringList frameKeys)
+{
+    frameKeys.sort();
+    return frameKeys.join(QChar(0x1e));
+}
+
+static QString anchorKey(Anchor::Type type, Qt::Orientation orientation,
+                         const QString &side1Key, const QString &side2Key)
+{
+    return QString::number(int(type)) + QLatin1Char(':') + QString::number(int(orientation))
+            + QLatin1Char(':') + side1Key + QChar(0x1d) + side2Key;
+}
+
+// Decoded data can have any value. An anchor is either normal or exactly one of the four static
+// ones, which have a fixed orientation.
+static bool isValidAnchorType(quint64 type, quint64 orientation)
+{
+    const bool isVertical = orientation == quint64(Qt::Vertical);
+    const bool isHorizontal = orientation == quint64(Qt::Horizontal);
+
+    switch (type) {
+    case Anchor::Type_None:
+        return isVertical || isHorizontal;
+    case Anchor::Type_LeftStatic:
+    case Anchor::Type_RightStatic:
+        return isVertical;
+    case Anchor::Type_TopStatic:
+    case Anchor::Type_BottomStatic:
+        return isHorizontal;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Maps a saved LayoutState onto a live layout that has the same structure.
+ *
+ * Is only valid if every saved Anchor and Frame has a live counterpart, and vice-versa.
+ */
+struct LayoutMatch
+{
+    bool isValid() const { return !anchorByIndex.isEmpty(); }
+
+    QHash<int, Anchor*> anchorByIndex;
+    QHash<quint64, Frame*> frameById;
+};
+
+/**
+ * @brief Frames taken out of layouts which are being rebuilt, so LayoutState::restore() can reuse
+ * them instead of creating new ones. They're keyed by the names of the dock widgets they had when
+ * added.
+ *
+ * A pooled Frame keeps its dock widgets, so reusing it doesn't even add tabs. PerspectiveManager
+ * keeps the pool across switches, with the Frames emptied, so switching back reuses them too, and
+ * also pools the FloatingWindows which are rebuilt.
+ *
+ * Pooled Frames are children of a hidden holder widget, so they don't show up as top-levels.
+ */
+struct FramePool
+{
+    FramePool() = default;
+    ~FramePool();
+
+    ///@brief Takes @p frame out of its layout. Its dock widgets stay in it.
+    void add(Frame *frame);
+
+    ///@brief Hides @p fw and keeps it for reuse. It's unregistered from DockRegistry until taken.
+    /// Must be called before its Frames are added, otherwise it deletes itself once empty.
+    void addFloatingWindow(FloatingWindow *fw);
+
+    ///@brief Returns a pooled FloatingWindow, or a new one if there's none.
+    FloatingWindow *takeFloatingWindow();
+
+    ///@brief Returns a pooled Frame with @p options for the dock widgets named @p dockWidgets, or nullptr.
+    /// Frames which still have their dock widgets are preferred over emptied ones.
+    Frame *take(const QStringList &dockWidgets, Frame::Options options);
+
+    ///@brief Closes the dock widgets of the Frames which weren't reused. The Frames and
+    /// FloatingWindows are kept for the next restore if @p keepFrames, otherwise they're deleted.
+    void release(bool keepFrames);
+
+    QHash<QString, QVector<QPointer<Frame>>> m_frames;
+    QVector<QPointer<FloatingWindow>> m_floatingWindows;
+
+private:
+    Q_DISABLE_COPY(FramePool)
+    QWidget *holder();
+    std::unique_ptr<QWidget> m_holder;
+};
+
 struct LayoutState
 {
     struct FrameState {
@@ -153,6 +279,12 @@ struct LayoutState
                 return false;
             }
 
+            if (!isValidAnchorType(quint64(type), quint64(orientation))) {
+                if (warn)
+                    qWarning() << Q_FUNC_INFO << "Invalid type" << int(type) << "or orientation" << int(orientation);
+                return false;
+            }
+
             return true;
         }
 
@@ -161,6 +293,19 @@ struct LayoutState
             return type & Anchor::Type_Static;
         }
 
+        QString key() const
+        {
+            auto keyOf = [] (const FrameState::List &frames) {
+                QStringList frameKeys;
+                frameKeys.reserve(frames.size());
+                for (const FrameState &f : frames)
+                    frameKeys.push_back(frameKey(f.dockWidgets));
+                return sideKey(frameKeys);
+            };
+
+            return anchorKey(type, orientation, keyOf(side1FrameStates), keyOf(side2FrameStates));
+        }
+
         typedef QVector<AnchorState> List;
 
         static const QString s_magicMarker; // Just to validate serialize is simetric to deserialize
@@ -176,8 +321,7 @@ struct LayoutState
     };
 
     explicit LayoutState(const DropArea *a)
-        : m_dropArea(a)
-        , m_isInMainWindow(a->isInMainWindow())
+        : m_isInMainWindow(a->isInMainWindow())
         , m_isInFloatingWindow(a->isInFloatingWindow())
     {
         if (m_isInMainWindow) {
@@ -185,6 +329,11 @@ struct LayoutState
             // Needed since we support multiple main windows.
             m_name = name(a->parentWidget());
         }
+
+        const auto anchors = a->multiSplitterLayout()->anchors();
+        m_anchors.reserve(anchors.size());
+        for (Anchor *anchor : anchors)
+            m_anchors.push_back(AnchorState(anchor));
     }
 
     LayoutState() = default;
@@ -200,17 +349,49 @@ struct LayoutState
             return false;
         }
 
-        bool valid = true;
-        for (const auto &anchorState : m_anchors)
-            valid = valid && anchorState.isValid(warn);
+        // The whole graph is validated upfront, so restore() never has to stop halfway through
+        QHash<int, const AnchorState*> anchorsByIndex;
+        for (const auto &anchorState : m_anchors) {
+            if (!anchorState.isValid(warn))
+                return false;
+
+            if (anchorsByIndex.contains(anchorState.index)) {
+                if (warn)
+                    qWarning() << Q_FUNC_INFO << "Duplicate anchor index" << anchorState.index;
+                return false;
+            }
+
+            anchorsByIndex.insert(anchorState.index, &anchorState);
+        }
+
+        for (const auto &anchorState : m_anchors) {
+            for (int linkedIndex : { anchorState.fromIndex, anchorState.toIndex }) {
+                const AnchorState *linked = anchorsByIndex.value(linkedIndex);
+                if (!linked || linked->orientation == anchorState.orientation) {
+                    if (warn)
+                        qWarning() << Q_FUNC_INFO << "Invalid from/to" << linkedIndex
+                                   << "for anchor" << anchorState.index;
+                    return false;
+                }
+            }
+        }
 
-        return valid;
+        return true;
     }
 
-    void restore(DropArea *dropArea);
+    ///@brief Rebuilds @p dropArea. Frames are taken from @p pool when possible, instead of being created.
+    void restore(DropArea *dropArea, FramePool *pool = nullptr) const;
+
+    /**
+     * @brief Matches this layout against the one currently in @p dropArea.
+     * Returns an invalid match if they differ in anything other than positions and current tabs.
+     */
+    LayoutMatch match(const DropArea *dropArea) const;
+
+    ///@brief Restores positions and current tabs onto the existing Anchors and Frames of @p match
+    void restoreInPlace(DropArea *dropArea, const LayoutMatch &match) const;
 
     static const QString s_magicMarker; // Just to validate serialize is simetric to deserialize
-    const DropArea *m_dropArea = nullptr;
     bool m_isInMainWindow = false;
     bool m_isInFloatingWindow = false;
     QString m_name;
@@ -350,13 +531,9 @@ QDataStream &operator<<(QDataStream &ds, const KDDockWidgets::LayoutState &s)
     ds << s.m_isInFloatingWindow;
     ds << s.m_name;
 
-    const auto anchors = s.m_dropArea->multiSplitterLayout()->anchors();
-    ds << anchors.size();
-
-    for (Anchor *anchor : anchors) {
-        LayoutState::AnchorState anchorState(anchor);
+    ds << s.m_anchors.size();
+    for (const LayoutState::AnchorState &anchorState : s.m_anchors)
         ds << anchorState;
-    }
 
     if (!s.isValid(/*warn*/true))
         qWarning() << "Saving invalid layout";
@@ -386,7 +563,515 @@ QDataStream &operator>>(QDataStream &ds, KDDockWidgets::LayoutState &s)
     return ds;
 }
 
-void LayoutState::restore(DropArea *dropArea)
+// The compact format starts with s_formatMagic, the legacy one above has no header.
+// Names are stored once, in a string table, and referenced by index. Each frame is stored once per
+// layout and referenced by index from the anchors. Integers are varints.
+static const quint32 s_formatMagic = 0x4b44444c; // "KDDL"
+static const quint8 s_formatVersion = 2; // The legacy format counts as version 1
+
+///@brief Everything serializeLayout() saves
+struct SavedLayout
+{
+    typedef QPair<WindowState, LayoutState> Window;
+
+    QVector<WindowState> floatingDockWidgets;
+    QVector<Window> mainWindows;
+    QVector<Window> floatingWindows;
+};
+
+class LayoutWriter
+{
+public:
+    explicit LayoutWriter(QDataStream &ds)
+        : m_ds(ds)
+    {
+    }
+
+    ///@brief collects the strings of @p layout, which must be done before writeStringTable()
+    void addStrings(const SavedLayout &layout)
+    {
+        for (const WindowState &s : layout.floatingDockWidgets)
+            addString(s.name);
+
+        for (const auto *windows : { &layout.mainWindows, &layout.floatingWindows }) {
+            for (const SavedLayout::Window &window : *windows) {
+                addString(window.first.name);
+                addString(window.second.m_name);
+                for (const LayoutState::AnchorState &anchor : window.second.m_anchors) {
+                    for (const auto *frames : { &anchor.side1FrameStates, &anchor.side2FrameStates }) {
+                        for (const LayoutState::FrameState &frame : *frames) {
+                            for (const QString &dockName : frame.dockWidgets)
+                                addString(dockName);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    void writeHeader()
+    {
+        m_ds << s_formatMagic;
+        m_ds << s_formatVersion;
+    }
+
+    void writeStringTable()
+    {
+        writeVarint(quint64(m_strings.size()));
+        for (const QString &s : qAsConst(m_strings)) {
+            const QByteArray utf8 = s.toUtf8();
+            writeVarint(quint64(utf8.size()));
+            m_ds.writeRawData(utf8.constData(), utf8.size());
+        }
+    }
+
+    void write(const SavedLayout &layout)
+    {
+        writeVarint(quint64(layout.floatingDockWidgets.size()));
+        for (const WindowState &s : layout.floatingDockWidgets)
+            write(s);
+
+        for (const auto *windows : { &layout.mainWindows, &layout.floatingWindows }) {
+            writeVarint(quint64(windows->size()));
+            for (const SavedLayout::Window &window : *windows) {
+                write(window.first);
+                write(window.second);
+            }
+        }
+    }
+
+private:
+    void addString(const QString &s)
+    {
+        if (!m_stringIndexes.contains(s)) {
+            m_stringIndexes.insert(s, m_strings.size());
+            m_strings.push_back(s);
+        }
+    }
+
+    void writeString(const QString &s)
+    {
+        Q_ASSERT(m_stringIndexes.contains(s));
+        writeVarint(quint64(m_stringIndexes.value(s)));
+    }
+
+    void writeVarint(quint64 v)
+    {
+        while (v >= 0x80) {
+            m_ds << quint8((v & 0x7f) | 0x80);
+            v >>= 7;
+        }
+        m_ds << quint8(v);
+    }
+
+    void writeSignedVarint(qint64 v)
+    {
+        // ZigZag, so small negative numbers are small too
+        writeVarint((quint64(v) << 1) ^ quint64(v >> 63));
+    }
+
+    void write(const WindowState &s)
+    {
+        writeString(s.name);
+        writeSignedVarint(s.geometry.x());
+        writeSignedVarint(s.geometry.y());
+        writeSignedVarint(s.geometry.width());
+        writeSignedVarint(s.geometry.height());
+        writeVarint((s.isVisible ? 1 : 0) | (s.isTopLevel ? 2 : 0));
+    }
+
+    void write(const LayoutState &s)
+    {
+        writeVarint((s.m_isInMainWindow ? 1 : 0) | (s.m_isInFloatingWindow ? 2 : 0));
+        writeString(s.m_name);
+
+        // A frame is on the sides of several anchors, but only written once
+        QHash<quint64, int> frameIndexes;
+        LayoutState::FrameState::List frames;
+        for (const LayoutState::AnchorState &anchor : s.m_anchors) {
+            for (const auto *sideFrames : { &anchor.side1FrameStates, &anchor.side2FrameStates }) {
+                for (const LayoutState::FrameState &frame : *sideFrames) {
+                    if (!frameIndexes.contains(frame.id)) {
+                        frameIndexes.insert(frame.id, frames.size());
+                        frames.push_back(frame);
+                    }
+                }
+            }
+        }
+
+        writeVarint(quint64(frames.size()));
+        for (const LayoutState::FrameState &frame : qAsConst(frames)) {
+            writeVarint(quint64(int(frame.options)));
+            writeSignedVarint(frame.currentTabIndex);
+            writeVarint(frame.id);
+            writeVarint(quint64(frame.dockWidgets.size()));
+            for (const QString &dockName : frame.dockWidgets)
+                writeString(dockName);
+        }
+
+        // The anchor's own index is implicit, it's its position in the list
+        writeVarint(quint64(s.m_anchors.size()));
+        for (const LayoutState::AnchorState &anchor : s.m_anchors) {
+            writeVarint(quint64(anchor.type));
+            writeVarint(quint64(anchor.orientation));
+            writeSignedVarint(anchor.position);
+            writeSignedVarint(anchor.fromIndex);
+            writeSignedVarint(anchor.toIndex);
+            for (const auto *sideFrames : { &anchor.side1FrameStates, &anchor.side2FrameStates }) {
+                writeVarint(quint64(sideFrames->size()));
+                for (const LayoutState::FrameState &frame : *sideFrames)
+                    writeVarint(quint64(frameIndexes.value(frame.id)));
+            }
+        }
+    }
+
+    QDataStream &m_ds;
+    QStringList m_strings;
+    QHash<QString, int> m_stringIndexes;
+};
+
+class LayoutReader
+{
+public:
+    explicit LayoutReader(QDataStream &ds)
+        : m_ds(ds)
+    {
+    }
+
+    ///@brief returns false if the stream was truncated or had invalid counts or indexes
+    bool isValid() const
+    {
+        return m_valid && m_ds.status() == QDataStream::Ok;
+    }
+
+    void readStringTable()
+    {
+        // Counts aren't bounded for sequential devices, so nothing is reserved upfront
+        const int count = readCount();
+        for (int i = 0; i < count && isValid(); ++i) {
+            const int size = readCount();
+            const QByteArray utf8 = m_ds.device()->read(size);
+            if (utf8.size() != size) {
+                m_valid = false;
+                return;
+            }
+            m_strings.push_back(QString::fromUtf8(utf8));
+        }
+    }
+
+    void read(SavedLayout &layout)
+    {
+        const int numFloating = readCount();
+        for (int i = 0; i < numFloating && isValid(); ++i) {
+            WindowState s;
+            read(s);
+            layout.floatingDockWidgets.push_back(s);
+        }
+
+        for (auto *windows : { &layout.mainWindows, &layout.floatingWindows }) {
+            const int numWindows = readCount();
+            for (int i = 0; i < numWindows && isValid(); ++i) {
+                SavedLayout::Window window;
+                read(window.first);
+                read(window.second);
+                windows->push_back(window);
+            }
+        }
+    }
+
+private:
+    quint64 readVarint()
+    {
+        quint64 result = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            quint8 byte = 0;
+            m_ds >> byte;
+            if (m_ds.status() != QDataStream::Ok)
+                break;
+
+            result |= quint64(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return result;
+        }
+
+        m_valid = false;
+        return 0;
+    }
+
+    int readInt()
+    {
+        const quint64 v = readVarint();
+        return int(qint64(v >> 1) ^ -qint64(v & 1));
+    }
+
+    ///@brief reads a number of elements, which can't be more than the bytes left
+    int readCount()
+    {
+        const quint64 count = readVarint();
+        QIODevice *device = m_ds.device();
+        const qint64 bytesLeft = device->isSequential() ? std::numeric_limits<int>::max()
+                                                        : device->bytesAvailable();
+        if (count > quint64(bytesLeft)) {
+            m_valid = false;
+            return 0;
+        }
+
+        return int(count);
+    }
+
+    QString readString()
+    {
+        const quint64 index = readVarint();
+        if (index >= quint64(m_strings.size())) {
+            m_valid = false;
+            return QString();
+        }
+
+        return m_strings.at(int(index));
+    }
+
+    void read(WindowState &s)
+    {
+        s.name = readString();
+        const int x = readInt();
+        const int y = readInt();
+        const int width = readInt();
+        const int height = readInt();
+        s.geometry = QRect(x, y, width, height);
+        const quint64 flags = readVarint();
+        s.isVisible = flags & 1;
+        s.isTopLevel = flags & 2;
+    }
+
+    void read(LayoutState &s)
+    {
+        const quint64 flags = readVarint();
+        s.m_isInMainWindow = flags & 1;
+        s.m_isInFloatingWindow = flags & 2;
+        s.m_name = readString();
+
+        const int numFrames = readCount();
+        LayoutState::FrameState::List frames;
+        for (int i = 0; i < numFrames && isValid(); ++i) {
+            LayoutState::FrameState f;
+            f.options = Frame::Options(QFlag(int(readVarint())));
+            f.currentTabIndex = readInt();
+            f.id = readVarint();
+            const int numDocks = readCount();
+            for (int j = 0; j < numDocks && isValid(); ++j)
+                f.dockWidgets.push_back(readString());
+            frames.push_back(f);
+        }
+
+        const int numAnchors = readCount();
+        for (int i = 0; i < numAnchors && isValid(); ++i) {
+            LayoutState::AnchorState a;
+            a.index = i;
+            const quint64 type = readVarint();
+            const quint64 orientation = readVarint();
+            if (!isValidAnchorType(type, orientation)) {
+                m_valid = false;
+                break;
+            }
+            a.type = static_cast<Anchor::Type>(type);
+            a.orientation = static_cast<Qt::Orientation>(orientation);
+            a.position = readInt();
+            a.fromIndex = readInt();
+            a.toIndex = readInt();
+            for (auto *sideFrames : { &a.side1FrameStates, &a.side2FrameStates }) {
+                const int numSideFrames = readCount();
+                for (int j = 0; j < numSideFrames && isValid(); ++j) {
+                    const quint64 frameIndex = readVarint();
+                    if (frameIndex >= quint64(frames.size())) {
+                        m_valid = false;
+                        break;
+                    }
+                    sideFrames->push_back(frames.at(int(frameIndex)));
+                }
+            }
+            s.m_anchors.push_back(a);
+        }
+    }
+
+    QDataStream &m_ds;
+    QStringList m_strings;
+    bool m_valid = true;
+};
+
+static bool decodeLegacyLayout(QDataStream &ds, SavedLayout &layout)
+{
+    int numFloating;
+    ds >> numFloating;
+    for (int i = 0; i < numFloating && ds.status() == QDataStream::Ok; i++) {
+        WindowState windowState;
+        ds >> windowState;
+        layout.floatingDockWidgets.push_back(windowState);
+    }
+
+    for (auto *windows : { &layout.mainWindows, &layout.floatingWindows }) {
+        int numWindows;
+        ds >> numWindows;
+        for (int i = 0; i < numWindows && ds.status() == QDataStream::Ok; i++) {
+            SavedLayout::Window window;
+            ds >> window.first;
+            ds >> window.second;
+            windows->push_back(window);
+        }
+    }
+
+    return ds.status() == QDataStream::Ok;
+}
+
+static bool decodeLayout(QIODevice *device, SavedLayout &layout)
+{
+    // Peek, so sequential devices work too
+    quint32 magic = 0;
+    QDataStream(device->peek(sizeof(magic))) >> magic;
+
+    QDataStream ds(device);
+    if (magic != s_formatMagic)
+        return decodeLegacyLayout(ds, layout);
+
+    ds >> magic;
+    quint8 version = 0;
+    ds >> version;
+    if (version != s_formatVersion) {
+        qWarning() << Q_FUNC_INFO << "Unsupported format version" << version;
+        return false;
+    }
+
+    LayoutReader reader(ds);
+    reader.readStringTable();
+    reader.read(layout);
+    return reader.isValid();
+}
+
+void FramePool::add(Frame *frame)
+{
+    const QString key = frameKey(dockWidgetNames(frame));
+    qCDebug(restoring) << Q_FUNC_INFO << frame << key;
+
+    // Same as MultiSplitterLayout::addWidget() does when a Frame changes place. The Item turns into
+    // a placeholder, which is deleted as soon as the dock widgets drop their references to it.
+    frame->setParent(holder());
+    frame->setLayoutItem(nullptr);
+    frame->setDeletesItselfWhenEmpty(false);
+    m_frames[key].push_back(frame);
+}
+
+void FramePool::addFloatingWindow(FloatingWindow *fw)
+{
+    qCDebug(restoring) << Q_FUNC_INFO << fw;
+    fw->setDeletesItselfWhenEmpty(false);
+    fw->hide();
+    DockRegistry::self()->unregisterNestedWindow(fw);
+    m_floatingWindows.push_back(fw);
+}
+
+FloatingWindow *FramePool::takeFloatingWindow()
+{
+    while (!m_floatingWindows.isEmpty()) {
+        FloatingWindow *fw = m_floatingWindows.takeLast();
+        if (!fw)
+            continue;
+
+        fw->setDeletesItselfWhenEmpty(true);
+        DockRegistry::self()->registerNestedWindow(fw);
+        return fw;
+    }
+
+    return new FloatingWindow();
+}
+
+QWidget *FramePool::holder()
+{
+    if (!m_holder) {
+        m_holder.reset(new QWidget());
+        m_holder->setObjectName(QStringLiteral("_docks_FramePool_Holder"));
+    }
+
+    return m_holder.get();
+}
+
+Frame *FramePool::take(const QStringList &dockWidgets, Frame::Options options)
+{
+    auto it = m_frames.find(frameKey(dockWidgets));
+    if (it == m_frames.end())
+        return nullptr;
+
+    QVector<QPointer<Frame>> &frames = *it;
+    int candidate = -1;
+    for (int i = 0; i < frames.size(); ++i) {
+        Frame *frame = frames.at(i);
+        if (frame && frame->options() == options) {
+            candidate = i;
+            if (!frame->isEmpty())
+                break;
+        }
+    }
+
+    if (candidate == -1)
+        return nullptr;
+
+    Frame *frame = frames.at(candidate);
+    frames.remove(candidate);
+    frame->setDeletesItselfWhenEmpty(true);
+    return frame;
+}
+
+void FramePool::release(bool keepFrames)
+{
+    for (auto it = m_frames.begin(); it != m_frames.end();) {
+        QVector<QPointer<Frame>> kept;
+        for (Frame *frame : qAsConst(*it)) {
+            if (!frame)
+                continue;
+
+            const DockWidget::List docks = frame->dockWidgets();
+            for (DockWidget *dw : docks)
+                dw->close();
+
+            if (keepFrames)
+                kept.push_back(frame);
+            else
+                delete frame;
+        }
+
+        if (kept.isEmpty()) {
+            it = m_frames.erase(it);
+        } else {
+            *it = kept;
+            ++it;
+        }
+    }
+
+    for (FloatingWindow *fw : qAsConst(m_floatingWindows)) {
+        if (!fw)
+            continue;
+
+        // Only placeholders are left, so dock widgets don't get restored into a hidden window
+        if (keepFrames)
+            fw->dropArea()->multiSplitterLayout()->clear();
+        else
+            delete fw;
+    }
+
+    if (!keepFrames)
+        m_floatingWindows.clear();
+}
+
+FramePool::~FramePool()
+{
+    for (const QVector<QPointer<Frame>> &frames : qAsConst(m_frames)) {
+        for (Frame *frame : frames)
+            delete frame;
+    }
+
+    for (FloatingWindow *fw : qAsConst(m_floatingWindows))
+        delete fw;
+}
+
+void LayoutState::restore(DropArea *dropArea, FramePool *pool) const
 {
      if (!dropArea) {
          qWarning() << Q_FUNC_INFO << "MainWindow is missing a drop area";
@@ -399,14 +1084,19 @@ void LayoutState::restore(DropArea *dropArea)
          return;
      }
 
-     if (!dropArea->multiSplitterLayout()->checkSanity()) {
+     if (!dropArea->multiSplitterLayout()->verifySanity()) {
          qWarning() << "Drop area is not sane, refusing to restore";
          return;
      }
 
-     QHash<quint64, Frame*> framesById;
+     MultiSplitterLayout *layout = dropArea->multiSplitterLayout();
+
+     // Frames and separators only get their geometry once, when the transaction is committed
+     LayoutTransaction transaction(layout);
+
+     // Create the Anchors. They're only positioned once the whole graph is built, otherwise each
+     // setPosition() would resize items which aren't there yet.
      QHash<int, Anchor*> anchorByIndex;
-     // Create the Anchors
      for (const AnchorState &a : qAsConst(m_anchors)) {
          if (!a.isValid()) {
              qWarning() << "Ignoring invalid AnchorState for" << dropArea;
@@ -415,11 +1105,10 @@ void LayoutState::restore(DropArea *dropArea)
 
          Anchor *anchor = nullptr;
          if (a.isStatic()) {
-             anchor = dropArea->multiSplitterLayout()->staticAnchor(a.type);
+             anchor = layout->staticAnchor(a.type);
              Q_ASSERT(anchor);
          } else {
-             anchor = new Anchor(a.orientation, dropArea->multiSplitterLayout());
-             anchor->setPosition(a.position);
+             anchor = new Anchor(a.orientation, layout);
          }
 
          anchorByIndex.insert(a.index, anchor);
@@ -440,51 +1129,235 @@ void LayoutState::restore(DropArea *dropArea)
 
      if (auto cf = dropArea->centralFrame()) {
          // Remove the built-in frame, it's much easier to just restore everything
-         dropArea->multiSplitterLayout()->removeItem(cf);
+         layout->removeItem(cf);
          delete cf;
      }
 
+     // Create the frames. Each one is on the side of several anchors, but only created once.
+     QHash<quint64, Item*> itemsById;
+     ItemList items;
      for (const AnchorState &a : qAsConst(m_anchors)) {
          if (!a.isValid())
              continue;
 
-         Anchor *anchor = anchorByIndex.value(a.index);
+         for (const FrameState::List *frames : { &a.side1FrameStates, &a.side2FrameStates }) {
+             for (const FrameState &f : *frames) {
+                 if (itemsById.contains(f.id))
+                     continue;
 
-         auto restoreFrames = [&framesById, anchor, dropArea] (Anchor::Side side, const LayoutState::FrameState::List &frames) {
-             for (LayoutState::FrameState f : qAsConst(frames)) {
-                 Frame *frame = nullptr;
-                 if (framesById.contains(f.id)) {
-                     frame = framesById.value(f.id);
-                 } else {
+                 Frame *frame = pool ? pool->take(f.dockWidgets, f.options) : nullptr;
+                 if (!frame)
                      frame = new Frame(nullptr, f.options);
-                     auto item = new Item(frame, dropArea->multiSplitterLayout());
-                     framesById.insert(f.id, frame);
-
-                     // qCDebug(restoring) << "Restoring frame name =" << frameName << "; numDocks=" << f.dockWidgets.size();
-                     for (const QString &dockWidgetName : qAsConst(f.dockWidgets)) {
-                         DockWidget *dw = DockRegistry::self()->dockByName(dockWidgetName);
-                         frame->addWidget(dw);
+                 auto item = new Item(frame, layout);
+                 itemsById.insert(f.id, item);
+                 items.push_back(item);
+
+                 // Items get their edges from several anchors, one at a time. Don't let them push
+                 // anchors around while only some of the edges are set.
+                 item->beginBlockPropagateGeo();
+
+                 // The frame isn't in a layout nor shown yet, so adding tabs is cheap. A pooled frame
+                 // already has them. Only the current tab's dock widget is created by the factory,
+                 // the others get a placeholder until they become current.
+                 if (frame->isEmpty()) {
+                     DockRegistry *registry = DockRegistry::self();
+                     for (int i = 0, end = f.dockWidgets.size(); i < end; ++i) {
+                         const QString &dockWidgetName = f.dockWidgets.at(i);
+                         DockWidget *dw = i == f.currentTabIndex ? registry->dockByNameOrCreate(dockWidgetName)
+                                                                 : registry->dockByNameOrPlaceholder(dockWidgetName);
+                         if (dw)
+                             frame->addWidget(dw);
+                         else
+                             qWarning() << Q_FUNC_INFO << "Unknown DockWidget" << dockWidgetName;
                      }
-
-                     frame->setCurrentTabIndex(f.currentTabIndex);
-                     dropArea->multiSplitterLayout()->addItems_internal({ item }, /*updateSizeConstraints=*/ false);
-
                  }
 
-                 anchor->addItem(dropArea->multiSplitterLayout()->itemForFrame(frame), side);
+                 frame->setCurrentTabIndex(f.currentTabIndex);
              }
-         };
-
-         restoreFrames(Anchor::Side1, a.side1FrameStates);
-         restoreFrames(Anchor::Side2, a.side2FrameStates);
+         }
      }
 
-     dropArea->multiSplitterLayout()->updateSizeConstraints();
-     if (!dropArea->multiSplitterLayout()->checkSanity()) {
-         qWarning() << "Restored an invalid layout, this should not happen";
-     }
+     layout->addItems_internal(items, /*updateSizeConstraints=*/ false);
+
+     for (const AnchorState &a : qAsConst(m_anchors)) {
+         if (!a.isValid())
+             continue;
+
+         Anchor *anchor = anchorByIndex.value(a.index);
+         for (const FrameState &f : qAsConst(a.side1FrameStates))
+             anchor->addItem(itemsById.value(f.id), Anchor::Side1);
+         for (const FrameState &f : qAsConst(a.side2FrameStates))
+             anchor->addItem(itemsById.value(f.id), Anchor::Side2);
+     }
+
+     for (Item *item : qAsConst(items))
+         item->endBlockPropagateGeo();
+
+     // The graph is complete. Position the anchors on a snapshot, each one sets an edge of the items
+     // at its sides, and apply the result once.
+     LayoutEngineAdapter adapter(layout);
+     LayoutEngine &engine = adapter.engine();
+     engine.setBlockPropagateGeo(true);
+     for (const AnchorState &a : qAsConst(m_anchors)) {
+         if (a.isValid() && !a.isStatic())
+             engine.setAnchorPosition(adapter.indexOf(anchorByIndex.value(a.index)), a.position);
+     }
+     engine.setBlockPropagateGeo(false);
+     adapter.apply();
+
+     layout->updateSizeConstraints();
+     if (!layout->verifySanity()) {
+         qWarning() << "Restored an invalid layout, this should not happen";
+     }
+}
+
+LayoutMatch LayoutState::match(const DropArea *dropArea) const
+{
+    if (!dropArea || !isValid())
+        return {};
+
+    MultiSplitterLayout *layout = dropArea->multiSplitterLayout();
+    const Anchor::List anchors = layout->anchors();
+    if (anchors.size() != m_anchors.size())
+        return {};
+
+    QHash<QString, Frame*> liveFrames;
+    auto keyOf = [&liveFrames] (const ItemList &items, QString &key) {
+        QStringList frameKeys;
+        frameKeys.reserve(items.size());
+        for (Item *item : items) {
+            Frame *frame = item->frame();
+            if (!frame) // Placeholders aren't supported by save/restore
+                return false;
+
+            const QString k = frameKey(dockWidgetNames(frame));
+            Frame *existing = liveFrames.value(k);
+            if (existing && existing != frame)
+                return false; // Ambiguous, two frames with the same content
+
+            liveFrames.insert(k, frame);
+            frameKeys.push_back(k);
+        }
+
+        key = sideKey(frameKeys);
+        return true;
+    };
+
+    QHash<QString, Anchor*> liveAnchors;
+    for (Anchor *anchor : anchors) {
+        QString side1Key;
+        QString side2Key;
+        if (!keyOf(anchor->side1Items(), side1Key) || !keyOf(anchor->side2Items(), side2Key))
+            return {};
+
+        liveAnchors.insert(anchorKey(anchor->type(), anchor->orientation(), side1Key, side2Key), anchor);
+    }
+
+    if (liveAnchors.size() != anchors.size())
+        return {};
+
+    LayoutMatch result;
+    QSet<Anchor*> matchedAnchors;
+    for (const AnchorState &a : m_anchors) {
+        Anchor *anchor = liveAnchors.value(a.key());
+        if (!anchor || matchedAnchors.contains(anchor))
+            return {};
+
+        matchedAnchors.insert(anchor);
+        result.anchorByIndex.insert(a.index, anchor);
+    }
+
+    for (const AnchorState &a : m_anchors) {
+        Anchor *anchor = result.anchorByIndex.value(a.index);
+        if (!a.isStatic() && (anchor->from() != result.anchorByIndex.value(a.fromIndex) ||
+                              anchor->to() != result.anchorByIndex.value(a.toIndex)))
+            return {};
+
+        for (const FrameState::List *frames : { &a.side1FrameStates, &a.side2FrameStates }) {
+            for (const FrameState &f : *frames) {
+                Frame *frame = liveFrames.value(frameKey(f.dockWidgets));
+                if (!frame || frame->options() != f.options)
+                    return {};
+
+                result.frameById.insert(f.id, frame);
+            }
+        }
+    }
+
+    if (result.frameById.size() != liveFrames.size())
+        return {};
+
+    return result;
+}
+
+void LayoutState::restoreInPlace(DropArea *dropArea, const LayoutMatch &match) const
+{
+    MultiSplitterLayout *layout = dropArea->multiSplitterLayout();
+    qCDebug(restoring) << Q_FUNC_INFO << "Reusing" << match.frameById.size() << "frames and"
+                       << match.anchorByIndex.size() << "anchors";
+
+    LayoutTransaction transaction(layout);
+
+    // Anchors are moved one at a time, don't let the items in between push the others around
+    LayoutEngineAdapter adapter(layout);
+    LayoutEngine &engine = adapter.engine();
+    engine.setBlockPropagateGeo(true);
+    for (const AnchorState &a : qAsConst(m_anchors)) {
+        if (!a.isStatic())
+            engine.setAnchorPosition(adapter.indexOf(match.anchorByIndex.value(a.index)), a.position);
+    }
+    engine.setBlockPropagateGeo(false);
+    adapter.apply();
+
+    for (const AnchorState &a : qAsConst(m_anchors)) {
+        for (const FrameState::List *frames : { &a.side1FrameStates, &a.side2FrameStates }) {
+            for (const FrameState &f : *frames)
+                match.frameById.value(f.id)->setCurrentTabIndex(f.currentTabIndex);
+        }
+    }
+
+    layout->updateSizeConstraints();
+    if (!layout->verifySanity()) {
+        qWarning() << "Restored an invalid layout, this should not happen";
+    }
+}
+
+}
+
+static QByteArray encodeLayout(const SavedLayout &layout)
+{
+    QByteArray result;
+    QDataStream ds(&result, QIODevice::WriteOnly);
+    LayoutWriter writer(ds);
+    writer.addStrings(layout);
+    writer.writeHeader();
+    writer.writeStringTable();
+    writer.write(layout);
+
+    return result;
+}
+
+static bool writeFileAtomically(const QString &fileName, const QByteArray &data)
+{
+    // QSaveFile writes to a temporary file and renames it on commit, so a crash never leaves
+    // a truncated file behind
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << Q_FUNC_INFO << "Failed to open" << fileName << file.errorString();
+        return false;
+    }
+
+    if (file.write(data) != data.size() || !file.commit()) {
+        qWarning() << Q_FUNC_INFO << "Failed to write" << fileName << file.errorString();
+        return false;
+    }
+
+    return true;
 }
 
+static bool writeLayoutFile(const QString &fileName, const SavedLayout &layout)
+{
+    return writeFileAtomically(fileName, encodeLayout(layout));
 }
 
 class KDDockWidgets::LayoutSaver::Private
@@ -497,7 +1370,12 @@ public:
 
     DockWidget::List floatingDockWidgets() const;
     MainWindow::List mainWindows() const;
+    SavedLayout captureLayout() const;
+    ///@brief Restores @p layout. Frames are pooled in @p persistentPool, if passed, so later restores can reuse them
+    bool restore(const SavedLayout &layout, FramePool *persistentPool = nullptr);
     std::unique_ptr<QSettings> settings() const;
+    static QString layoutFileName();
+    static bool ensureDirectoryFor(const QString &fileName);
     DockRegistry *const m_dockRegistry;
 };
 
@@ -519,17 +1397,70 @@ bool LayoutSaver::saveToDisk()
         return false;
     }
 
-    const QByteArray data = serializeLayout();
-    d->settings()->setValue(QStringLiteral("data"), data);
-    return true;
+    const QString fileName = Private::layoutFileName();
+    if (!Private::ensureDirectoryFor(fileName))
+        return false;
+
+    return saveToFile(fileName);
 }
 
 void LayoutSaver::restoreFromDisk()
 {
+    const QString fileName = Private::layoutFileName();
+    if (QFile::exists(fileName)) {
+        restoreFromFile(fileName);
+        return;
+    }
+
+    // Layouts saved by older versions live in QSettings
     const QByteArray data = d->settings()->value(QStringLiteral("data")).toByteArray();
     restoreLayout(data);
 }
 
+bool LayoutSaver::saveToFile(const QString &fileName)
+{
+    return writeLayoutFile(fileName, d->captureLayout());
+}
+
+bool LayoutSaver::restoreFromFile(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << Q_FUNC_INFO << "Failed to open" << fileName << file.errorString();
+        return false;
+    }
+
+    const qint64 size = file.size();
+    if (size == 0)
+        return true;
+
+    // Decode straight from the mapped pages. fromRawData() doesn't copy, and neither does the
+    // QBuffer restoreLayout() reads it through.
+    if (uchar *mapped = file.map(0, size)) {
+        const bool result = restoreLayout(QByteArray::fromRawData(reinterpret_cast<const char*>(mapped), int(size)));
+        file.unmap(mapped);
+        return result;
+    }
+
+    return restoreLayout(&file);
+}
+
+bool LayoutSaver::Private::ensureDirectoryFor(const QString &fileName)
+{
+    if (!QDir().mkpath(QFileInfo(fileName).absolutePath())) {
+        qWarning() << Q_FUNC_INFO << "Failed to create directory for" << fileName;
+        return false;
+    }
+
+    return true;
+}
+
+QString LayoutSaver::Private::layoutFileName()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)
+            + QStringLiteral("/kddockwidgets_layout.bin");
+}
+
 std::unique_ptr<QSettings> LayoutSaver::Private::settings() const
 {
     auto settings = std::unique_ptr<QSettings>(new QSettings(qApp->organizationName(),
@@ -541,61 +1472,194 @@ std::unique_ptr<QSettings> LayoutSaver::Private::settings() const
 
 QByteArray LayoutSaver::serializeLayout() const
 {
+    return encodeLayout(d->captureLayout());
+}
+
+#if defined(DOCKS_DEVELOPER_MODE)
+QByteArray LayoutSaver::serializeLayout_legacy() const
+{
+    const SavedLayout layout = d->captureLayout();
+
     QByteArray result;
     QDataStream ds(&result, QIODevice::WriteOnly);
 
-    // Save floating dock widgets (just geometry and visibility):
-    const DockWidget::List floatingDocks = d->floatingDockWidgets();
-    ds << floatingDocks.size();
-    for (auto floating : floatingDocks) {
-        WindowState state(floating, floating->name());
+    ds << layout.floatingDockWidgets.size();
+    for (const WindowState &state : layout.floatingDockWidgets)
         ds << state;
+
+    for (const auto *windows : { &layout.mainWindows, &layout.floatingWindows }) {
+        ds << windows->size();
+        for (const SavedLayout::Window &window : *windows) {
+            ds << window.first;
+            ds << window.second;
+        }
     }
 
-    // Save main windows (geometry, visibility and dockwidget layout):
-    auto mainWindows = d->mainWindows();
+    return result;
+}
+#endif
 
-    ds << mainWindows.size();
-    for (auto mainWindow : mainWindows) {
-        WindowState windowState(mainWindow, mainWindow->name());
-        LayoutState layoutState(mainWindow->dropArea());
-        ds << windowState;
-        ds << layoutState;
+bool LayoutSaver::restoreLayout(const QByteArray &data)
+{
+    if (data.isEmpty())
+        return true;
+
+    QBuffer buffer;
+    buffer.setData(data); // Shallow copy
+    buffer.open(QIODevice::ReadOnly);
+    return restoreLayout(&buffer);
+}
+
+bool LayoutSaver::restoreLayout(QIODevice *device)
+{
+    if (!device || !device->isReadable()) {
+        qWarning() << Q_FUNC_INFO << "Device isn't readable" << device;
+        return false;
     }
 
-    // Save the floating nested windows:
-    const auto floatingNestedWindows = d->m_dockRegistry->nestedwindows();
-    ds << floatingNestedWindows.size();
-    for (auto window : floatingNestedWindows) {
-        WindowState windowState(window, QString());
-        LayoutState layoutState(window->dropArea());
-        ds << windowState;
-        ds << layoutState;
+    SavedLayout layout;
+    if (!decodeLayout(device, layout)) {
+        qWarning() << Q_FUNC_INFO << "Layout data is corrupted, not restoring";
+        return false;
     }
 
-    return result;
+    return d->restore(layout);
 }
 
-void LayoutSaver::restoreLayout(const QByteArray &data)
+void LayoutSaver::setDockWidgetFactory(DockWidgetFactoryFunc factory)
 {
-    if (data.isEmpty())
-        return;
+    DockRegistry::setDockWidgetFactory(factory);
+}
 
-    // Hide all dockwidgets and unparent them from any layout before starting restore
-    d->m_dockRegistry->closeAllDockWidgets();
+DockWidgetFactoryFunc LayoutSaver::dockWidgetFactory()
+{
+    return DockRegistry::dockWidgetFactory();
+}
 
-    QDataStream ds(data);
+bool LayoutSaver::Private::restore(const SavedLayout &layout, FramePool *persistentPool)
+{
+    // Windows whose layout only differs in positions and current tabs keep their Frames and
+    // separators. Everything else is rebuilt.
+    QHash<MainWindow*, LayoutMatch> mainWindowMatches;
+    QSet<DockWidget*> reusedDockWidgets;
+    auto reuse = [&reusedDockWidgets] (const LayoutMatch &match) {
+        for (Frame *frame : match.frameById) {
+            const DockWidget::List docks = frame->dockWidgets();
+            for (DockWidget *dw : docks)
+                reusedDockWidgets.insert(dw);
+        }
+    };
 
-    // Restore geometry and visibility of floating dock widgets:
-    int numFloating;
-    ds >> numFloating;
-    DockWidget::List floatingDocks;
-    floatingDocks.reserve(numFloating);
-    for (int i = 0; i < numFloating; i++) {
-        WindowState windowState;
-        ds >> windowState;
+    for (const SavedLayout::Window &window : layout.mainWindows) {
+        MainWindow *w = m_dockRegistry->mainWindowByName(window.first.name);
+        if (!w)
+            continue;
+
+        const LayoutMatch match = window.second.match(w->dropArea());
+        if (match.isValid()) {
+            mainWindowMatches.insert(w, match);
+            reuse(match);
+        }
+    }
+
+    // Floating windows have no name, any one with the same contents is reused
+    QVector<QPair<FloatingWindow*, LayoutMatch>> floatingWindowMatches;
+    floatingWindowMatches.reserve(layout.floatingWindows.size());
+    QVector<FloatingWindow*> availableFloatingWindows = m_dockRegistry->nestedwindows();
+    for (const SavedLayout::Window &window : layout.floatingWindows) {
+        QPair<FloatingWindow*, LayoutMatch> result = { nullptr, LayoutMatch() };
+        for (FloatingWindow *fw : qAsConst(availableFloatingWindows)) {
+            const LayoutMatch match = window.second.match(fw->dropArea());
+            if (match.isValid()) {
+                result = { fw, match };
+                availableFloatingWindows.removeOne(fw);
+                reuse(match);
+                break;
+            }
+        }
+
+        floatingWindowMatches.push_back(result);
+    }
+
+    // Windows which are rebuilt give up the Frames which the new layout needs again, dock widgets
+    // included. Those are only repositioned, instead of being closed and tabbed again. A persistent
+    // pool takes the other Frames too, empty, for the layouts restored later.
+    QSet<QString> wantedFrameKeys;
+    auto want = [&wantedFrameKeys] (const LayoutState &layoutState) {
+        for (const LayoutState::AnchorState &a : layoutState.m_anchors) {
+            for (const LayoutState::FrameState::List *frames : { &a.side1FrameStates, &a.side2FrameStates }) {
+                for (const LayoutState::FrameState &f : *frames)
+                    wantedFrameKeys.insert(frameKey(f.dockWidgets));
+            }
+        }
+    };
 
-        if (DockWidget *dw = d->m_dockRegistry->dockByName(windowState.name)) {
+    QVector<DropArea*> rebuiltDropAreas;
+    for (const SavedLayout::Window &window : layout.mainWindows) {
+        MainWindow *w = m_dockRegistry->mainWindowByName(window.first.name);
+        if (w && !mainWindowMatches.contains(w)) {
+            want(window.second);
+            rebuiltDropAreas.push_back(w->dropArea());
+        }
+    }
+
+    for (int i = 0, end = layout.floatingWindows.size(); i < end; ++i) {
+        if (!floatingWindowMatches.at(i).first)
+            want(layout.floatingWindows.at(i).second);
+    }
+
+    FramePool localPool;
+    FramePool &framePool = persistentPool ? *persistentPool : localPool;
+    for (FloatingWindow *fw : qAsConst(availableFloatingWindows)) {
+        // A persistent pool takes all of its Frames, so the emptied window is pooled too
+        if (persistentPool)
+            persistentPool->addFloatingWindow(fw);
+        rebuiltDropAreas.push_back(fw->dropArea());
+    }
+
+    QVector<Frame*> pooledFrames;
+    for (DropArea *dropArea : qAsConst(rebuiltDropAreas)) {
+        const ItemList items = dropArea->multiSplitterLayout()->items();
+        for (Item *item : items) {
+            Frame *frame = item->frame();
+            if (!frame || frame->isCentralFrame())
+                continue;
+
+            if (wantedFrameKeys.contains(frameKey(dockWidgetNames(frame)))) {
+                const DockWidget::List docks = frame->dockWidgets();
+                for (DockWidget *dw : docks)
+                    reusedDockWidgets.insert(dw);
+                pooledFrames.push_back(frame);
+            } else if (persistentPool) {
+                pooledFrames.push_back(frame);
+            }
+        }
+    }
+
+    for (Frame *frame : qAsConst(pooledFrames))
+        framePool.add(frame);
+
+    // Hide all other dockwidgets and unparent them from any layout before starting restore
+    if (reusedDockWidgets.isEmpty()) {
+        m_dockRegistry->closeAllDockWidgets();
+    } else {
+        const DockWidget::List dockWidgets = m_dockRegistry->dockwidgets();
+        for (DockWidget *dw : dockWidgets) {
+            if (!reusedDockWidgets.contains(dw))
+                dw->close();
+        }
+    }
+
+    // Restore geometry and visibility of floating dock widgets. Hidden ones which the factory can
+    // create are only created when needed, they just keep their geometry.
+    m_dockRegistry->clearPendingFloatingGeometries();
+    for (const WindowState &windowState : layout.floatingDockWidgets) {
+        DockWidget *existing = m_dockRegistry->dockByName(windowState.name);
+        if (!windowState.isVisible && DockRegistry::dockWidgetFactory() &&
+            (!existing || m_dockRegistry->isPlaceholder(existing))) {
+            qCDebug(restoring) << "Deferring hidden dockwidget" << windowState.name;
+            m_dockRegistry->setPendingFloatingGeometry(windowState.name, windowState.geometry);
+        } else if (DockWidget *dw = m_dockRegistry->dockByNameOrCreate(windowState.name)) {
             qCDebug(restoring) << "Restoring dockwidget" << dw << "; to=" << windowState.geometry;
             windowState.restore(dw);
         } else {
@@ -604,16 +1668,9 @@ void LayoutSaver::restoreLayout(const QByteArray &data)
     }
 
     // Restore geometry and visibility of main windows:
-    int numMainWindows;
-    ds >> numMainWindows;
-    MainWindow::List mainWindows;
-    mainWindows.reserve(numMainWindows);
-    for (int i = 0; i < numMainWindows; i++) {
-        WindowState windowState;
-        LayoutState layoutState;
-        ds >> windowState;
-        ds >> layoutState;
-        MainWindow *w = d->m_dockRegistry->mainWindowByName(windowState.name);
+    for (const SavedLayout::Window &window : layout.mainWindows) {
+        const WindowState &windowState = window.first;
+        MainWindow *w = m_dockRegistry->mainWindowByName(windowState.name);
         if (!w) {
             qWarning() << "Unable to restore MainWindow" << windowState.name
                      << "; You need to create it before restoring.";
@@ -624,24 +1681,72 @@ void LayoutSaver::restoreLayout(const QByteArray &data)
             windowState.restore(w);
 
         qCDebug(restoring) << "Restoring MainWindow";
-        layoutState.restore(w->dropArea());
+        const auto it = mainWindowMatches.constFind(w);
+        if (it != mainWindowMatches.cend())
+            window.second.restoreInPlace(w->dropArea(), *it);
+        else
+            window.second.restore(w->dropArea(), &framePool);
     }
 
     // Restore floating nested windows
-    int numNestedWindows;
-    ds >> numNestedWindows;
+    for (int i = 0, end = layout.floatingWindows.size(); i < end; ++i) {
+        const SavedLayout::Window &window = layout.floatingWindows.at(i);
+        const QPair<FloatingWindow*, LayoutMatch> &match = floatingWindowMatches.at(i);
+        qCDebug(restoring) << "Restoring FloatingWindow; reused=" << (match.first != nullptr);
+        if (match.first) {
+            window.first.restore(match.first);
+            window.second.restoreInPlace(match.first->dropArea(), match.second);
+        } else {
+            FloatingWindow *fw = framePool.takeFloatingWindow();
+            window.first.restore(fw);
+            window.second.restore(fw->dropArea(), &framePool);
+        }
+    }
+
+    // Frames the new layout didn't need after all
+    framePool.release(/*keepFrames=*/ persistentPool != nullptr);
+
+    return true;
+}
+
+SavedLayout LayoutSaver::Private::captureLayout() const
+{
+    SavedLayout layout;
 
-    for (int i = 0; i < numNestedWindows; i++) {
+    // Save floating dock widgets (just geometry and visibility):
+    const DockWidget::List floatingDocks = floatingDockWidgets();
+    layout.floatingDockWidgets.reserve(floatingDocks.size());
+    for (auto floating : floatingDocks)
+        layout.floatingDockWidgets.push_back(WindowState(floating, floating->name()));
+
+    // Hidden floating dock widgets which weren't created yet, saved as they were restored
+    const QHash<QString, QRect> pendingGeometries = m_dockRegistry->pendingFloatingGeometries();
+    QStringList pendingNames = pendingGeometries.keys();
+    pendingNames.sort(); // Deterministic output
+    for (const QString &pendingName : qAsConst(pendingNames)) {
         WindowState windowState;
-        LayoutState layoutState;
-        ds >> windowState;
-        ds >> layoutState;
+        windowState.name = pendingName;
+        windowState.geometry = pendingGeometries.value(pendingName);
+        windowState.isTopLevel = true;
+        windowState.isVisible = false;
+        layout.floatingDockWidgets.push_back(windowState);
+    }
+
+    // Save main windows (geometry, visibility and dockwidget layout):
+    const auto mainWindows = this->mainWindows();
+    layout.mainWindows.reserve(mainWindows.size());
+    for (auto mainWindow : mainWindows) {
+        layout.mainWindows.push_back({ WindowState(mainWindow, mainWindow->name()),
+                                       LayoutState(mainWindow->dropArea()) });
+    }
 
-        qCDebug(restoring) << "Restoring FloatingWindow";
-        auto fw = new FloatingWindow();
-        windowState.restore(fw);
-        layoutState.restore(fw->dropArea());
-    }    
+    // Save the floating nested windows:
+    const auto floatingNestedWindows = m_dockRegistry->nestedwindows();
+    layout.floatingWindows.reserve(floatingNestedWindows.size());
+    for (auto window : floatingNestedWindows)
+        layout.floatingWindows.push_back({ WindowState(window, QString()), LayoutState(window->dropArea()) });
+
+    return layout;
 }
 
 DockWidget::List LayoutSaver::Private::floatingDockWidgets() const
@@ -661,3 +1766,913 @@ MainWindow::List LayoutSaver::Private::mainWindows() const
     return m_dockRegistry->mainwindows();
 }
 
+class KDDockWidgets::PerspectiveManager::Private
+{
+public:
+    LayoutSaver m_saver;
+    QHash<QString, SavedLayout> m_perspectives;
+    QString m_currentPerspective;
+    FramePool m_framePool; // Frames which the current perspective doesn't use, for the next switches
+};
+
+PerspectiveManager::PerspectiveManager()
+    : d(new Private())
+{
+}
+
+PerspectiveManager::~PerspectiveManager()
+{
+    delete d;
+}
+
+void PerspectiveManager::savePerspective(const QString &name)
+{
+    d->m_perspectives.insert(name, d->m_saver.d->captureLayout());
+    d->m_currentPerspective = name;
+}
+
+bool PerspectiveManager::addPerspective(const QString &name, const QByteArray &data)
+{
+    QBuffer buffer;
+    buffer.setData(data); // Shallow copy
+    buffer.open(QIODevice::ReadOnly);
+
+    SavedLayout layout;
+    if (!decodeLayout(&buffer, layout)) {
+        qWarning() << Q_FUNC_INFO << "Layout data is corrupted, not adding perspective" << name;
+        return false;
+    }
+
+    d->m_perspectives.insert(name, layout);
+    return true;
+}
+
+void PerspectiveManager::removePerspective(const QString &name)
+{
+    d->m_perspectives.remove(name);
+    if (d->m_currentPerspective == name)
+        d->m_currentPerspective.clear();
+}
+
+bool PerspectiveManager::containsPerspective(const QString &name) const
+{
+    return d->m_perspectives.contains(name);
+}
+
+QStringList PerspectiveManager::perspectives() const
+{
+    QStringList names = d->m_perspectives.keys();
+    names.sort();
+    return names;
+}
+
+bool PerspectiveManager::switchToPerspective(const QString &name)
+{
+    const auto it = d->m_perspectives.constFind(name);
+    if (it == d->m_perspectives.cend())
+        return false;
+
+    if (!d->m_saver.d->restore(*it, &d->m_framePool))
+        return false;
+
+    d->m_currentPerspective = name;
+    return true;
+}
+
+QString PerspectiveManager::currentPerspective() const
+{
+    return d->m_currentPerspective;
+}
+
+QByteArray PerspectiveManager::serializePerspective(const QString &name) const
+{
+    const auto it = d->m_perspectives.constFind(name);
+    return it == d->m_perspectives.cend() ? QByteArray() : encodeLayout(*it);
+}
+
+namespace {
+
+///@brief Encodes and writes a captured layout, on a worker thread
+class LayoutWriteJob : public QRunnable
+{
+public:
+    LayoutWriteJob(const QString &fileName, const SavedLayout &layout)
+        : m_fileName(fileName)
+        , m_layout(layout)
+    {
+    }
+
+    void run() override
+    {
+        QElapsedTimer timer;
+        timer.start();
+        writeLayoutFile(m_fileName, m_layout);
+        qCDebug(restoring) << "Autosaved" << m_fileName << "in" << timer.elapsed() << "ms";
+    }
+
+private:
+    const QString m_fileName;
+    const SavedLayout m_layout;
+};
+
+}
+
+class KDDockWidgets::LayoutAutoSaver::Private
+{
+public:
+    explicit Private(const QString &fileName)
+        : m_fileName(fileName)
+    {
+        m_timer.setSingleShot(true);
+        m_timer.setInterval(1000);
+
+        // A single thread, so writes to the file never overlap and land in order
+        m_pool.setMaxThreadCount(1);
+    }
+
+    const QString m_fileName;
+    LayoutSaver m_saver;
+    QTimer m_timer;
+    QElapsedTimer m_pendingSince;
+    QThreadPool m_pool;
+};
+
+LayoutAutoSaver::LayoutAutoSaver(const QString &fileName)
+    : d(new Private(fileName))
+{
+    QObject::connect(&d->m_timer, &QTimer::timeout, [this] {
+        saveNow();
+    });
+
+    if (qApp) {
+        QObject::connect(qApp, &QCoreApplication::aboutToQuit, &d->m_timer, [this] {
+            flush();
+        });
+    }
+}
+
+LayoutAutoSaver::~LayoutAutoSaver()
+{
+    flush();
+    delete d;
+}
+
+QString LayoutAutoSaver::fileName() const
+{
+    return d->m_fileName.isEmpty() ? LayoutSaver::Private::layoutFileName() : d->m_fileName;
+}
+
+void LayoutAutoSaver::setDelay(int ms)
+{
+    d->m_timer.setInterval(ms);
+}
+
+int LayoutAutoSaver::delay() const
+{
+    return d->m_timer.interval();
+}
+
+void LayoutAutoSaver::scheduleSave()
+{
+    if (!d->m_timer.isActive()) {
+        d->m_pendingSince.start();
+        d->m_timer.start();
+    } else if (d->m_pendingSince.elapsed() < 4 * d->m_timer.interval()) {
+        // Restart, so only the last change of a burst triggers a save
+        d->m_timer.start();
+    }
+}
+
+bool LayoutAutoSaver::isSavePending() const
+{
+    return d->m_timer.isActive();
+}
+
+void LayoutAutoSaver::flush()
+{
+    if (d->m_timer.isActive()) {
+        d->m_timer.stop();
+        saveNow();
+    }
+
+    d->m_pool.waitForDone();
+}
+
+void LayoutAutoSaver::saveNow()
+{
+    const QString fileName = this->fileName();
+    if (d->m_fileName.isEmpty()) {
+        if (qApp->organizationName().isEmpty() || qApp->applicationName().isEmpty()) {
+            qWarning() << Q_FUNC_INFO
+                       << "Cannot save. Either organization name or application name is empty.";
+            return;
+        }
+
+        if (!LayoutSaver::Private::ensureDirectoryFor(fileName))
+            return;
+    }
+
+    // Capturing is the only part that touches widgets, the rest happens on the worker thread
+    d->m_pool.start(new LayoutWriteJob(fileName, d->m_saver.d->captureLayout()));
+}
+
+// The journal starts with a header, which holds a checksum of the snapshot it applies to. A journal
+// left over from an older snapshot, for example after a crash during compaction, is ignored.
+// Each record is a QByteArray: type, window kind, window index, and a type specific payload.
+static const quint32 s_journalMagic = 0x4b44444a; // "KDDJ"
+static const quint8 s_journalVersion = 1;
+
+namespace {
+
+enum JournalRecordType : quint8 {
+    JournalRecord_AnchorPosition = 1,
+    JournalRecord_CurrentTab,
+    JournalRecord_WindowGeometry,
+    JournalRecord_Layout
+};
+
+enum JournalWindowKind : quint8 {
+    JournalWindow_FloatingDockWidget = 0,
+    JournalWindow_MainWindow,
+    JournalWindow_FloatingWindow
+};
+
+}
+
+static QByteArray snapshotChecksum(const QByteArray &snapshot)
+{
+    return QCryptographicHash::hash(snapshot, QCryptographicHash::Sha1).left(8);
+}
+
+template <typename Func>
+static QByteArray journalRecord(JournalRecordType type, JournalWindowKind kind, int windowIndex,
+                                Func writePayload)
+{
+    QByteArray record;
+    QDataStream ds(&record, QIODevice::WriteOnly);
+    ds << quint8(type) << quint8(kind) << qint32(windowIndex);
+    writePayload(ds);
+    return record;
+}
+
+static bool applyJournalRecord(const QByteArray &record, SavedLayout &layout)
+{
+    QDataStream ds(record);
+    quint8 type = 0;
+    quint8 kind = 0;
+    qint32 windowIndex = -1;
+    ds >> type >> kind >> windowIndex;
+
+    WindowState *windowState = nullptr;
+    LayoutState *layoutState = nullptr;
+    switch (kind) {
+    case JournalWindow_FloatingDockWidget:
+        if (windowIndex >= 0 && windowIndex < layout.floatingDockWidgets.size())
+            windowState = &layout.floatingDockWidgets[windowIndex];
+        break;
+    case JournalWindow_MainWindow:
+    case JournalWindow_FloatingWindow: {
+        QVector<SavedLayout::Window> &windows = kind == JournalWindow_MainWindow ? layout.mainWindows
+                                                                                 : layout.floatingWindows;
+        if (windowIndex >= 0 && windowIndex < windows.size()) {
+            windowState = &windows[windowIndex].first;
+            layoutState = &windows[windowIndex].second;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+
+    if (!windowState)
+        return false;
+
+    switch (type) {
+    case JournalRecord_AnchorPosition: {
+        qint32 anchorIndex = -1;
+        qint32 position = 0;
+        ds >> anchorIndex >> position;
+        if (!layoutState || anchorIndex < 0 || anchorIndex >= layoutState->m_anchors.size())
+            return false;
+        layoutState->m_anchors[anchorIndex].position = position;
+        break;
+    }
+    case JournalRecord_CurrentTab: {
+        quint64 id = 0;
+        qint32 currentTabIndex = -1;
+        ds >> id >> currentTabIndex;
+        if (!layoutState)
+            return false;
+        for (LayoutState::AnchorState &a : layoutState->m_anchors) {
+            for (LayoutState::FrameState::List *frames : { &a.side1FrameStates, &a.side2FrameStates }) {
+                for (LayoutState::FrameState &f : *frames) {
+                    if (f.id == id)
+                        f.currentTabIndex = currentTabIndex;
+                }
+            }
+        }
+        break;
+    }
+    case JournalRecord_WindowGeometry:
+        ds >> windowState->geometry >> windowState->isVisible;
+        break;
+    case JournalRecord_Layout: {
+        LayoutState state;
+        ds >> state;
+        if (!layoutState || ds.status() != QDataStream::Ok || !state.isValid())
+            return false;
+        *layoutState = state;
+        break;
+    }
+    default:
+        return false;
+    }
+
+    return ds.status() == QDataStream::Ok;
+}
+
+class KDDockWidgets::LayoutJournal::Private : public QObject
+{
+public:
+    explicit Private(const QString &fileName)
+        : m_fileName(fileName)
+        , m_journalFileName(fileName + QStringLiteral(".journal"))
+    {
+    }
+
+    ~Private() override
+    {
+        untrack();
+    }
+
+    ///@brief A window of the snapshot, at the index records refer to it by
+    struct TrackedWindow
+    {
+        JournalWindowKind kind;
+        int index;
+        QPointer<QWidget> window;
+        QPointer<DropArea> dropArea; // nullptr for floating dock widgets
+        QVector<QMetaObject::Connection> layoutConnections;
+        bool structureChanged = false;
+    };
+
+    struct QueuedRecord
+    {
+        int slot;
+        JournalRecordType type;
+        QByteArray record;
+    };
+
+    ///@brief Captures the whole layout, writes it as the snapshot and starts tracking it
+    bool compact(LayoutSaver::Private &saver);
+    bool append(const QVector<QByteArray> &records);
+
+    ///@brief Hooks the mutation points of the captured windows, so each change queues its record
+    void track(LayoutSaver::Private &saver);
+    void untrack();
+    void trackWindow(JournalWindowKind kind, int index, QWidget *window, DropArea *dropArea);
+    void trackLayout(int slot);
+    void queue(int slot, JournalRecordType type, quint64 key, const QByteArray &record);
+
+    ///@brief Returns the queued records, plus a Layout record for each window whose structure changed
+    QVector<QByteArray> takeQueuedRecords();
+
+    bool eventFilter(QObject *o, QEvent *e) override;
+
+    const QString m_fileName;
+    const QString m_journalFileName;
+    LayoutSaver m_saver;
+    bool m_hasBaseline = false; // Whether the snapshot plus the journal describe the tracked windows
+    bool m_windowsChanged = false; // Windows were added or removed, which records can't express
+    int m_numRecords = 0;
+    int m_compactionThreshold = 256;
+    QVector<TrackedWindow> m_windows;
+    QHash<const QObject*, int> m_slotByWindow;
+    QVector<QMetaObject::Connection> m_connections;
+
+    // A later change to the same separator, tab or window geometry replaces the queued record
+    QVector<QueuedRecord> m_queued;
+    QHash<QPair<int, quint64>, int> m_queuedIndexes;
+};
+
+bool LayoutJournal::Private::compact(LayoutSaver::Private &saver)
+{
+    const SavedLayout layout = saver.captureLayout();
+    const QByteArray snapshot = encodeLayout(layout);
+    if (!writeFileAtomically(m_fileName, snapshot))
+        return false;
+
+    QByteArray header;
+    QDataStream ds(&header, QIODevice::WriteOnly);
+    ds << s_journalMagic << s_journalVersion << snapshotChecksum(snapshot);
+    if (!writeFileAtomically(m_journalFileName, header)) {
+        // The stale journal doesn't match the new snapshot, so won't be replayed
+        m_hasBaseline = false;
+        return false;
+    }
+
+    track(saver);
+    m_hasBaseline = true;
+    m_numRecords = 0;
+    return true;
+}
+
+bool LayoutJournal::Private::append(const QVector<QByteArray> &records)
+{
+    QFile file(m_journalFileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning() << Q_FUNC_INFO << "Failed to open" << m_journalFileName << file.errorString();
+        return false;
+    }
+
+    QByteArray data;
+    QDataStream ds(&data, QIODevice::WriteOnly);
+    for (const QByteArray &record : records)
+        ds << record;
+
+    // A single write, a crash can only truncate the last records, which replay detects
+    if (file.write(data) != data.size() || !file.flush()) {
+        qWarning() << Q_FUNC_INFO << "Failed to write" << m_journalFileName << file.errorString();
+        return false;
+    }
+
+    m_numRecords += records.size();
+    return true;
+}
+
+void LayoutJournal::Private::track(LayoutSaver::Private &saver)
+{
+    untrack();
+
+    DockRegistry *registry = DockRegistry::self();
+    auto windowsChanged = [this] {
+        m_windowsChanged = true;
+    };
+    m_connections.push_back(connect(registry, &DockRegistry::registryChanged, this, windowsChanged));
+    m_connections.push_back(connect(registry, &QObject::destroyed, this, windowsChanged));
+
+    // Docking or floating a dock widget adds or removes a floating dock widget. Tabs changing
+    // frames reparent it too, but don't change which windows there are.
+    const DockWidget::List dockWidgets = registry->dockwidgets();
+    for (DockWidget *dw : dockWidgets) {
+        const bool isWindow = dw->isWindow();
+        m_connections.push_back(connect(dw, &DockWidget::parentChanged, this, [this, dw, isWindow] {
+            if (dw->isWindow() != isWindow)
+                m_windowsChanged = true;
+        }));
+    }
+
+    // In the same order as captureLayout(), the records refer to windows by index
+    const DockWidget::List floatingDocks = saver.floatingDockWidgets();
+    for (int i = 0, end = floatingDocks.size(); i < end; ++i)
+        trackWindow(JournalWindow_FloatingDockWidget, i, floatingDocks.at(i), nullptr);
+
+    const MainWindow::List mainWindows = saver.mainWindows();
+    for (int i = 0, end = mainWindows.size(); i < end; ++i)
+        trackWindow(JournalWindow_MainWindow, i, mainWindows.at(i), mainWindows.at(i)->dropArea());
+
+    const QVector<FloatingWindow*> floatingWindows = registry->nestedwindows();
+    for (int i = 0, end = floatingWindows.size(); i < end; ++i)
+        trackWindow(JournalWindow_FloatingWindow, i, floatingWindows.at(i), floatingWindows.at(i)->dropArea());
+
+    m_windowsChanged = false;
+}
+
+void LayoutJournal::Private::untrack()
+{
+    for (const QMetaObject::Connection &connection : qAsConst(m_connections))
+        disconnect(connection);
+
+    for (const TrackedWindow &window : qAsConst(m_windows)) {
+        for (const QMetaObject::Connection &connection : window.layoutConnections)
+            disconnect(connection);
+        if (window.window)
+            window.window->removeEventFilter(this);
+    }
+
+    m_connections.clear();
+    m_windows.clear();
+    m_slotByWindow.clear();
+    m_queued.clear();
+    m_queuedIndexes.clear();
+}
+
+void LayoutJournal::Private::trackWindow(JournalWindowKind kind, int index, QWidget *window, DropArea *dropArea)
+{
+    const int slot = m_windows.size();
+    TrackedWindow tracked;
+    tracked.kind = kind;
+    tracked.index = index;
+    tracked.window = window;
+    tracked.dropArea = dropArea;
+    m_windows.push_back(tracked);
+
+    m_slotByWindow.insert(window, slot);
+    window->installEventFilter(this);
+    if (dropArea)
+        trackLayout(slot);
+}
+
+void LayoutJournal::Private::trackLayout(int slot)
+{
+    TrackedWindow &window = m_windows[slot];
+    for (const QMetaObject::Connection &connection : qAsConst(window.layoutConnections))
+        disconnect(connection);
+    window.layoutConnections.clear();
+
+    // Frames added, removed or tabbed change the anchors, the whole window gets a Layout record
+    auto structureChanged = [this, slot] {
+        m_windows[slot].structureChanged = true;
+    };
+
+    MultiSplitterLayout *layout = window.dropArea->multiSplitterLayout();
+    window.layoutConnections.push_back(connect(layout, &MultiSplitterLayout::visibleWidgetCountChanged,
+                                               this, structureChanged));
+
+    const Anchor::List anchors = layout->anchors();
+    for (int i = 0, end = anchors.size(); i < end; ++i) {
+        window.layoutConnections.push_back(connect(anchors.at(i), &Anchor::positionChanged, this, [this, slot, i] (int position) {
+            const TrackedWindow &w = m_windows.at(slot);
+            if (w.structureChanged)
+                return;
+
+            queue(slot, JournalRecord_AnchorPosition, quint64(i),
+                  journalRecord(JournalRecord_AnchorPosition, w.kind, w.index, [i, position] (QDataStream &ds) {
+                ds << qint32(i) << qint32(position);
+            }));
+        }));
+    }
+
+    const ItemList items = layout->items();
+    for (Item *item : items) {
+        Frame *frame = item->frame();
+        if (!frame)
+            continue;
+
+        window.layoutConnections.push_back(connect(frame, &Frame::numDockWidgetsChanged, this, structureChanged));
+        window.layoutConnections.push_back(connect(frame, &Frame::currentDockWidgetChanged, this, [this, slot, frame] {
+            const TrackedWindow &w = m_windows.at(slot);
+            if (w.structureChanged)
+                return;
+
+            const quint64 id = frame->id();
+            const int currentTabIndex = frame->currentTabIndex();
+            queue(slot, JournalRecord_CurrentTab, id,
+                  journalRecord(JournalRecord_CurrentTab, w.kind, w.index, [id, currentTabIndex] (QDataStream &ds) {
+                ds << id << qint32(currentTabIndex);
+            }));
+        }));
+    }
+}
+
+void LayoutJournal::Private::queue(int slot, JournalRecordType type, quint64 key, const QByteArray &record)
+{
+    const QPair<int, quint64> queueKey(slot * 8 + type, key);
+    const auto it = m_queuedIndexes.constFind(queueKey);
+    if (it != m_queuedIndexes.cend()) {
+        m_queued[*it].record = record;
+    } else {
+        m_queuedIndexes.insert(queueKey, m_queued.size());
+        m_queued.push_back({ slot, type, record });
+    }
+}
+
+QVector<QByteArray> LayoutJournal::Private::takeQueuedRecords()
+{
+    QVector<QByteArray> records;
+    records.reserve(m_queued.size());
+    for (const QueuedRecord &queued : qAsConst(m_queued)) {
+        // A Layout record has the window's separators and tabs, but not its geometry
+        if (!m_windows.at(queued.slot).structureChanged || queued.type == JournalRecord_WindowGeometry)
+            records.push_back(queued.record);
+    }
+
+    m_queued.clear();
+    m_queuedIndexes.clear();
+
+    // Only the windows whose structure changed are captured
+    for (int slot = 0, end = m_windows.size(); slot < end; ++slot) {
+        TrackedWindow &window = m_windows[slot];
+        if (!window.structureChanged || !window.dropArea)
+            continue;
+
+        const LayoutState layoutState(window.dropArea.data());
+        records.push_back(journalRecord(JournalRecord_Layout, window.kind, window.index, [&layoutState] (QDataStream &ds) {
+            ds << layoutState;
+        }));
+
+        window.structureChanged = false;
+        trackLayout(slot);
+    }
+
+    return records;
+}
+
+bool LayoutJournal::Private::eventFilter(QObject *o, QEvent *e)
+{
+    switch (e->type()) {
+    case QEvent::Move:
+    case QEvent::Resize:
+    case QEvent::Show:
+    case QEvent::Hide:
+        break;
+    default:
+        return false;
+    }
+
+    const auto it = m_slotByWindow.constFind(o);
+    if (it == m_slotByWindow.cend())
+        return false;
+
+    const int slot = *it;
+    const TrackedWindow &window = m_windows.at(slot);
+    auto w = static_cast<QWidget *>(o);
+    const QRect geometry = w->geometry();
+    const bool isVisible = w->isVisible();
+    queue(slot, JournalRecord_WindowGeometry, 0,
+          journalRecord(JournalRecord_WindowGeometry, window.kind, window.index, [geometry, isVisible] (QDataStream &ds) {
+        ds << geometry << isVisible;
+    }));
+
+    return false;
+}
+
+LayoutJournal::LayoutJournal(const QString &fileName)
+    : d(new Private(fileName))
+{
+}
+
+LayoutJournal::~LayoutJournal()
+{
+    delete d;
+}
+
+QString LayoutJournal::fileName() const
+{
+    return d->m_fileName;
+}
+
+QString LayoutJournal::journalFileName() const
+{
+    return d->m_journalFileName;
+}
+
+bool LayoutJournal::record()
+{
+    if (!d->m_hasBaseline || d->m_windowsChanged)
+        return d->compact(*d->m_saver.d);
+
+    const QVector<QByteArray> records = d->takeQueuedRecords();
+    if (d->m_numRecords + records.size() > d->m_compactionThreshold)
+        return d->compact(*d->m_saver.d);
+
+    if (records.isEmpty())
+        return true;
+
+    if (!d->append(records)) {
+        // Don't know how much made it to disk, start over from a snapshot next time
+        d->m_hasBaseline = false;
+        return false;
+    }
+
+    qCDebug(restoring) << Q_FUNC_INFO << "Appended" << records.size() << "records";
+    return true;
+}
+
+bool LayoutJournal::compact()
+{
+    return d->compact(*d->m_saver.d);
+}
+
+bool LayoutJournal::restore()
+{
+    QFile snapshotFile(d->m_fileName);
+    if (!snapshotFile.open(QIODevice::ReadOnly)) {
+        qWarning() << Q_FUNC_INFO << "Failed to open" << d->m_fileName << snapshotFile.errorString();
+        return false;
+    }
+
+    const QByteArray snapshot = snapshotFile.readAll();
+    QBuffer buffer;
+    buffer.setData(snapshot); // Shallow copy
+    buffer.open(QIODevice::ReadOnly);
+
+    SavedLayout layout;
+    if (!decodeLayout(&buffer, layout)) {
+        qWarning() << Q_FUNC_INFO << "Layout data is corrupted, not restoring";
+        return false;
+    }
+
+    QFile journalFile(d->m_journalFileName);
+    int numReplayed = 0;
+    if (journalFile.open(QIODevice::ReadOnly)) {
+        QDataStream ds(&journalFile);
+        quint32 magic = 0;
+        quint8 version = 0;
+        QByteArray checksum;
+        ds >> magic >> version >> checksum;
+        if (ds.status() != QDataStream::Ok || magic != s_journalMagic || version != s_journalVersion ||
+            checksum != snapshotChecksum(snapshot)) {
+            qCDebug(restoring) << Q_FUNC_INFO << "Ignoring journal, it doesn't belong to the snapshot";
+        } else {
+            while (!ds.atEnd()) {
+                QByteArray record;
+                ds >> record;
+                if (ds.status() != QDataStream::Ok) {
+                    // Interrupted while appending, what's before is still good
+                    qCDebug(restoring) << Q_FUNC_INFO << "Journal ends with a truncated record";
+                    break;
+                }
+
+                if (!applyJournalRecord(record, layout)) {
+                    qWarning() << Q_FUNC_INFO << "Journal is corrupted, ignoring it after record" << numReplayed;
+                    break;
+                }
+
+                ++numReplayed;
+            }
+        }
+    }
+
+    qCDebug(restoring) << Q_FUNC_INFO << "Replayed" << numReplayed << "records";
+
+    // Frames get new ids when restored, so records can't be appended to this journal anymore
+    d->m_hasBaseline = false;
+    d->untrack();
+    return d->m_saver.d->restore(layout);
+}
+
+void LayoutJournal::setCompactionThreshold(int numRecords)
+{
+    d->m_compactionThreshold = numRecords;
+}
+
+int LayoutJournal::compactionThreshold() const
+{
+    return d->m_compactionThreshold;
+}
+
+int LayoutJournal::journalSize() const
+{
+    return d->m_numRecords;
+}
+
+///@brief appends to @p errors what's wrong with the anchor graph of @p state
+static void checkLayoutState(const LayoutState &state, const QString &windowName, QStringList &errors)
+{
+    auto error = [&errors, &windowName] (const QString &message) {
+        errors.push_back(windowName + QStringLiteral(": ") + message);
+    };
+
+    QHash<int, const LayoutState::AnchorState*> anchorsByIndex;
+    int staticTypes = 0;
+    for (const LayoutState::AnchorState &a : state.m_anchors) {
+        if (!a.isValid()) {
+            error(QStringLiteral("anchor has invalid indexes %1, from=%2, to=%3").arg(a.index).arg(a.fromIndex).arg(a.toIndex));
+            continue;
+        }
+
+        if (anchorsByIndex.contains(a.index))
+            error(QStringLiteral("duplicate anchor index %1").arg(a.index));
+        anchorsByIndex.insert(a.index, &a);
+
+        if (a.isStatic()) {
+            if (staticTypes & a.type)
+                error(QStringLiteral("duplicate static anchor of type %1").arg(int(a.type)));
+            staticTypes |= a.type;
+        } else if (a.side1FrameStates.isEmpty() || a.side2FrameStates.isEmpty()) {
+            error(QStringLiteral("anchor %1 doesn't have frames on both sides").arg(a.index));
+        }
+    }
+
+    if (staticTypes != Anchor::Type_Static)
+        error(QStringLiteral("missing static anchors, found types %1").arg(staticTypes));
+
+    for (const LayoutState::AnchorState &a : state.m_anchors) {
+        if (!a.isValid())
+            continue;
+
+        for (int linkedIndex : { a.fromIndex, a.toIndex }) {
+            const LayoutState::AnchorState *linked = anchorsByIndex.value(linkedIndex);
+            if (!linked)
+                error(QStringLiteral("anchor %1 links to unknown anchor %2").arg(a.index).arg(linkedIndex));
+            else if (linked->orientation == a.orientation)
+                error(QStringLiteral("anchor %1 links to anchor %2 of the same orientation").arg(a.index).arg(linkedIndex));
+        }
+    }
+
+    // Each frame has exactly one anchor at each of its 4 edges, like an Item's AnchorGroup
+    struct FrameEdges {
+        QVector<const LayoutState::AnchorState*> edges[4]; // left, right, top, bottom
+        QStringList dockWidgets;
+    };
+
+    QHash<quint64, FrameEdges> frames;
+    for (const LayoutState::AnchorState &a : state.m_anchors) {
+        if (!a.isValid())
+            continue;
+
+        const int offset = a.orientation == Qt::Vertical ? 0 : 2;
+        for (const LayoutState::FrameState &f : a.side1FrameStates) {
+            frames[f.id].edges[offset + 1].push_back(&a);
+            frames[f.id].dockWidgets = f.dockWidgets;
+        }
+        for (const LayoutState::FrameState &f : a.side2FrameStates) {
+            frames[f.id].edges[offset].push_back(&a);
+            frames[f.id].dockWidgets = f.dockWidgets;
+        }
+    }
+
+    for (auto it = frames.cbegin(), end = frames.cend(); it != end; ++it) {
+        const FrameEdges &frame = *it;
+        bool hasAllEdges = true;
+        for (const auto &edge : frame.edges) {
+            if (edge.size() != 1) {
+                error(QStringLiteral("frame %1 has %2 anchors at one edge").arg(it.key()).arg(edge.size()));
+                hasAllEdges = false;
+            }
+        }
+
+        if (hasAllEdges && (frame.edges[0].at(0)->position >= frame.edges[1].at(0)->position ||
+                            frame.edges[2].at(0)->position >= frame.edges[3].at(0)->position))
+            error(QStringLiteral("frame %1 has a negative size").arg(it.key()));
+    }
+}
+
+LayoutReport LayoutReport::fromData(const QByteArray &data)
+{
+    LayoutReport report;
+
+    quint32 magic = 0;
+    QDataStream(data) >> magic;
+    report.formatVersion = 1;
+    if (magic == s_formatMagic && data.size() > int(sizeof(magic)))
+        report.formatVersion = quint8(data.at(int(sizeof(magic))));
+
+    QBuffer buffer;
+    buffer.setData(data); // Shallow copy
+    buffer.open(QIODevice::ReadOnly);
+
+    SavedLayout layout;
+    if (!decodeLayout(&buffer, layout)) {
+        report.errors.push_back(QStringLiteral("Can't decode the layout"));
+        return report;
+    }
+
+    report.numMainWindows = layout.mainWindows.size();
+    report.numFloatingWindows = layout.floatingWindows.size();
+    report.numFloatingDockWidgets = layout.floatingDockWidgets.size();
+
+    // A dock widget can only be in one place. Each location is visited once, so any repetition is an error.
+    QHash<QString, QString> dockWidgetLocations;
+    auto addDockWidget = [&report, &dockWidgetLocations] (const QString &dockWidget, const QString &location) {
+        const QString previous = dockWidgetLocations.value(dockWidget);
+        if (previous.isEmpty()) {
+            dockWidgetLocations.insert(dockWidget, location);
+        } else if (previous == location) {
+            report.errors.push_back(QStringLiteral("dock widget %1 is twice in %2").arg(dockWidget, location));
+        } else {
+            report.errors.push_back(QStringLiteral("dock widget %1 is in both %2 and %3")
+                                    .arg(dockWidget, previous, location));
+        }
+    };
+
+    for (const WindowState &windowState : qAsConst(layout.floatingDockWidgets))
+        addDockWidget(windowState.name, QStringLiteral("a floating dock widget"));
+
+    for (const auto *windows : { &layout.mainWindows, &layout.floatingWindows }) {
+        for (int i = 0, end = windows->size(); i < end; ++i) {
+            const LayoutState &state = windows->at(i).second;
+            const QString windowName = windows == &layout.mainWindows
+                    ? QStringLiteral("main window %1").arg(state.m_name)
+                    : QStringLiteral("floating window %1").arg(i);
+
+            checkLayoutState(state, windowName, report.errors);
+
+            QSet<quint64> frameIds;
+            for (const LayoutState::AnchorState &a : state.m_anchors) {
+                for (const LayoutState::FrameState::List *frames : { &a.side1FrameStates, &a.side2FrameStates }) {
+                    for (const LayoutState::FrameState &f : *frames) {
+                        if (frameIds.contains(f.id))
+                            continue;
+
+                        frameIds.insert(f.id);
+                        const QString frameName = QStringLiteral("%1, frame %2").arg(windowName).arg(f.id);
+                        for (const QString &dockWidget : f.dockWidgets)
+                            addDockWidget(dockWidget, frameName);
+                    }
+                }
+            }
+
+            report.numAnchors += state.m_anchors.size();
+            report.numFrames += frameIds.size();
+
+            // Anything checkLayoutState() accepts must be restorable
+            if (report.errors.isEmpty() && !state.isValid())
+                report.errors.push_back(windowName + QStringLiteral(": rejected by LayoutState::isValid()"));
+        }
+    }
+
+    report.numDockWidgets = dockWidgetLocations.size();
+    return report;
+}
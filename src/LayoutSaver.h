@@ -29,8 +29,14 @@
  */
 
 #include "docks_export.h"
+#include "KDDockWidgets.h"
+
+#include <QtGlobal>
 
 class QByteArray;
+class QIODevice;
+class QString;
+class QStringList;
 
 namespace KDDockWidgets {
 
@@ -40,12 +46,180 @@ public:
     LayoutSaver();
     ~LayoutSaver();
 
+    /**
+     * @brief saves the layout into a file in QStandardPaths::AppDataLocation
+     * Requires QCoreApplication's organization and application names to be set.
+     */
     bool saveToDisk();
+
+    /**
+     * @brief restores the layout saved by saveToDisk()
+     * Falls back to the QSettings entry written by older versions.
+     */
     void restoreFromDisk();
 
+    ///@brief saves the layout into @p fileName atomically, the old file is only replaced on success
+    bool saveToFile(const QString &fileName);
+
+    ///@brief restores the layout from @p fileName, which is memory mapped instead of read into memory
+    bool restoreFromFile(const QString &fileName);
+
     QByteArray serializeLayout() const;
-    void restoreLayout(const QByteArray &);
+
+    ///@brief restores from @p data, without copying it. Returns false if the data is corrupted.
+    bool restoreLayout(const QByteArray &data);
+
+    ///@brief restores by reading @p device, which can be sequential. Returns false if the data is corrupted.
+    bool restoreLayout(QIODevice *device);
+
+    /**
+     * @brief sets the function creating the dock widgets a restored layout needs but which don't exist yet
+     *
+     * With a factory the application doesn't need to create every dock widget before restoring.
+     * Dock widgets in tabs which aren't current, and floating ones restored hidden, are only
+     * created once they're needed. Pass nullptr to unset it.
+     */
+    static void setDockWidgetFactory(DockWidgetFactoryFunc factory);
+    static DockWidgetFactoryFunc dockWidgetFactory();
+
+#if defined(DOCKS_DEVELOPER_MODE)
+    ///@brief serializes in the format used before the compact one, so tests can check it's still readable
+    QByteArray serializeLayout_legacy() const;
+#endif
+private:
+    friend class PerspectiveManager;
+    friend class LayoutAutoSaver;
+    friend class LayoutJournal;
+    class Private;
+    Private *const d;
+};
+
+/**
+ * @brief Keeps several named layouts in memory, for switching between them quickly.
+ *
+ * Perspectives are decoded once, when added, so switching doesn't parse anything. Windows whose
+ * structure matches the perspective keep their Frames and separators, which are only repositioned.
+ * Other windows are rebuilt, but Frames are still reused. Frames a perspective doesn't need are
+ * kept by the manager, so switching back to a perspective which does doesn't create them again.
+ */
+class DOCKS_EXPORT PerspectiveManager
+{
+public:
+    PerspectiveManager();
+    ~PerspectiveManager();
+
+    ///@brief captures the current layout as perspective @p name, replacing any previous one
+    void savePerspective(const QString &name);
+
+    ///@brief adds the layout in @p data, as returned by LayoutSaver::serializeLayout(), as perspective @p name
+    bool addPerspective(const QString &name, const QByteArray &data);
+
+    void removePerspective(const QString &name);
+    bool containsPerspective(const QString &name) const;
+
+    ///@brief returns the names of all perspectives, sorted
+    QStringList perspectives() const;
+
+    ///@brief restores perspective @p name. Returns false if there's no such perspective.
+    bool switchToPerspective(const QString &name);
+
+    ///@brief returns the name of the perspective last saved or switched to
+    QString currentPerspective() const;
+
+    ///@brief serializes perspective @p name, so it can be persisted. Returns an empty array if it doesn't exist.
+    QByteArray serializePerspective(const QString &name) const;
+
+private:
+    class Private;
+    Private *const d;
+};
+
+/**
+ * @brief Saves the layout in the background, after a burst of changes settles.
+ *
+ * Only capturing the layout happens on the GUI thread. Encoding and writing the file happen on a
+ * worker thread, and the file is replaced atomically. Pending saves are flushed when the
+ * application quits and when the LayoutAutoSaver is destroyed.
+ */
+class DOCKS_EXPORT LayoutAutoSaver
+{
+public:
+    ///@brief saves into @p fileName. If empty, saves into the file used by LayoutSaver::saveToDisk()
+    explicit LayoutAutoSaver(const QString &fileName = QString());
+    ~LayoutAutoSaver();
+
+    QString fileName() const;
+
+    ///@brief the delay, in ms, after the last scheduleSave() before saving. Defaults to 1000.
+    void setDelay(int ms);
+    int delay() const;
+
+    /**
+     * @brief schedules a save. Calls in quick succession result in a single save.
+     * A continuous stream of calls still saves every 4 * delay().
+     */
+    void scheduleSave();
+
+    ///@brief returns whether a save was scheduled but the layout wasn't captured yet
+    bool isSavePending() const;
+
+    ///@brief saves now if a save is pending, and waits for the writes to finish
+    void flush();
+
+private:
+    Q_DISABLE_COPY(LayoutAutoSaver)
+    void saveNow();
+    class Private;
+    Private *const d;
+};
+
+/**
+ * @brief Persists layout changes incrementally, as records appended to a journal.
+ *
+ * The full layout is written to fileName() only on compaction. Each record() appends only what
+ * changed since the previous one to journalFileName(): separator moves, current tabs, window
+ * geometry, or the anchors of a single window whose structure changed. restore() replays the
+ * journal on top of the snapshot.
+ *
+ * Since the last compaction, the journal watches separators, tabs, windows and layouts, and each
+ * change queues its record as it happens, replacing an older one for the same separator, tab or
+ * window. record() only writes what's queued, capturing just the windows whose frames were added,
+ * removed or tabbed. Adding or removing windows, including floating or docking a dock widget,
+ * compacts.
+ */
+class DOCKS_EXPORT LayoutJournal
+{
+public:
+    ///@brief the snapshot is written to @p fileName, the journal next to it
+    explicit LayoutJournal(const QString &fileName);
+    ~LayoutJournal();
+
+    QString fileName() const;
+    QString journalFileName() const;
+
+    /**
+     * @brief appends the changes since the last record() or compact() to the journal
+     * Compacts instead if there's no snapshot yet, if windows were added or removed, or if the
+     * journal reached compactionThreshold() records. Costs O(changes), plus capturing the layout
+     * of each window whose structure changed.
+     */
+    bool record();
+
+    ///@brief writes a full snapshot and empties the journal
+    bool compact();
+
+    ///@brief restores the snapshot and replays the journal. The next record() compacts.
+    bool restore();
+
+    ///@brief the number of records after which record() compacts. Defaults to 256.
+    void setCompactionThreshold(int numRecords);
+    int compactionThreshold() const;
+
+    ///@brief returns the number of records in the journal
+    int journalSize() const;
+
 private:
+    Q_DISABLE_COPY(LayoutJournal)
     class Private;
     Private *const d;
 };
@@ -0,0 +1,57 @@
+/*
+  This file is part of KDDockWidgets.
+
+  Copyright (C) 2018-2019 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com
+  Author: Sérgio Martins <sergio.martins@kdab.com>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef KD_LAYOUTSAVER_P_H
+#define KD_LAYOUTSAVER_P_H
+
+#include "docks_export.h"
+
+#include <QByteArray>
+#include <QStringList>
+
+namespace KDDockWidgets {
+
+/**
+ * @brief What a serialized layout contains, and what's wrong with it.
+ *
+ * Computed by decoding the data only, no widgets are created, so it can run on any thread and
+ * without a QApplication. The checks are the ones LayoutState::isValid() and
+ * MultiSplitterLayout::checkSanity() do, minus those which need actual geometry.
+ */
+struct DOCKS_EXPORT_FOR_UNIT_TESTS LayoutReport
+{
+    ///@brief decodes and validates @p data, as returned by LayoutSaver::serializeLayout()
+    static LayoutReport fromData(const QByteArray &data);
+
+    bool isValid() const { return errors.isEmpty(); }
+
+    QStringList errors;
+    int formatVersion = 0;
+    int numMainWindows = 0;
+    int numFloatingWindows = 0;
+    int numFloatingDockWidgets = 0;
+    int numAnchors = 0;
+    int numFrames = 0;
+    int numDockWidgets = 0;
+};
+
+}
+
+#endif
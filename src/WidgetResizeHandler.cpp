@@ -19,6 +19,7 @@
 */
 
 #include "WidgetResizeHandler_p.h"
+#include "EventRouter_p.h"
 #include <QEvent>
 #include <QMouseEvent>
 #include <QWidget>
@@ -38,6 +39,8 @@ WidgetResizeHandler::WidgetResizeHandler(QWidget *target)
 
 WidgetResizeHandler::~WidgetResizeHandler()
 {
+    if (mTarget)
+        EventRouter::instance()->removeRoute(mTarget, this);
 }
 
 bool WidgetResizeHandler::eventFilter(QObject *o, QEvent *e)
@@ -179,9 +182,11 @@ void WidgetResizeHandler::mouseMoveEvent(QMouseEvent *e)
 void WidgetResizeHandler::setTarget(QWidget *w)
 {
     if (w) {
+        if (mTarget)
+            EventRouter::instance()->removeRoute(mTarget, this);
         mTarget = w;
         mTarget->setMouseTracking(true);
-        mTarget->installEventFilter(this);
+        EventRouter::instance()->addRoute(mTarget, this, EventRouter::MouseEvents);
     } else {
         qWarning() << "Target widget is null!";
     }
@@ -51,10 +51,16 @@ Anchor::~Anchor()
     m_separatorWidget->deleteLater();
     qCDebug(multisplittercreation) << "~Anchor; this=" << this << "; m_to=" << m_to << "; m_from=" << m_from;
     m_layout->removeAnchor(this);
-    for (Item *item : items(Side1))
+    if (m_followee)
+        m_followee->m_followers.removeOne(this);
+    for (Item *item : items(Side1)) {
         item->anchorGroup().setAnchor(nullptr, m_orientation, Side1);
-    for (Item *item : items(Side2))
+        m_layout->markTouched(item);
+    }
+    for (Item *item : items(Side2)) {
         item->anchorGroup().setAnchor(nullptr, m_orientation, Side2);
+        m_layout->markTouched(item);
+    }
 }
 
 void Anchor::setFrom(Anchor *from)
@@ -68,6 +74,8 @@ void Anchor::setFrom(Anchor *from)
     if (m_from)
         disconnect(m_from, &Anchor::positionChanged, this, &Anchor::updateSize);
     m_from = from;
+    m_layout->markTouched(this);
+    m_layout->invalidateStructure();
     connect(from, &Anchor::positionChanged, this, &Anchor::updateSize);
     updateSize();
 
@@ -86,6 +94,8 @@ void Anchor::setTo(Anchor *to)
     if (m_to)
         disconnect(m_to, &Anchor::positionChanged, this, &Anchor::updateSize);
     m_to = to;
+    m_layout->markTouched(this);
+    m_layout->invalidateStructure();
     connect(to, &Anchor::positionChanged, this, &Anchor::updateSize);
     updateSize();
 
@@ -113,10 +123,61 @@ void Anchor::setGeometry(QRect r)
         }
 
         m_geometry = r;
-        m_separatorWidget->setGeometry(r);
+        m_layout->markTouched(this);
+        if (m_layout->isInTransaction())
+            setSeparatorGeometryDirty();
+        else
+            m_separatorWidget->setGeometry(r);
     }
 }
 
+void Anchor::setSeparatorGeometryDirty()
+{
+    if (!m_separatorGeometryDirty) {
+        m_separatorGeometryDirty = true;
+        m_layout->addDirtyAnchor(this);
+    }
+}
+
+void Anchor::commitGeometry()
+{
+    if (!m_separatorGeometryDirty)
+        return;
+
+    m_separatorGeometryDirty = false;
+    if (isValid())
+        m_separatorWidget->setGeometry(m_geometry);
+    else
+        m_separatorWidget->move(position());
+}
+
+void Anchor::setGeometryFromEngine(QRect r, qreal positionPercentage)
+{
+    m_initialized = true;
+    m_positionPercentage = positionPercentage;
+    const int oldPosition = position();
+    setGeometry(r);
+
+    if (position() == oldPosition || m_positionChangePending)
+        return;
+
+    if (m_layout->isInTransaction()) {
+        m_positionChangePending = true;
+        m_layout->addMovedAnchor(this);
+    } else {
+        Q_EMIT positionChanged(position());
+    }
+}
+
+void Anchor::commitPositionChanged()
+{
+    if (!m_positionChangePending)
+        return;
+
+    m_positionChangePending = false;
+    Q_EMIT positionChanged(position());
+}
+
 void Anchor::updateItemSizes()
 {
     if (!m_initialized) {
@@ -185,6 +246,21 @@ Qt::Orientation Anchor::orientation() const
 }
 
 void Anchor::setPosition(int p, SetPositionOptions options)
+{
+    if (!setPositionWithoutFollowers(p, options) || m_followers.isEmpty())
+        return;
+
+    // The whole chain of followers is moved in a single pass, instead of each follower reacting to
+    // its followee's positionChanged signal. Only anchors that actually moved have their followers moved.
+    List chain = m_followers;
+    for (int i = 0; i < chain.size(); ++i) {
+        Anchor *follower = chain.at(i);
+        if (follower->setPositionWithoutFollowers(p, SetPositionOption_None))
+            chain += follower->m_followers;
+    }
+}
+
+bool Anchor::setPositionWithoutFollowers(int p, SetPositionOptions options)
 {
     qCDebug(anchors) << Q_FUNC_INFO << this << "; visible="
                      << m_separatorWidget->isVisible() << "; p=" << p;
@@ -201,7 +277,7 @@ void Anchor::setPosition(int p, SetPositionOptions options)
     m_initialized = true;
     if (position() == p) {
         updateItemSizes();
-        return;
+        return false;
     }
 
     if (isVertical()) {
@@ -212,9 +288,13 @@ void Anchor::setPosition(int p, SetPositionOptions options)
 
     const bool recalculatePercentage = !(options & SetPositionOption_DontRecalculatePercentage);
 
-    m_separatorWidget->move(p);
+    if (m_layout->isInTransaction())
+        setSeparatorGeometryDirty();
+    else
+        m_separatorWidget->move(p);
+
     if (recalculatePercentage)
-        m_positionPercentage = (p * 1.0) / m_layout->contentsWidth(); // We keep the percentage, so we don't constantly recalculate it during a resize, which introduces rounding errors
+        m_positionPercentage = (p * 1.0) / m_layout->contentsLength(orientation()); // We keep the percentage, so we don't constantly recalculate it during a resize, which introduces rounding errors
 
     // Note: Position can be slightly negative if the main window isn't big enougn to host the new size.
     // In that case the window will be resized shortly after
@@ -222,6 +302,7 @@ void Anchor::setPosition(int p, SetPositionOptions options)
 
     Q_EMIT positionChanged(position());
     updateItemSizes();
+    return true;
 }
 
 int Anchor::position() const
@@ -318,9 +399,9 @@ bool Anchor::containsItem(const Item *item, Anchor::Side side) const
 {
     switch (side) {
     case Side1:
-        return m_side1Items.contains(const_cast<Item *>(item));
+        return m_side1ItemSet.contains(item);
     case Side2:
-        return m_side2Items.contains(const_cast<Item *>(item));
+        return m_side2ItemSet.contains(item);
     default:
         Q_ASSERT(false);
         return false;
@@ -438,6 +519,30 @@ bool Anchor::isBeingDragged() const
 }
 
 int Anchor::cumulativeMinLength(Anchor::Side side) const
+{
+    const int index = side == Side1 ? 0 : 1;
+    const quint64 generation = m_layout->cumulativeMinLengthGeneration();
+    if (m_cumulativeMinLengthGeneration[index] == generation)
+        return m_cumulativeMinLength[index];
+
+    const int result = computeCumulativeMinLength(side);
+    m_cumulativeMinLength[index] = result;
+    m_cumulativeMinLengthGeneration[index] = generation;
+    return result;
+}
+
+int Anchor::freshCumulativeMinLength(Anchor::Side side, QHash<const Anchor*, int> &memo) const
+{
+    auto it = memo.constFind(this);
+    if (it != memo.cend())
+        return *it;
+
+    const int result = computeCumulativeMinLength(side, &memo);
+    memo.insert(this, result);
+    return result;
+}
+
+int Anchor::computeCumulativeMinLength(Anchor::Side side, QHash<const Anchor*, int> *freshMemo) const
 {
     if (isStatic() && isEmpty()) {
         // There's no widget, but minimum is the space occupied by left+right anchors (or top+bottom).
@@ -450,7 +555,8 @@ int Anchor::cumulativeMinLength(Anchor::Side side) const
     const auto items = this->items(side);
     int minLength = 0;
     for (auto item : items) {
-        const int itemMin = item->cumulativeMinLength(side, orientation());
+        const int itemMin = freshMemo ? item->minLength(orientation()) + item->anchorAtSide(side, orientation())->freshCumulativeMinLength(side, *freshMemo)
+                                      : item->cumulativeMinLength(side, orientation());
         minLength = qMax(itemMin, minLength);
     }
 
@@ -468,17 +574,19 @@ void Anchor::setFollowee(Anchor *followee)
                          << this << "; followee=" << followee;
 
     if (m_followee) {
-        disconnect(m_followee, &Anchor::positionChanged, this, &Anchor::onFolloweePositionChanged);
+        m_followee->m_followers.removeOne(this);
         disconnect(m_followee, &Anchor::thicknessChanged, this, &Anchor::setThickness);
     }
 
     m_followee = followee;
+    m_layout->markTouched(this);
+    m_layout->invalidateStructure(); // Also, a follower doesn't count its own thickness
     setThickness();
     if (m_followee) {
         Q_ASSERT(orientation() == m_followee->orientation());
         setVisible(false);
+        m_followee->m_followers.push_back(this);
         setPosition(m_followee->position());
-        connect(m_followee, &Anchor::positionChanged, this, &Anchor::onFolloweePositionChanged);
         connect(m_followee, &Anchor::thicknessChanged, this, &Anchor::setThickness);
     } else {
         setVisible(true);
@@ -540,12 +648,6 @@ Anchor *Anchor::findNearestAnchorWithItems(Anchor::Side side) const
     return candidate;
 }
 
-void Anchor::onFolloweePositionChanged(int pos)
-{
-    Q_ASSERT(isFollowing());
-    setPosition(pos);
-}
-
 int Anchor::thickness(bool staticAnchor)
 {
     return staticAnchor ? 1 : 5;
@@ -555,6 +657,7 @@ void Anchor::setLayout(MultiSplitterLayout *layout)
 {
     m_layout->removeAnchor(this);
     m_layout = layout;
+    m_cumulativeMinLengthGeneration[0] = m_cumulativeMinLengthGeneration[1] = 0; // Generations are per layout
     setParent(layout->multiSplitter());
     m_separatorWidget->setParent(layout->multiSplitter());
     m_layout->insertAnchor(this);
@@ -595,8 +698,20 @@ void Anchor::addItem(Item *item, Anchor::Side side)
 {
     Q_ASSERT(side != Side_None);
     auto &items = (side == Side1) ? m_side1Items : m_side2Items;
-    if (!items.contains(item)) {
+    auto &itemSet = (side == Side1) ? m_side1ItemSet : m_side2ItemSet;
+    if (!itemSet.contains(item)) {
         items << item;
+        itemSet.insert(item);
+        m_layout->invalidateStructure();
+
+        // The anchor losing its place in the item's group still has the item, it must be verified too
+        if (Anchor *previous = item->anchorGroup().anchorAtSide(oppositeSide(side), orientation())) {
+            if (previous != this)
+                previous->m_layout->markTouched(previous);
+        }
+        m_layout->markTouched(this);
+        m_layout->markTouched(item);
+
         item->anchorGroup().setAnchor(this, orientation(), side);
         Q_EMIT itemsChanged(side);
         updateItemSizes();
@@ -611,11 +726,19 @@ void Anchor::addItems(const ItemList &list, Side side)
 
 void Anchor::removeItem(Item *item)
 {
-    if (m_side1Items.removeOne(item)) {
+    if (m_side1ItemSet.remove(item)) {
+        m_layout->markTouched(this);
+        m_layout->markTouched(item);
+        m_side1Items.removeOne(item);
+        m_layout->invalidateStructure();
         item->anchorGroup().setAnchor(nullptr, orientation(), Side1);
         Q_EMIT itemsChanged(Side1);
     } else {
-        if (m_side2Items.removeOne(item)) {
+        if (m_side2ItemSet.remove(item)) {
+            m_layout->markTouched(this);
+            m_layout->markTouched(item);
+            m_side2Items.removeOne(item);
+            m_layout->invalidateStructure();
             item->anchorGroup().setAnchor(nullptr, orientation(), Side2);
             Q_EMIT itemsChanged(Side2);
         }
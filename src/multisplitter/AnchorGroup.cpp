@@ -192,6 +192,9 @@ Anchor *AnchorGroup::anchorAtSide(Anchor::Side side, Qt::Orientation orientation
 
 void AnchorGroup::setAnchor(Anchor *anchor, Location loc)
 {
+    if (layout)
+        layout->invalidateStructure();
+
     switch (loc) {
 
     case KDDockWidgets::Location_OnLeft:
@@ -307,6 +310,9 @@ void AnchorGroup::updateItemSizes()
 
 void AnchorGroup::setAnchor(Anchor *a, Qt::Orientation orientation, Anchor::Side side)
 {
+    if (layout)
+        layout->invalidateStructure();
+
     const bool isSide1 = side == Anchor::Side1;
     if (orientation == Qt::Vertical) {
         if (isSide1)
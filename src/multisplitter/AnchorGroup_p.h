@@ -102,7 +102,7 @@ struct DOCKS_EXPORT_FOR_UNIT_TESTS AnchorGroup
     Anchor *left = nullptr;
     Anchor *bottom = nullptr;
     Anchor *right = nullptr;
-    MultiSplitterLayout *layout;
+    MultiSplitterLayout *layout = nullptr;
 
     QDebug debug(QDebug d) const;
 };
@@ -23,9 +23,11 @@
 
 #include "docks_export.h"
 
+#include <QHash>
 #include <QObject>
 #include <QPointer>
 #include <QRect>
+#include <QSet>
 #include <QVector>
 
 namespace KDDockWidgets {
@@ -212,12 +214,23 @@ public:
 
     static Anchor *createFrom(Anchor *other, Item *relativeTo = nullptr);
     void setPositionOffset(int);
+    int positionOffset() const { return m_positionOffset; }
     bool isBeingDragged() const;
 
     Type type() const { return m_type; }
 
+    /**
+     * @brief Returns the minimum length needed by all items on side @p side, up to the static anchor.
+     * Memoized, see MultiSplitterLayout::invalidateCumulativeMinLengths().
+     */
     int cumulativeMinLength(Anchor::Side side) const;
 
+    /**
+     * @brief Same as cumulativeMinLength() but computed from scratch, memoized in @p memo instead of in
+     * the anchors. Used by MultiSplitterLayout::checkSanity() to verify the cache without touching it.
+     */
+    int freshCumulativeMinLength(Anchor::Side side, QHash<const Anchor*, int> &memo) const;
+
     /**
      * @brief Makes this separator follow another one. This one will be made invisible.
      * Used when the item in the layout is just a placeholder remembering a previous dock widget position.
@@ -235,6 +248,9 @@ public:
      */
     Anchor *endFollowee() const;
 
+    ///@brief returns the anchors following this one directly
+    const List followers() const { return m_followers; }
+
     /**
      * @brief Recursively looks for an anchor in the whole layout but only looking at side @p side
      *
@@ -253,7 +269,6 @@ public:
 
     static int thickness(bool staticAnchor);
     static Anchor::Side oppositeSide(Side side);
-    void onFolloweePositionChanged(int pos);
     bool isFollowing() const { return m_followee != nullptr; }
 
     void onMousePress();
@@ -287,9 +302,23 @@ public:
     void setGeometry(QRect);
     QRect geometry() const { return m_geometry; }
 
+    /**
+     * @brief Sets the geometry solved by LayoutEngine. Items aren't touched, the engine already solved them too.
+     * If the position changed, positionChanged() is emitted once the layout's transaction commits.
+     */
+    void setGeometryFromEngine(QRect, qreal positionPercentage);
+
+    ///@brief Applies the geometry to the separator widget, if it was deferred by a MultiSplitterLayout transaction
+    void commitGeometry();
+
+    ///@brief Emits the positionChanged() deferred by setGeometryFromEngine(), if any
+    void commitPositionChanged();
+
     const Qt::Orientation m_orientation;
     ItemList m_side1Items;
     ItemList m_side2Items;
+    QSet<const Item*> m_side1ItemSet; // Same as m_side1Items, for O(1) containsItem()
+    QSet<const Item*> m_side2ItemSet;
     QPointer<Anchor> m_from;// QPointer just so we can assert. They should never be null.
     QPointer<Anchor> m_to;
     const Type m_type;
@@ -312,6 +341,24 @@ public:
     SeparatorWidget *const m_separatorWidget;
     QRect m_geometry;
     QPointer<Anchor> m_followee;
+    List m_followers; // Moved directly by setPosition(), no signals involved
+    bool m_separatorGeometryDirty = false;
+    bool m_positionChangePending = false;
+
+    // Memoized cumulativeMinLength(), indexed by Side1 and Side2. Only valid if the generation matches
+    // MultiSplitterLayout::cumulativeMinLengthGeneration()
+    mutable int m_cumulativeMinLength[2] = {0, 0};
+    mutable quint64 m_cumulativeMinLengthGeneration[2] = {0, 0};
+
+private:
+    ///@brief setPosition() without moving the followers. Returns whether the position changed.
+    bool setPositionWithoutFollowers(int p, SetPositionOptions options);
+
+    ///@brief The uncached cumulativeMinLength(). With @p freshMemo the items' anchors don't use their cache either.
+    int computeCumulativeMinLength(Anchor::Side side, QHash<const Anchor*, int> *freshMemo = nullptr) const;
+
+    ///@brief Defers the separator's geometry until the layout's transaction is committed
+    void setSeparatorGeometryDirty();
 };
 }
 
@@ -26,6 +26,7 @@
 #include "Frame_p.h"
 #include "MainWindow.h"
 #include "DockWidget.h"
+#include "EventRouter_p.h"
 
 #include <QEvent>
 
@@ -60,6 +61,7 @@ public:
     bool m_destroying = false;
     int m_refCount = 0;
     bool m_blockPropagateGeo = false;
+    bool m_frameGeometryDirty = false;
     QMetaObject::Connection m_onFrameDestroyed_connection;
     QMetaObject::Connection m_onFrameObjectNameChanged_connection;
 };
@@ -152,10 +154,20 @@ void Item::setGeometry(QRect geo)
                  << "; window=" << parentWidget()->window()
                  << "this=" << this;*/
         d->m_geometry = geo;
+        if (d->m_layout)
+            d->m_layout->markTouched(this);
         Q_EMIT geometryChanged();
 
-        if (!isPlaceholder())
-            d->m_frame->setGeometry(geo);
+        if (!isPlaceholder()) {
+            if (d->m_layout && d->m_layout->isInTransaction()) {
+                if (!d->m_frameGeometryDirty) {
+                    d->m_frameGeometryDirty = true;
+                    d->m_layout->addDirtyItem(this);
+                }
+            } else {
+                d->m_frame->setGeometry(geo);
+            }
+        }
 
         if (!d->m_blockPropagateGeo && d->m_anchorGroup.isValid() && geoDiff.onlyOneSideChanged) {
             // If we're being squeezed to the point where it reaches less then our min size, then we drag the opposite separator, to preserve size
@@ -182,6 +194,16 @@ void Item::setGeometry(QRect geo)
     }
 }
 
+void Item::commitGeometry()
+{
+    if (!d->m_frameGeometryDirty)
+        return;
+
+    d->m_frameGeometryDirty = false;
+    if (!isPlaceholder() && d->m_frame)
+        d->m_frame->setGeometry(d->m_geometry);
+}
+
 void Item::beginBlockPropagateGeo()
 {
     Q_ASSERT(!d->m_blockPropagateGeo);
@@ -369,6 +391,10 @@ void Item::Private::setMinimumSize(QSize sz)
 {
     if (sz != m_minSize) {
         m_minSize = sz;
+        if (m_layout) {
+            m_layout->invalidateCumulativeMinLengths();
+            m_layout->markTouched(q);
+        }
         Q_EMIT q->minimumSizeChanged();
     }
 }
@@ -378,7 +404,7 @@ void Item::Private::setFrame(Frame *frame)
     Q_ASSERT((m_frame && !frame) || (!m_frame && frame));
 
     if (m_frame) {
-        m_frame->removeEventFilter(q);
+        EventRouter::instance()->removeRoute(m_frame, q);
         QObject::disconnect(m_onFrameDestroyed_connection);
         QObject::disconnect(m_onFrameObjectNameChanged_connection);
     }
@@ -388,7 +414,7 @@ void Item::Private::setFrame(Frame *frame)
 
     if (frame) {
         frame->setLayoutItem(q);
-        frame->installEventFilter(q);
+        EventRouter::instance()->addRoute(frame, q, EventRouter::ParentChangeEvents);
         // auto destruction
         m_onFrameDestroyed_connection = q->connect(frame, &QObject::destroyed, q, [this] {
             if (!m_layout) {
@@ -453,23 +479,24 @@ void Item::Private::turnIntoPlaceholder()
     setFrame(nullptr);
     setIsPlaceholder(true);
 
-    m_layout->clearAnchorsFollowing();
-
     AnchorGroup anchorGroup = q->anchorGroup();
     if (anchorGroup.isValid()) {
         m_layout->emitVisibleWidgetCountChanged();
+        m_layout->updateAnchorFollowing(anchorGroup.anchors(), anchorGroup);
     } else {
-        // Auto-destruction, which removes it from the layout
+        // Auto-destruction, which removes it from the layout and updates the followers
         delete q;
     }
-
-    m_layout->updateAnchorFollowing(anchorGroup);
 }
 
 void Item::Private::setIsPlaceholder(bool is)
 {
     if (is != m_isPlaceholder) {
         m_isPlaceholder = is;
+        if (m_layout) {
+            m_layout->invalidateCumulativeMinLengths(); // Placeholders have no minimum size
+            m_layout->markTouched(q);
+        }
         Q_EMIT q->isPlaceholderChanged();
     }
 }
@@ -109,6 +109,9 @@ public:
 
     void setGeometry(QRect);
 
+    ///@brief Applies the geometry to the Frame, if it was deferred by a MultiSplitterLayout transaction
+    void commitGeometry();
+
     void beginBlockPropagateGeo();
     void endBlockPropagateGeo();
 
@@ -0,0 +1,584 @@
+/*
+  This file is part of KDDockWidgets.
+
+  Copyright (C) 2018-2019 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com
+  Author: Sérgio Martins <sergio.martins@kdab.com>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "LayoutEngine_p.h"
+
+#include <QDebug>
+
+#include <algorithm>
+
+using namespace KDDockWidgets;
+
+static int sideIndex(LayoutEngine::Side side)
+{
+    return side == LayoutEngine::Side1 ? 0 : 1;
+}
+
+int LayoutEngine::addAnchor(Qt::Orientation orientation, int thickness, AnchorType type,
+                            int position, qreal positionPercentage)
+{
+    AnchorNode node;
+    node.orientation = orientation;
+    node.thickness = thickness;
+    node.type = type;
+    node.position = position;
+    node.positionPercentage = positionPercentage;
+
+    m_anchors.push_back(node);
+    m_followers.push_back({});
+    m_dirtyAnchors.push_back(false);
+    invalidateCumulativeMinLengths();
+
+    const int index = m_anchors.size() - 1;
+    if (type != AnchorType_Normal)
+        m_staticAnchors[type == AnchorType_Side1Static ? 0 : 1][orientation == Qt::Vertical ? 0 : 1] = index;
+
+    return index;
+}
+
+int LayoutEngine::addItem(QRect geometry, QSize minSize, bool isPlaceholder)
+{
+    ItemNode node;
+    node.geometry = geometry;
+    node.minSize = minSize;
+    node.isPlaceholder = isPlaceholder;
+
+    m_items.push_back(node);
+    m_dirtyItems.push_back(false);
+    invalidateCumulativeMinLengths();
+
+    return m_items.size() - 1;
+}
+
+void LayoutEngine::setFromTo(int anchor, int from, int to)
+{
+    AnchorNode &node = m_anchors[anchor];
+    node.from = from;
+    node.to = to;
+}
+
+void LayoutEngine::addItemToAnchor(int anchor, int item, Side side)
+{
+    Q_ASSERT(side != Side_None);
+    AnchorNode &node = m_anchors[anchor];
+    QVector<int> &items = side == Side1 ? node.side1Items : node.side2Items;
+    if (items.contains(item))
+        return;
+
+    items.push_back(item);
+
+    // Same as AnchorGroup::setAnchor(), our Side1 is the item's right or bottom
+    ItemNode &itemNode = m_items[item];
+    if (node.isVertical()) {
+        if (side == Side1)
+            itemNode.right = anchor;
+        else
+            itemNode.left = anchor;
+    } else {
+        if (side == Side1)
+            itemNode.bottom = anchor;
+        else
+            itemNode.top = anchor;
+    }
+
+    invalidateCumulativeMinLengths();
+}
+
+void LayoutEngine::setFollowee(int anchor, int followee)
+{
+    Q_ASSERT(anchor != followee);
+    AnchorNode &node = m_anchors[anchor];
+    if (node.followee == followee)
+        return;
+
+    if (node.followee != -1)
+        m_followers[node.followee].removeOne(anchor);
+
+    node.followee = followee;
+    invalidateCumulativeMinLengths();
+
+    if (followee != -1) {
+        Q_ASSERT(node.orientation == m_anchors.at(followee).orientation);
+        m_followers[followee].push_back(anchor);
+        if (node.position != m_anchors.at(followee).position)
+            setAnchorPosition(anchor, m_anchors.at(followee).position);
+    }
+}
+
+void LayoutEngine::setPositionOffset(int anchor, int offset)
+{
+    AnchorNode &node = m_anchors[anchor];
+    if (node.positionOffset == offset)
+        return;
+
+    node.positionOffset = offset;
+    updateItemSizes(anchor);
+}
+
+void LayoutEngine::resetAnchorState(int anchor, int position, qreal positionPercentage, int positionOffset)
+{
+    AnchorNode &node = m_anchors[anchor];
+    node.position = position;
+    node.positionPercentage = positionPercentage;
+    node.positionOffset = positionOffset;
+}
+
+void LayoutEngine::resetItemState(int item, QRect geometry, QSize minSize, bool isPlaceholder)
+{
+    ItemNode &node = m_items[item];
+    node.geometry = geometry;
+    if (node.minSize != minSize || node.isPlaceholder != isPlaceholder) {
+        node.minSize = minSize;
+        node.isPlaceholder = isPlaceholder;
+        invalidateCumulativeMinLengths();
+    }
+}
+
+int LayoutEngine::contentsLength(Qt::Orientation o) const
+{
+    return o == Qt::Vertical ? m_contentsSize.width()
+                             : m_contentsSize.height();
+}
+
+int LayoutEngine::staticAnchor(Side side, Qt::Orientation orientation) const
+{
+    Q_ASSERT(side != Side_None);
+    return m_staticAnchors[sideIndex(side)][orientation == Qt::Vertical ? 0 : 1];
+}
+
+int LayoutEngine::thickness(int anchor) const
+{
+    const AnchorNode &node = m_anchors.at(anchor);
+    return node.isFollowing() ? thickness(node.followee)
+                              : node.thickness;
+}
+
+int LayoutEngine::cumulativeMinLength(int anchor, Side side) const
+{
+    if (m_cumulativeMinLengthsGeneration != m_generation) {
+        // Positions don't influence the min lengths, only the topology and the min sizes do
+        for (QVector<int> &cache : m_cumulativeMinLengths)
+            cache.fill(-1, m_anchors.size());
+        m_cumulativeMinLengthsGeneration = m_generation;
+    }
+
+    const int cached = m_cumulativeMinLengths[sideIndex(side)].at(anchor);
+    if (cached != -1)
+        return cached;
+
+    const AnchorNode &node = m_anchors.at(anchor);
+    int result = -1;
+
+    if (node.isStatic() && node.side1Items.isEmpty() && node.side2Items.isEmpty()) {
+        // There's no item, but minimum is the space occupied by left+right anchors (or top+bottom).
+        if ((side == Side2 && node.type == AnchorType_Side1Static) ||
+            (side == Side1 && node.type == AnchorType_Side2Static))
+            result = 2 * node.thickness;
+    }
+
+    if (result == -1) {
+        int minLength = 0;
+        for (int item : node.items(side))
+            minLength = qMax(minLength, itemCumulativeMinLength(item, side, node.orientation));
+
+        result = minLength + (node.isFollowing() ? 0 : thickness(anchor));
+    }
+
+    m_cumulativeMinLengths[sideIndex(side)][anchor] = result;
+    return result;
+}
+
+int LayoutEngine::itemCumulativeMinLength(int item, Side side, Qt::Orientation orientation) const
+{
+    const ItemNode &node = m_items.at(item);
+    const int oppositeAnchor = node.anchorAtSide(side, orientation);
+    Q_ASSERT(oppositeAnchor != -1);
+    return node.minLength(orientation) + cumulativeMinLength(oppositeAnchor, side);
+}
+
+QPair<int, int> LayoutEngine::boundPositions(int anchor) const
+{
+    const AnchorNode &node = m_anchors.at(anchor);
+    if (node.type == AnchorType_Side1Static) {
+        return {0, 0};
+    } else if (node.type == AnchorType_Side2Static) {
+        const int max = contentsLength(node.orientation) - 1;
+        return {max, max};
+    }
+
+    const int minSide1Length = cumulativeMinLength(anchor, Side1);
+    const int minSide2Length = cumulativeMinLength(anchor, Side2);
+
+    return { minSide1Length - thickness(anchor), contentsLength(node.orientation) - minSide2Length };
+}
+
+int LayoutEngine::boundPosition(int anchor, Side direction) const
+{
+    const QPair<int, int> bounds = boundPositions(anchor);
+    return direction == Side1 ? bounds.first
+                              : bounds.second;
+}
+
+int LayoutEngine::minPosition(int anchor) const
+{
+    return m_anchors.at(anchor).position - smallestAvailableItemSqueeze(anchor, Side1);
+}
+
+int LayoutEngine::smallestAvailableItemSqueeze(int anchor, Side side) const
+{
+    const AnchorNode &node = m_anchors.at(anchor);
+    int smallest = 0;
+    bool firstElement = true;
+    for (int item : node.items(side)) {
+        const ItemNode &itemNode = m_items.at(item);
+        const int availableSqueeze = itemNode.length(node.orientation) - itemNode.minLength(node.orientation);
+        if (availableSqueeze < smallest || firstElement) {
+            smallest = availableSqueeze;
+            firstElement = false;
+        }
+    }
+
+    return smallest;
+}
+
+bool LayoutEngine::hasNonPlaceholderItems(int anchor, Side side) const
+{
+    for (int item : m_anchors.at(anchor).items(side)) {
+        if (!m_items.at(item).isPlaceholder)
+            return true;
+    }
+
+    return false;
+}
+
+QSize LayoutEngine::minimumSize() const
+{
+    const int left = staticAnchor(Side1, Qt::Vertical);
+    const int top = staticAnchor(Side1, Qt::Horizontal);
+    if (left == -1 || top == -1)
+        return {};
+
+    return { cumulativeMinLength(left, Side2), cumulativeMinLength(top, Side2) };
+}
+
+QRect LayoutEngine::anchorGeometry(int anchor) const
+{
+    const AnchorNode &node = m_anchors.at(anchor);
+    if (node.from == -1 || node.to == -1)
+        return {};
+
+    const AnchorNode &from = m_anchors.at(node.from);
+    const AnchorNode &to = m_anchors.at(node.to);
+    const int length = to.position - from.position;
+    const int fromEnd = from.position + thickness(node.from) - 1; // Same as Anchor::geometry().bottom() (or right())
+
+    if (node.isVertical())
+        return QRect(node.position, fromEnd, thickness(anchor), length);
+
+    return QRect(fromEnd, node.position, length, thickness(anchor));
+}
+
+void LayoutEngine::setAnchorPosition(int anchor, int position, int options)
+{
+    if (!setAnchorPositionWithoutFollowers(anchor, position, options))
+        return;
+
+    // Same as Anchor::setPosition(), the whole chain of followers is moved in a single pass
+    QVector<int> chain = m_followers.at(anchor);
+    for (int i = 0; i < chain.size(); ++i) {
+        const int follower = chain.at(i);
+        if (setAnchorPositionWithoutFollowers(follower, position, SetPositionOption_None))
+            chain += m_followers.at(follower);
+    }
+}
+
+bool LayoutEngine::setAnchorPositionWithoutFollowers(int anchor, int position, int options)
+{
+    AnchorNode &node = m_anchors[anchor];
+    const bool changed = node.position != position;
+    if (changed) {
+        node.position = position;
+        if (!(options & SetPositionOption_DontRecalculatePercentage))
+            node.positionPercentage = (position * 1.0) / contentsLength(node.orientation); // Same as Anchor::setPosition()
+
+        m_dirtyAnchors[anchor] = true;
+    }
+
+    updateItemSizes(anchor);
+    return changed;
+}
+
+void LayoutEngine::updateItemSizes(int anchor)
+{
+    const AnchorNode &node = m_anchors.at(anchor);
+    const int anchorThickness = thickness(anchor);
+    const bool isVertical = node.isVertical();
+    const QVector<int> side1Items = node.side1Items;
+    const QVector<int> side2Items = node.side2Items;
+
+    // Same as Anchor::updateItemSizes(), the offset pushes the items away from the anchor
+    int position = node.position + node.positionOffset;
+    for (int item : side2Items) {
+        if (m_items.at(item).isPlaceholder)
+            continue;
+
+        QRect geo = m_items.at(item).geometry;
+        const QPoint topLeft = isVertical ? QPoint(position + anchorThickness, geo.y())
+                                          : QPoint(geo.x(), position + anchorThickness);
+        geo.setTopLeft(topLeft);
+        setItemGeometry(item, geo);
+    }
+
+    position = m_anchors.at(anchor).position - m_anchors.at(anchor).positionOffset;
+    for (int item : side1Items) {
+        if (m_items.at(item).isPlaceholder)
+            continue;
+
+        QRect geo = m_items.at(item).geometry;
+        // -1 as the item is right next to the anchor, and not on top
+        const QPoint bottomRight = isVertical ? QPoint(position - 1, geo.bottom())
+                                              : QPoint(geo.right(), position - 1);
+        geo.setBottomRight(bottomRight);
+        setItemGeometry(item, geo);
+    }
+}
+
+void LayoutEngine::setItemGeometry(int item, QRect geometry)
+{
+    ItemNode &node = m_items[item];
+    const QRect oldGeo = node.geometry;
+    if (oldGeo == geometry)
+        return;
+
+    node.geometry = geometry;
+    m_dirtyItems[item] = true;
+
+    if (m_blockPropagateGeo || !node.hasAllAnchors())
+        return;
+
+    const int leftDiff = geometry.left() - oldGeo.left();
+    const int topDiff = geometry.top() - oldGeo.top();
+    const int rightDiff = geometry.right() - oldGeo.right();
+    const int bottomDiff = geometry.bottom() - oldGeo.bottom();
+    const int numChanged = (leftDiff ? 1 : 0) + (topDiff ? 1 : 0) + (rightDiff ? 1 : 0) + (bottomDiff ? 1 : 0);
+    if (numChanged != 1)
+        return;
+
+    // If we're being squeezed to the point where it reaches less then our min size, then we drag the opposite anchor, to preserve size
+    const Qt::Orientation orientation = (leftDiff || rightDiff) ? Qt::Vertical : Qt::Horizontal;
+    const int lengthDelta = node.length(orientation) - node.minLength(orientation);
+    if (lengthDelta >= 0)
+        return;
+
+    int anchorToMove = -1;
+    if (leftDiff)
+        anchorToMove = node.right;
+    else if (topDiff)
+        anchorToMove = node.bottom;
+    else if (rightDiff)
+        anchorToMove = node.left;
+    else
+        anchorToMove = node.top;
+
+    while (m_anchors.at(anchorToMove).isFollowing())
+        anchorToMove = m_anchors.at(anchorToMove).followee;
+
+    const int delta = leftDiff + topDiff + rightDiff + bottomDiff;
+    const int signess = delta > 0 ? 1 : -1;
+    setAnchorPosition(anchorToMove, m_anchors.at(anchorToMove).position - (lengthDelta * signess));
+}
+
+void LayoutEngine::positionStaticAnchors()
+{
+    const int left = staticAnchor(Side1, Qt::Vertical);
+    const int top = staticAnchor(Side1, Qt::Horizontal);
+    const int right = staticAnchor(Side2, Qt::Vertical);
+    const int bottom = staticAnchor(Side2, Qt::Horizontal);
+    if (left == -1 || top == -1 || right == -1 || bottom == -1) {
+        qWarning() << Q_FUNC_INFO << "Missing static anchors";
+        return;
+    }
+
+    setAnchorPosition(left, 0);
+    setAnchorPosition(top, 0);
+    setAnchorPosition(bottom, m_contentsSize.height() - 1);
+    setAnchorPosition(right, m_contentsSize.width() - 1);
+}
+
+void LayoutEngine::resize(QSize newSize)
+{
+    const QSize oldSize = m_contentsSize;
+    if (oldSize == newSize)
+        return;
+
+    m_contentsSize = newSize;
+    positionStaticAnchors();
+    if (!oldSize.isValid() || !newSize.isValid())
+        return;
+
+    redistributeSpace(Qt::Vertical);
+    redistributeSpace(Qt::Horizontal);
+}
+
+QVector<int> LayoutEngine::topologicalOrder(Qt::Orientation orientation) const
+{
+    QVector<int> postOrder;
+    QVector<bool> visited(m_anchors.size(), false);
+    const int start = staticAnchor(Side1, orientation);
+    if (start == -1)
+        return postOrder;
+
+    for (int item : m_anchors.at(start).side2Items)
+        collectPostOrder(m_items.at(item).anchorAtSide(Side2, orientation), Side2, visited, postOrder);
+
+    std::reverse(postOrder.begin(), postOrder.end());
+    return postOrder;
+}
+
+void LayoutEngine::collectPostOrder(int anchor, Side direction, QVector<bool> &visited, QVector<int> &postOrder) const
+{
+    const AnchorNode &node = m_anchors.at(anchor);
+    if (node.isStatic() || visited.at(anchor))
+        return;
+
+    visited[anchor] = true;
+    for (int item : node.items(direction))
+        collectPostOrder(m_items.at(item).anchorAtSide(direction, node.orientation), direction, visited, postOrder);
+
+    postOrder.push_back(anchor);
+}
+
+void LayoutEngine::redistributeSpace(Qt::Orientation orientation)
+{
+    // Visit each anchor once, in topological order, so its predecessors were already positioned.
+    // The min position each anchor inherits from the anchors before it is the largest one.
+    const QVector<int> order = topologicalOrder(orientation);
+    QVector<int> inheritedMinPositions(m_anchors.size(), -1);
+    const int length = contentsLength(orientation);
+
+    for (int anchor : order) {
+        int minAnchorPos = qMax(0, inheritedMinPositions.at(anchor));
+
+        // We use the minPos of the Anchor that had non-placeholder items on its side1.
+        if (hasNonPlaceholderItems(anchor, Side1))
+            minAnchorPos = minPosition(anchor);
+
+        const AnchorNode &node = m_anchors.at(anchor);
+        if (hasNonPlaceholderItems(anchor, Side2) && !node.isFollowing()) {
+            const int newPosition = int(node.positionPercentage * length);
+
+            // But don't let the anchor go out of bounds, it must respect its items min sizes
+            const int newPositionBounded = qBound(minAnchorPos, newPosition, boundPosition(anchor, Side2));
+            setAnchorPosition(anchor, newPositionBounded, SetPositionOption_DontRecalculatePercentage);
+        }
+
+        for (int item : m_anchors.at(anchor).side2Items) {
+            const int nextAnchor = m_items.at(item).anchorAtSide(Side2, orientation);
+            inheritedMinPositions[nextAnchor] = qMax(inheritedMinPositions.at(nextAnchor), minAnchorPos);
+        }
+    }
+}
+
+void LayoutEngine::propagateResize(int delta, int fromAnchor, Side direction)
+{
+    Q_ASSERT(delta >= 0);
+    if (delta == 0 || m_anchors.at(fromAnchor).isStatic())
+        return;
+
+    // The anchors form a DAG with shared nodes, so instead of enumerating every path, which explodes
+    // on grid-like layouts, we compute the shortest path going through each anchor. That's what
+    // determines how much the anchor contributes.
+    const Qt::Orientation orientation = m_anchors.at(fromAnchor).orientation;
+    QVector<int> postOrder;
+    QVector<bool> visited(m_anchors.size(), false);
+    collectPostOrder(fromAnchor, direction, visited, postOrder);
+
+    QVector<int> distanceFromStart(m_anchors.size(), 0); // In anchors, the start anchor counts as 1
+    QVector<int> distanceToEnd(m_anchors.size(), 0); // In anchors, until the last non-static one
+
+    // Successors come first in postOrder
+    for (int anchor : qAsConst(postOrder)) {
+        int shortestTail = -1;
+        for (int item : m_anchors.at(anchor).items(direction)) {
+            const int next = m_items.at(item).anchorAtSide(direction, orientation);
+            const int tail = m_anchors.at(next).isStatic() ? 0 : distanceToEnd.at(next);
+            shortestTail = shortestTail == -1 ? tail : qMin(shortestTail, tail);
+        }
+        distanceToEnd[anchor] = 1 + qMax(0, shortestTail);
+    }
+
+    // Predecessors come first in the reversed postOrder, which starts with fromAnchor
+    distanceFromStart[fromAnchor] = 1;
+    for (int i = postOrder.size() - 1; i >= 0; --i) {
+        const int anchor = postOrder.at(i);
+        const int distance = distanceFromStart.at(anchor);
+        for (int item : m_anchors.at(anchor).items(direction)) {
+            const int next = m_items.at(item).anchorAtSide(direction, orientation);
+            if (m_anchors.at(next).isStatic())
+                continue;
+
+            if (distanceFromStart.at(next) == 0 || distance + 1 < distanceFromStart.at(next))
+                distanceFromStart[next] = distance + 1;
+        }
+    }
+
+    // Bucket the anchors by the length of their shortest path, keeping the topological order within a bucket
+    QVector<QVector<int>> anchorsByPathLength(postOrder.size() + 1);
+    for (int i = postOrder.size() - 1; i >= 0; --i) {
+        const int anchor = postOrder.at(i);
+        if (anchor != fromAnchor)
+            anchorsByPathLength[distanceFromStart.at(anchor) + distanceToEnd.at(anchor) - 1].push_back(anchor);
+    }
+
+    const bool towardsSide1 = direction == Side1;
+    const int sign = towardsSide1 ? -1 : 1;
+
+    // Smallest paths first, as they have less anchors to share delta with
+    for (int pathLength = 2, end = anchorsByPathLength.size(); pathLength < end; ++pathLength) {
+        const int contributionPerAnchor = (delta / (pathLength - 1)) * sign; // n-1 because the initial anchor already contributed
+        if (qAbs(contributionPerAnchor) < 5) {
+            // Too small, don't bother. Longer paths would contribute even less.
+            break;
+        }
+
+        for (int anchor : qAsConst(anchorsByPathLength[pathLength])) {
+            // When moving anchors don't allow items to go bellow their min size
+            const int bound = boundPosition(anchor, direction);
+            int newPosition = m_anchors.at(anchor).position + contributionPerAnchor;
+            if ((towardsSide1 && newPosition < bound) || (!towardsSide1 && newPosition > bound))
+                newPosition = bound;
+
+            if (m_anchors.at(anchor).position != newPosition)
+                setAnchorPosition(anchor, newPosition);
+        }
+    }
+}
+
+void LayoutEngine::clearDirty()
+{
+    m_dirtyAnchors.fill(false);
+    m_dirtyItems.fill(false);
+}
+
+void LayoutEngine::invalidateCumulativeMinLengths()
+{
+    // The cache is only refilled when it's next read, so building a graph stays linear
+    ++m_generation;
+}
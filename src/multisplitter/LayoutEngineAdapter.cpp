@@ -0,0 +1,153 @@
+/*
+  This file is part of KDDockWidgets.
+
+  Copyright (C) 2018-2019 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com
+  Author: Sérgio Martins <sergio.martins@kdab.com>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "LayoutEngineAdapter_p.h"
+#include "MultiSplitterLayout_p.h"
+#include "Item_p.h"
+#include "Logging_p.h"
+
+using namespace KDDockWidgets;
+
+static LayoutEngine::AnchorType engineAnchorType(const Anchor *anchor)
+{
+    if (anchor->type() & (Anchor::Type_LeftStatic | Anchor::Type_TopStatic))
+        return LayoutEngine::AnchorType_Side1Static;
+
+    if (anchor->type() & (Anchor::Type_RightStatic | Anchor::Type_BottomStatic))
+        return LayoutEngine::AnchorType_Side2Static;
+
+    return LayoutEngine::AnchorType_Normal;
+}
+
+LayoutEngineSnapshot::LayoutEngineSnapshot(MultiSplitterLayout *layout)
+    : anchors(layout->anchors())
+    , items(layout->items())
+    , structureGeneration(layout->structureGeneration())
+{
+    engine.setContentsSize(layout->contentsSize());
+
+    for (Anchor *anchor : anchors) {
+        const int index = engine.addAnchor(anchor->orientation(), Anchor::thickness(anchor->isStatic()),
+                                           engineAnchorType(anchor), anchor->position(),
+                                           anchor->positionPercentage());
+        engine.setPositionOffset(index, anchor->positionOffset());
+        anchorIndexes.insert(anchor, index);
+    }
+
+    for (Item *item : items) {
+        const int index = engine.addItem(item->geometry(), item->minimumSize(), item->isPlaceholder());
+        itemIndexes.insert(item, index);
+    }
+
+    for (Anchor *anchor : anchors) {
+        const int index = anchorIndexes.value(anchor);
+        engine.setFromTo(index, anchorIndexes.value(anchor->from(), -1), anchorIndexes.value(anchor->to(), -1));
+
+        for (Anchor::Side side : { Anchor::Side1, Anchor::Side2 }) {
+            for (Item *item : anchor->items(side)) {
+                const int itemIndex = itemIndexes.value(item, -1);
+                if (itemIndex == -1) {
+                    qWarning() << Q_FUNC_INFO << "Anchor has" << item << "but the layout does not";
+                    continue;
+                }
+
+                engine.addItemToAnchor(index, itemIndex, LayoutEngine::Side(side));
+            }
+        }
+    }
+
+    for (Anchor *anchor : anchors) {
+        if (Anchor *followee = anchor->followee())
+            engine.setFollowee(anchorIndexes.value(anchor), anchorIndexes.value(followee, -1));
+    }
+
+    engine.clearDirty();
+}
+
+void LayoutEngineSnapshot::refresh(MultiSplitterLayout *layout)
+{
+    Q_ASSERT(structureGeneration == layout->structureGeneration());
+    engine.setContentsSize(layout->contentsSize());
+
+    for (int i = 0, end = anchors.size(); i < end; ++i) {
+        const Anchor *anchor = anchors.at(i);
+        engine.resetAnchorState(i, anchor->position(), anchor->positionPercentage(), anchor->positionOffset());
+    }
+
+    for (int i = 0, end = items.size(); i < end; ++i) {
+        const Item *item = items.at(i);
+        engine.resetItemState(i, item->geometry(), item->minimumSize(), item->isPlaceholder());
+    }
+
+    engine.clearDirty();
+}
+
+LayoutEngineAdapter::LayoutEngineAdapter(MultiSplitterLayout *layout)
+    : m_layout(layout)
+    , m_snapshot(layout->takeEngineSnapshot())
+{
+    if (m_snapshot)
+        m_snapshot->refresh(layout);
+    else
+        m_snapshot.reset(new LayoutEngineSnapshot(layout));
+}
+
+LayoutEngineAdapter::~LayoutEngineAdapter()
+{
+    if (m_layout) // Might have been deleted meanwhile
+        m_layout->returnEngineSnapshot(std::move(m_snapshot));
+}
+
+void LayoutEngineAdapter::apply()
+{
+    if (!m_layout)
+        return;
+
+    // Separators and Frames are only moved once the transaction commits, followed by the positionChanged signals
+    LayoutTransaction transaction(m_layout);
+    const LayoutEngine &engine = m_snapshot->engine;
+    const ItemList &items = m_snapshot->items;
+    const Anchor::List &anchors = m_snapshot->anchors;
+
+    for (int i = 0, end = items.size(); i < end; ++i) {
+        if (!engine.isItemDirty(i))
+            continue;
+
+        // The engine already pushed the anchors of squeezed items, don't let Item do it again
+        Item *item = items.at(i);
+        item->beginBlockPropagateGeo();
+        item->setGeometry(engine.item(i).geometry);
+        item->endBlockPropagateGeo();
+    }
+
+    // Anchors starting or ending at a moved anchor need their length updated too
+    for (int i = 0, end = anchors.size(); i < end; ++i) {
+        const LayoutEngine::AnchorNode &node = engine.anchor(i);
+        const bool needsUpdate = engine.isAnchorDirty(i)
+                || (node.from != -1 && engine.isAnchorDirty(node.from))
+                || (node.to != -1 && engine.isAnchorDirty(node.to));
+
+        if (needsUpdate && node.from != -1 && node.to != -1)
+            anchors.at(i)->setGeometryFromEngine(engine.anchorGeometry(i), node.positionPercentage);
+    }
+
+    qCDebug(sizing) << Q_FUNC_INFO << "Applied" << items.size() << "items and" << anchors.size() << "anchors";
+    m_snapshot->engine.clearDirty();
+}
@@ -0,0 +1,99 @@
+/*
+  This file is part of KDDockWidgets.
+
+  Copyright (C) 2018-2019 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com
+  Author: Sérgio Martins <sergio.martins@kdab.com>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef KD_MULTISPLITTER_LAYOUTENGINEADAPTER_P_H
+#define KD_MULTISPLITTER_LAYOUTENGINEADAPTER_P_H
+
+#include "docks_export.h"
+#include "LayoutEngine_p.h"
+#include "Anchor_p.h"
+
+#include <QHash>
+#include <QPointer>
+
+#include <memory>
+
+namespace KDDockWidgets {
+
+class MultiSplitterLayout;
+
+/**
+ * @brief What a LayoutEngineAdapter works on: the engine and the anchors and items it indexes.
+ *
+ * The MultiSplitterLayout keeps it between adapters. As long as its structure doesn't change, the
+ * next adapter only refreshes the positions and geometries, instead of allocating a new graph.
+ */
+struct LayoutEngineSnapshot
+{
+    explicit LayoutEngineSnapshot(MultiSplitterLayout *layout);
+
+    ///@brief Copies the current positions, geometries and min sizes, the topology must be the same
+    void refresh(MultiSplitterLayout *layout);
+
+    LayoutEngine engine;
+    const Anchor::List anchors;
+    const ItemList items;
+    QHash<const Anchor*, int> anchorIndexes;
+    QHash<const Item*, int> itemIndexes;
+    const quint64 structureGeneration; // See MultiSplitterLayout::structureGeneration()
+    Q_DISABLE_COPY(LayoutEngineSnapshot)
+};
+
+/**
+ * @brief Bridges a MultiSplitterLayout and a LayoutEngine.
+ *
+ * The constructor snapshots the layout's anchors and items into the engine, or reuses the layout's
+ * previous snapshot if the structure didn't change. Solve with engine(), then call apply(), which
+ * sets each changed separator and Frame geometry exactly once.
+ */
+class DOCKS_EXPORT_FOR_UNIT_TESTS LayoutEngineAdapter
+{
+public:
+    explicit LayoutEngineAdapter(MultiSplitterLayout *layout);
+    ~LayoutEngineAdapter();
+
+    LayoutEngine &engine() { return m_snapshot->engine; }
+    const LayoutEngine &engine() const { return m_snapshot->engine; }
+
+    ///@brief returns the engine index of @p anchor, or -1
+    int indexOf(const Anchor *anchor) const { return m_snapshot->anchorIndexes.value(anchor, -1); }
+
+    ///@brief returns the engine index of @p item, or -1
+    int indexOf(const Item *item) const { return m_snapshot->itemIndexes.value(item, -1); }
+
+    Anchor *anchorAt(int index) const { return m_snapshot->anchors.at(index); }
+    Item *itemAt(int index) const { return m_snapshot->items.at(index); }
+
+    /**
+     * @brief Applies the engine's positions and geometries to the Anchors, Items and their widgets.
+     * Only what changed since the snapshot (or the previous apply()) is touched. The moved anchors
+     * emit positionChanged() once the layout's transaction commits.
+     */
+    void apply();
+
+private:
+    Q_DISABLE_COPY(LayoutEngineAdapter)
+    const QPointer<MultiSplitterLayout> m_layout;
+    std::unique_ptr<LayoutEngineSnapshot> m_snapshot;
+};
+
+}
+
+#endif
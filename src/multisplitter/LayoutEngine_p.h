@@ -0,0 +1,257 @@
+/*
+  This file is part of KDDockWidgets.
+
+  Copyright (C) 2018-2019 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com
+  Author: Sérgio Martins <sergio.martins@kdab.com>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef KD_MULTISPLITTER_LAYOUTENGINE_P_H
+#define KD_MULTISPLITTER_LAYOUTENGINE_P_H
+
+#include "docks_export.h"
+
+#include <QPair>
+#include <QRect>
+#include <QSize>
+#include <QVector>
+
+namespace KDDockWidgets {
+
+/**
+ * @brief A widget-free model of the anchor graph of a MultiSplitterLayout.
+ *
+ * Anchors and items are plain structs, referenced by their index. The engine only knows about
+ * positions, thicknesses, minimum sizes and rects, so it can solve a layout without moving a single
+ * widget and without needing a QApplication.
+ *
+ * The semantics are the same as Anchor and Item: anchor positions are the source of truth and
+ * item geometries are derived from them, see updateItemSizes(). Use LayoutEngineAdapter to
+ * snapshot a live MultiSplitterLayout and to apply the solved result back to its widgets, which is
+ * how MultiSplitterLayout resizes, drops and restores.
+ */
+class DOCKS_EXPORT_FOR_UNIT_TESTS LayoutEngine
+{
+public:
+    ///@brief Same values as Anchor::Side
+    enum Side {
+        Side_None = 0,
+        Side1,
+        Side2
+    };
+
+    enum AnchorType {
+        AnchorType_Normal = 0,
+        AnchorType_Side1Static, ///< The left or top border
+        AnchorType_Side2Static  ///< The right or bottom border
+    };
+
+    enum SetPositionOption {
+        SetPositionOption_None = 0,
+        SetPositionOption_DontRecalculatePercentage = 1
+    };
+
+    struct AnchorNode {
+        bool isStatic() const { return type != AnchorType_Normal; }
+        bool isFollowing() const { return followee != -1; }
+        bool isVertical() const { return orientation == Qt::Vertical; }
+        const QVector<int> &items(Side side) const { return side == Side1 ? side1Items : side2Items; }
+
+        Qt::Orientation orientation = Qt::Vertical;
+        AnchorType type = AnchorType_Normal;
+        int position = 0;
+        int thickness = 0; // The anchor's own thickness. A follower uses its followee's, see LayoutEngine::thickness()
+        int from = -1;
+        int to = -1;
+        int followee = -1;
+        qreal positionPercentage = 0.0;
+        int positionOffset = 0; // See Anchor::setPositionOffset()
+        QVector<int> side1Items;
+        QVector<int> side2Items;
+    };
+
+    struct ItemNode {
+        int anchorAtSide(Side side, Qt::Orientation o) const
+        {
+            if (o == Qt::Vertical)
+                return side == Side1 ? left : right;
+            return side == Side1 ? top : bottom;
+        }
+
+        int length(Qt::Orientation o) const
+        {
+            return o == Qt::Vertical ? geometry.width() : geometry.height();
+        }
+
+        int minLength(Qt::Orientation o) const
+        {
+            if (isPlaceholder)
+                return 0;
+            return o == Qt::Vertical ? minSize.width() : minSize.height();
+        }
+
+        bool hasAllAnchors() const { return left != -1 && top != -1 && right != -1 && bottom != -1; }
+
+        QRect geometry;
+        QSize minSize;
+        bool isPlaceholder = false;
+        int left = -1;
+        int top = -1;
+        int right = -1;
+        int bottom = -1;
+    };
+
+    LayoutEngine() = default;
+
+    ///@brief Adds an anchor and returns its index
+    int addAnchor(Qt::Orientation orientation, int thickness, AnchorType type = AnchorType_Normal,
+                  int position = 0, qreal positionPercentage = 0.0);
+
+    ///@brief Adds an item and returns its index. Its anchors are set with addItemToAnchor()
+    int addItem(QRect geometry, QSize minSize, bool isPlaceholder = false);
+
+    ///@brief Sets the anchors where @p anchor starts and ends, see Anchor::from()
+    void setFromTo(int anchor, int from, int to);
+
+    ///@brief Equivalent to Anchor::addItem(). Also sets the anchor on the item's side.
+    void addItemToAnchor(int anchor, int item, Side side);
+
+    ///@brief Makes @p anchor follow @p followee. Pass -1 to stop following.
+    void setFollowee(int anchor, int followee);
+
+    ///@brief Equivalent to Anchor::setPositionOffset()
+    void setPositionOffset(int anchor, int offset);
+
+    /**
+     * @brief Overwrites the position, percentage and offset of @p anchor, without touching its items
+     * or followers. For refreshing a snapshot whose topology didn't change, see LayoutEngineAdapter.
+     */
+    void resetAnchorState(int anchor, int position, qreal positionPercentage, int positionOffset);
+
+    ///@brief Overwrites the geometry, minimum size and placeholder state of @p item, without propagating
+    void resetItemState(int item, QRect geometry, QSize minSize, bool isPlaceholder);
+
+    ///@brief Sets the size of the layout, without redistributing. See resize()
+    void setContentsSize(QSize sz) { m_contentsSize = sz; }
+    QSize contentsSize() const { return m_contentsSize; }
+    int contentsLength(Qt::Orientation o) const;
+
+    int anchorCount() const { return m_anchors.size(); }
+    int itemCount() const { return m_items.size(); }
+    const AnchorNode &anchor(int index) const { return m_anchors.at(index); }
+    const ItemNode &item(int index) const { return m_items.at(index); }
+
+    ///@brief returns the left, top, right or bottom static anchor, -1 if it wasn't added yet
+    int staticAnchor(Side side, Qt::Orientation orientation) const;
+
+    ///@brief The thickness of @p anchor, which is its followee's if it's following
+    int thickness(int anchor) const;
+
+    ///@brief Equivalent to Anchor::cumulativeMinLength(), but memoized.
+    int cumulativeMinLength(int anchor, Side side) const;
+
+    ///@brief Equivalent to Item::cumulativeMinLength()
+    int itemCumulativeMinLength(int item, Side side, Qt::Orientation orientation) const;
+
+    ///@brief Equivalent to MultiSplitterLayout::boundPositionsForAnchor()
+    QPair<int, int> boundPositions(int anchor) const;
+    int boundPosition(int anchor, Side direction) const;
+
+    ///@brief Equivalent to Anchor::minPosition()
+    int minPosition(int anchor) const;
+
+    ///@brief The minimum size of the whole layout, see MultiSplitterLayout::updateSizeConstraints()
+    QSize minimumSize() const;
+
+    ///@brief The rect of the separator, as computed by Anchor::updateSize()
+    QRect anchorGeometry(int anchor) const;
+
+    /**
+     * @brief Equivalent to Anchor::setPosition().
+     * Followers are moved too and the geometry of the items at both sides is updated.
+     */
+    void setAnchorPosition(int anchor, int position, int options = SetPositionOption_None);
+
+    ///@brief Equivalent to Anchor::updateItemSizes()
+    void updateItemSizes(int anchor);
+
+    /**
+     * @brief Equivalent to Item::setGeometry(). If the item gets squeezed below its minimum size
+     * the opposite anchor is pushed, to preserve it.
+     */
+    void setItemGeometry(int item, QRect geometry);
+
+    /**
+     * @brief Equivalent to Item::beginBlockPropagateGeo(), but for every item.
+     * While blocked, squeezed items don't push their anchors. Used when anchors are positioned one
+     * at a time and items only have some of their edges right, like when restoring a layout.
+     */
+    void setBlockPropagateGeo(bool block) { m_blockPropagateGeo = block; }
+
+    ///@brief Equivalent to MultiSplitterLayout::positionStaticAnchors()
+    void positionStaticAnchors();
+
+    ///@brief Sets the new contents size and redistributes the space between the anchors proportionally
+    void resize(QSize newSize);
+
+    /**
+     * @brief Positions every anchor of @p orientation proportionally to the contents size, in a single
+     * topological sweep, without letting items go below their min size.
+     */
+    void redistributeSpace(Qt::Orientation orientation);
+
+    /**
+     * @brief Called when an item is dropped, after @p fromAnchor was moved by @p delta to make room for it.
+     * The anchors reachable from @p fromAnchor, in @p direction, are moved too, so all items chip in.
+     */
+    void propagateResize(int delta, int fromAnchor, Side direction);
+
+    /**
+     * @brief Returns the non-static anchors of @p orientation reachable from the left (or top) anchor,
+     * each one after all the anchors at its Side1.
+     */
+    QVector<int> topologicalOrder(Qt::Orientation orientation) const;
+
+    ///@brief Returns whether the position of @p anchor changed since the last clearDirty()
+    bool isAnchorDirty(int anchor) const { return m_dirtyAnchors.at(anchor); }
+
+    ///@brief Returns whether the geometry of @p item changed since the last clearDirty()
+    bool isItemDirty(int item) const { return m_dirtyItems.at(item); }
+
+    void clearDirty();
+
+private:
+    bool setAnchorPositionWithoutFollowers(int anchor, int position, int options);
+    void collectPostOrder(int anchor, Side direction, QVector<bool> &visited, QVector<int> &postOrder) const;
+    int smallestAvailableItemSqueeze(int anchor, Side side) const;
+    bool hasNonPlaceholderItems(int anchor, Side side) const;
+    void invalidateCumulativeMinLengths();
+
+    QVector<AnchorNode> m_anchors;
+    QVector<ItemNode> m_items;
+    QVector<QVector<int>> m_followers; // indexed by followee
+    QVector<bool> m_dirtyAnchors;
+    QVector<bool> m_dirtyItems;
+    mutable QVector<int> m_cumulativeMinLengths[2]; // Indexed by Side1 and Side2. -1 means not calculated yet
+    mutable int m_cumulativeMinLengthsGeneration = -1; // The m_generation the cache was filled for
+    int m_generation = 0; // Bumped whenever the topology or the min sizes change
+    int m_staticAnchors[2][2] = { { -1, -1 }, { -1, -1 } }; // Indexed by side and by orientation, see staticAnchor()
+    QSize m_contentsSize;
+    bool m_blockPropagateGeo = false;
+};
+
+}
+
+#endif
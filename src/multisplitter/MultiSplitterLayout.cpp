@@ -26,10 +26,13 @@
 #include "DockWidget.h"
 #include "LastPosition_p.h"
 #include "SeparatorWidget_p.h"
+#include "LayoutEngineAdapter_p.h"
 
 #include <QPushButton>
 #include <QEvent>
 #include <QtMath>
+#include <QHash>
+#include <QSet>
 
 #define INDICATOR_MINIMUM_LENGTH 100
 
@@ -175,6 +178,7 @@ void MultiSplitterLayout::addWidget(QWidget *w, Location location, Frame *relati
     if (!validateInputs(w, location, relativeToWidget, option))
         return;
 
+    LayoutTransaction transaction(this);
     unrefOldPlaceholders(framesFrom(w));
 
     Item *relativeToItem = itemForFrame(relativeToWidget);
@@ -303,8 +307,12 @@ void MultiSplitterLayout::addWidget(QWidget *w, Location location, Frame *relati
         // delta2 is the space stolen at the right. The sum of delta1+delta2 is the size of the widget
         // (plus the splitter). Then we propagate the resize, so that all widgets chip in and get smaller
         // to make room for ours.
-        propagateResize(delta1, direction1Anchor, /*direction*/ Anchor::Side1);
-        propagateResize(delta2, direction2Anchor, /*direction*/ Anchor::Side2);
+        // Both directions are solved on the same snapshot and applied together.
+        LayoutEngineAdapter adapter(this);
+        LayoutEngine &engine = adapter.engine();
+        engine.propagateResize(delta1, adapter.indexOf(direction1Anchor), LayoutEngine::Side1);
+        engine.propagateResize(delta2, adapter.indexOf(direction2Anchor), LayoutEngine::Side2);
+        adapter.apply();
 
         /*qDebug() << "Delta1=" << delta1 << "; delta2=" << delta2
                  << "; posForNewAnchor=" << posForNewAnchor
@@ -317,31 +325,41 @@ void MultiSplitterLayout::addWidget(QWidget *w, Location location, Frame *relati
     auto sourceMultiSplitter = sourceMultiSplitterWidget ? sourceMultiSplitterWidget->multiSplitterLayout()
                                                          : nullptr;
 
+    Anchor::List seeds;
     if (sourceMultiSplitter) {
         auto items = sourceMultiSplitter->items();
         targetAnchorGroup.addItem(sourceMultiSplitter);
         addItems_internal(items);
+        for (Item *item : qAsConst(items))
+            seeds += item->anchorGroup().anchors();
     } else {
         Q_ASSERT(frame);
         auto item = new Item(frame, this);
         targetAnchorGroup.addItem(item);
         addItems_internal(ItemList{ item });
+        seeds = item->anchorGroup().anchors();
     }
 
-    updateAnchorFollowing();
+    updateAnchorFollowing(seeds);
 }
 
 void MultiSplitterLayout::addItems_internal(const ItemList &items, bool updateConstraints)
 {
     m_items << items;
+    invalidateStructure();
     if (updateConstraints)
         updateSizeConstraints();
 
     for (auto item : items) {
+        if (MultiSplitterLayout *oldLayout = item->layout()) {
+            if (oldLayout != this) // Being merged from another MultiSplitter
+                oldLayout->unindexItem(item);
+        }
+
         item->setLayout(this);
+        indexItem(item);
         if (item->frame()) {
             item->setVisible(true);
-            item->frame()->installEventFilter(this);
             Q_EMIT widgetAdded(item);
         }
     }
@@ -369,7 +387,7 @@ void MultiSplitterLayout::addAsPlaceholder(DockWidget *dockWidget, Location loca
     dockWidget->addPlaceholderItem(item);
     delete frame;
 
-    updateAnchorFollowing();
+    updateAnchorFollowing(item->anchorGroup().anchors());
     Q_ASSERT(!dockWidget->isVisible());
 }
 
@@ -385,26 +403,9 @@ int MultiSplitterLayout::extraUselessSpace(Qt::Orientation o) const
                              : m_extraUselessSpace.height();
 }
 
-static Anchor::List removeSmallestPath(QVector<Anchor::List> &paths)
-{
-    // Removes and returns the smallest list
-    Anchor::List smallestPath;
-    int indexOfSmallest = 0;
-    for (int i = 0, end = paths.size(); i < end; ++i) {
-        const Anchor::List path = paths.at(i);
-        if (path.size() <= smallestPath.size() || smallestPath.isEmpty()) {
-            smallestPath = path;
-            indexOfSmallest = i;
-        }
-    }
-
-    paths.removeAt(indexOfSmallest);
-    return smallestPath;
-}
-
 void MultiSplitterLayout::propagateResize(int delta, Anchor *fromAnchor, Anchor::Side direction)
 {
-    qCDebug(sizing) << Q_FUNC_INFO << " START delta=" << delta
+    qCDebug(sizing) << Q_FUNC_INFO << "delta=" << delta
                     << "; fromAnchor=" << fromAnchor
                     << "; isStatic?" << fromAnchor->isStatic()
                     << "; direction=" << direction
@@ -414,81 +415,9 @@ void MultiSplitterLayout::propagateResize(int delta, Anchor *fromAnchor, Anchor:
     if (delta == 0 || fromAnchor->isStatic())
         return;
 
-    QVector<Anchor::List> paths;
-    collectPaths(paths, fromAnchor, direction);
-
-    qCDebug(sizing) << Q_FUNC_INFO << "Got" << paths.size() << "paths";
-    for (const Anchor::List &path : qAsConst(paths)) {
-        qCDebug(sizing) << Q_FUNC_INFO << path;
-    }
-
-    Anchor::List anchorsThatAlreadyContributed;
-    anchorsThatAlreadyContributed.push_back(fromAnchor);
-
-    while (!paths.isEmpty()) {
-        // Get smallest path:
-        Anchor::List smallestPath = removeSmallestPath(/*by-ref*/paths);
-        if (smallestPath.size() <= 1) {
-            // Nothing to do, it has a single anchor, which was already adjusted in addWidget()
-            continue;
-        }
-
-        const bool towardsSide1 = direction == Anchor::Side1;
-        const bool towardsSide2 = !towardsSide1;
-
-        const int sign = towardsSide1 ? -1 : 1;
-        const int contributionPerAnchor = (delta / (smallestPath.size() - 1)) * sign; // n-1 because the initial anchor already contributed
-        if (qAbs(contributionPerAnchor) < 5) {
-            // Too small, don't bother
-            continue;
-        }
-
-        // Now make those anchors contribute, skipping the first
-        for (int i = 1, end = smallestPath.size(); i < end; ++i) {
-            Anchor *a = smallestPath.at(i);
-            if (!anchorsThatAlreadyContributed.contains(a)) {
-                // When moving anchors don't allow widgets to go bellow their min size
-                const int bound = boundPositionForAnchor(a, direction);
-                int newPosition = a->position() + contributionPerAnchor;
-                if ((towardsSide1 && newPosition < bound) ||
-                    (towardsSide2 && newPosition > bound)) {
-                    newPosition = bound;
-                }
-
-                if (a->position() != newPosition) {
-                    a->setPosition(newPosition);
-                    anchorsThatAlreadyContributed.push_back(a);
-                }
-            }
-        }
-    }
-
-    qCDebug(sizing) << Q_FUNC_INFO << "END";
-}
-
-void MultiSplitterLayout::collectPaths(QVector<Anchor::List> &paths, Anchor *fromAnchor, Anchor::Side direction)
-{
-    if (fromAnchor->isStatic()) {
-        // We've finally reached a border anchor, we can stop now.
-        return;
-    }
-
-    if (paths.isEmpty())
-        paths.push_back({});
-
-    int currentPathIndex = paths.size() - 1; // Store the index instead of using "Anchor::List &currentPath = paths.last();" as the references are stable, as the paths vector reallocates
-
-    paths[currentPathIndex].push_back(fromAnchor);
-
-    const ItemList items = fromAnchor->items(direction);
-    for (int i = 0, end = items.size(); i < end; ++i) {
-        Anchor *nextAnchor = items[i]->anchorAtSide(direction, fromAnchor->orientation());
-        if (i > 0) {
-            Anchor::List newPath = paths[currentPathIndex];
-            paths.push_back(newPath);
-        }
-        collectPaths(paths, nextAnchor, direction);
-    }
+    LayoutEngineAdapter adapter(this);
+    adapter.engine().propagateResize(delta, adapter.indexOf(fromAnchor), LayoutEngine::Side(direction));
+    adapter.apply();
 }
 
 void MultiSplitterLayout::resizeItem(Frame *frame, int newSize, Qt::Orientation orientation)
@@ -515,16 +444,33 @@ void MultiSplitterLayout::addMultiSplitter(MultiSplitterWidget *sourceMultiSplit
 
 void MultiSplitterLayout::removeItem(Item *item)
 {
-    if (!item || m_inDestructor || !m_items.contains(item))
+    if (!item || m_inDestructor || !contains(item))
         return;
 
-    if (!item->isPlaceholder())
-        item->frame()->removeEventFilter(this);
+    LayoutTransaction transaction(this);
     AnchorGroup anchorGroup = item->anchorGroup();
+
+    // Some of the anchors might be deleted, their followers are looked at instead
+    QVector<QPointer<Anchor>> seeds;
+    for (Anchor *anchor : anchorGroup.anchors()) {
+        if (!anchor)
+            continue;
+        seeds.push_back(anchor);
+        for (Anchor *follower : anchor->followers())
+            seeds.push_back(follower);
+    }
+
     anchorGroup.removeItem(item);
     m_items.removeOne(item);
+    invalidateStructure();
+    unindexItem(item);
 
-    updateAnchorFollowing();
+    Anchor::List survivingSeeds;
+    for (const QPointer<Anchor> &anchor : qAsConst(seeds)) {
+        if (anchor)
+            survivingSeeds.push_back(anchor);
+    }
+    updateAnchorFollowing(survivingSeeds);
 
     Q_EMIT widgetRemoved(item);
     Q_EMIT widgetCountChanged(m_items.size());
@@ -532,7 +478,7 @@ void MultiSplitterLayout::removeItem(Item *item)
 
 bool MultiSplitterLayout::contains(const Item *item) const
 {
-    return m_items.contains(const_cast<Item*>(item));
+    return m_framesByItem.contains(item);
 }
 
 bool MultiSplitterLayout::contains(const Frame *frame) const
@@ -542,18 +488,66 @@ bool MultiSplitterLayout::contains(const Frame *frame) const
 
 Item *MultiSplitterLayout::itemAt(QPoint p) const
 {
-    for (Item *item : m_items) {
-        if (!item->isPlaceholder() && item->geometry().contains(p))
-            return item;
-    }
+    return m_itemIndex.at(p, [] (Item *item) {
+        return !item->isPlaceholder();
+    });
+}
 
-    return nullptr;
+void MultiSplitterLayout::indexItem(Item *item)
+{
+    markTouched(item);
+    m_itemIndex.update(item, item->geometry());
+    indexFrame(item);
+
+    connect(item, &Item::geometryChanged, this, [this, item] {
+        m_itemIndex.update(item, item->geometry());
+    });
+
+    connect(item, &Item::frameChanged, this, [this, item] {
+        indexFrame(item);
+    });
+}
+
+void MultiSplitterLayout::unindexItem(Item *item)
+{
+    disconnect(item, &Item::geometryChanged, this, nullptr);
+    disconnect(item, &Item::frameChanged, this, nullptr);
+    m_itemIndex.remove(item);
+    m_touchedItems.remove(item);
+    invalidateStructure();
+
+    const Frame *frame = m_framesByItem.take(item);
+    if (frame && m_itemsByFrame.value(frame) == item)
+        m_itemsByFrame.remove(frame);
+
+    if (m_centralFrameItem == item)
+        m_centralFrameItem.clear();
+}
+
+void MultiSplitterLayout::indexFrame(Item *item)
+{
+    const Frame *oldFrame = m_framesByItem.value(item);
+    if (oldFrame && m_itemsByFrame.value(oldFrame) == item)
+        m_itemsByFrame.remove(oldFrame);
+
+    Frame *frame = item->frame();
+    m_framesByItem.insert(item, frame);
+    if (frame) {
+        m_itemsByFrame.insert(frame, item);
+        if (frame->isCentralFrame())
+            m_centralFrameItem = item;
+    } else if (m_centralFrameItem == item) {
+        m_centralFrameItem.clear();
+    }
 }
 
 void MultiSplitterLayout::clear()
 {
     qDeleteAll(m_items);
     m_items.clear();
+    m_itemIndex.clear();
+    m_itemsByFrame.clear();
+    m_framesByItem.clear();
     Q_EMIT widgetCountChanged(0);
 
     for (Anchor *anchor : qAsConst(m_anchors)) {
@@ -563,6 +557,7 @@ void MultiSplitterLayout::clear()
 
     m_anchors.clear();
     m_anchors << m_topAnchor << m_bottomAnchor << m_leftAnchor << m_rightAnchor;
+    invalidateStructure();
 }
 
 int MultiSplitterLayout::visibleCount() const
@@ -586,8 +581,11 @@ int MultiSplitterLayout::length(Qt::Orientation orientation) const
 
 void MultiSplitterLayout::removeAnchor(Anchor *anchor)
 {
-    if (!m_inDestructor)
+    m_touchedAnchors.remove(anchor);
+    if (!m_inDestructor) {
         m_anchors.removeOne(anchor);
+        invalidateStructure();
+    }
 }
 
 QPair<int, int> MultiSplitterLayout::boundPositionsForAnchor(Anchor *anchor) const
@@ -944,50 +942,25 @@ void MultiSplitterLayout::positionStaticAnchors()
 
 void MultiSplitterLayout::redistributeSpace(QSize oldSize, QSize newSize)
 {
-    positionStaticAnchors();
-    if (oldSize == newSize || !oldSize.isValid() || !newSize.isValid())
+    if (m_inCtor) {
+        // The static anchors aren't linked yet, there's nothing else to lay out
+        positionStaticAnchors();
         return;
+    }
 
-    qCDebug(sizing) << "MultiSplitterLayout::redistributeSpace old=" << oldSize << "; new=" << newSize;
-
-    redistributeSpace_recursive(m_leftAnchor, 0);
-    redistributeSpace_recursive(m_topAnchor, 0);
-}
-
-void MultiSplitterLayout::redistributeSpace_recursive(Anchor *fromAnchor, int minAnchorPos)
-{
-    for (Item *item : fromAnchor->items(Anchor::Side2)) {
-        Anchor *nextAnchor = item->anchorAtSide(Anchor::Side2, fromAnchor->orientation());
-        if (nextAnchor->isStatic())
-            continue;
-
-        // We use the minPos of the Anchor that had non-placeholder items on its side1.
-        if (nextAnchor->hasNonPlaceholderItems(Anchor::Side1))
-            minAnchorPos = nextAnchor->minPosition();
-
-        if (nextAnchor->hasNonPlaceholderItems(Anchor::Side2) && !nextAnchor->isFollowing()) {
-            const int newPosition = int(nextAnchor->positionPercentage() * contentsLength(nextAnchor->orientation()));
-
-            // But don't let the anchor go out of bounds, it must respect its widgets min sizes
-            auto bounds = boundPositionsForAnchor(nextAnchor);
-
-            // For the bounding, use Anchor::minPosition, as we're not making the anchors on the left/top shift, which boundsPositionsForAnchor() assumes.
-            const int newPositionBounded = qBound(minAnchorPos, newPosition, bounds.second);
-
-            qCDebug(sizing) << Q_FUNC_INFO << nextAnchor << "FOO ; bounds.first=" << bounds.first
-                            << "; newPosition=" << newPosition
-                            << "; bounds.first=" << bounds.first
-                            << "; bounds.second=" << bounds.second
-                            << "; newPositionBounded=" << newPositionBounded
-                            << "; oldPosition=" << nextAnchor->position()
-                            << "; contentSize=" << m_contentSize
-                            << "; nextAnchor.minPosition=" << minAnchorPos;
-
-            nextAnchor->setPosition(newPositionBounded, Anchor::SetPositionOption_DontRecalculatePercentage);
-        }
+    // Solved on a snapshot, so each separator and Frame is only moved once, whatever the number of anchors
+    LayoutTransaction transaction(this);
+    LayoutEngineAdapter adapter(this);
+    LayoutEngine &engine = adapter.engine();
+    engine.positionStaticAnchors();
 
-        redistributeSpace_recursive(nextAnchor, minAnchorPos);
+    if (oldSize != newSize && oldSize.isValid() && newSize.isValid()) {
+        qCDebug(sizing) << "MultiSplitterLayout::redistributeSpace old=" << oldSize << "; new=" << newSize;
+        engine.redistributeSpace(Qt::Vertical);
+        engine.redistributeSpace(Qt::Horizontal);
     }
+
+    adapter.apply();
 }
 
 void MultiSplitterLayout::updateSizeConstraints()
@@ -1033,7 +1006,7 @@ Anchor *MultiSplitterLayout::newAnchor(AnchorGroup &group, Location location)
     qCDebug(::anchors) << "MultiSplitterLayout::newAnchor" << location;
     Anchor *newAnchor = nullptr;
     Anchor *donor = nullptr;
-    Q_ASSERT(checkSanity(AnchorSanity_Normal));
+    Q_ASSERT(checkSanityOfTouched(AnchorSanity_Normal));
     switch (location) {
     case Location_OnLeft:
         donor = group.left;
@@ -1065,7 +1038,7 @@ Anchor *MultiSplitterLayout::newAnchor(AnchorGroup &group, Location location)
     Q_ASSERT(donor != newAnchor);
 
 
-    if (!checkSanity(AnchorSanity_Normal)) {
+    if (!checkSanityOfTouched(AnchorSanity_Normal)) {
         qWarning() << "MultiSplitterLayout::newAnchor no sanity!";
         Q_ASSERT(false);
     }
@@ -1085,6 +1058,81 @@ void MultiSplitterLayout::setDoSanityChecks(bool doit)
         m_doSanityChecks = doit;
 }
 
+void MultiSplitterLayout::beginTransaction()
+{
+    m_transactionDepth++;
+}
+
+void MultiSplitterLayout::commitTransaction()
+{
+    if (m_transactionDepth <= 0) {
+        qWarning() << Q_FUNC_INFO << "No transaction in progress";
+        Q_ASSERT(false);
+        return;
+    }
+
+    if (--m_transactionDepth > 0)
+        return;
+
+    qCDebug(sizing) << Q_FUNC_INFO << "dirty anchors=" << m_dirtyAnchors.size()
+                    << "; dirty items=" << m_dirtyItems.size();
+
+    const auto dirtyItems = m_dirtyItems;
+    const auto dirtyAnchors = m_dirtyAnchors;
+    m_dirtyItems.clear();
+    m_dirtyAnchors.clear();
+
+    for (const QPointer<Item> &item : dirtyItems) {
+        if (item)
+            item->commitGeometry();
+    }
+
+    for (const QPointer<Anchor> &anchor : dirtyAnchors) {
+        if (anchor)
+            anchor->commitGeometry();
+    }
+
+    // Only now that every separator and Frame is in place
+    const auto movedAnchors = m_movedAnchors;
+    m_movedAnchors.clear();
+    for (const QPointer<Anchor> &anchor : movedAnchors) {
+        if (anchor)
+            anchor->commitPositionChanged();
+    }
+}
+
+void MultiSplitterLayout::addDirtyAnchor(Anchor *anchor)
+{
+    Q_ASSERT(isInTransaction());
+    m_dirtyAnchors.push_back(anchor);
+}
+
+void MultiSplitterLayout::addDirtyItem(Item *item)
+{
+    Q_ASSERT(isInTransaction());
+    m_dirtyItems.push_back(item);
+}
+
+void MultiSplitterLayout::addMovedAnchor(Anchor *anchor)
+{
+    Q_ASSERT(isInTransaction());
+    m_movedAnchors.push_back(anchor);
+}
+
+std::unique_ptr<LayoutEngineSnapshot> MultiSplitterLayout::takeEngineSnapshot()
+{
+    if (m_engineSnapshot && m_engineSnapshot->structureGeneration != m_structureGeneration)
+        m_engineSnapshot.reset();
+
+    return std::move(m_engineSnapshot);
+}
+
+void MultiSplitterLayout::returnEngineSnapshot(std::unique_ptr<LayoutEngineSnapshot> snapshot)
+{
+    if (snapshot && snapshot->structureGeneration == m_structureGeneration)
+        m_engineSnapshot = std::move(snapshot);
+}
+
 void MultiSplitterLayout::emitVisibleWidgetCountChanged()
 {
     if (!m_inDestructor)
@@ -1096,11 +1144,7 @@ Item *MultiSplitterLayout::itemForFrame(const Frame *frame) const
     if (!frame)
         return nullptr;
 
-    for (Item *item : m_items) {
-        if (item->frame() == frame)
-            return item;
-    }
-    return nullptr;
+    return m_itemsByFrame.value(frame);
 }
 
 Frame::List MultiSplitterLayout::framesFrom(QWidget *frameOrMultiSplitter) const
@@ -1169,18 +1213,24 @@ bool MultiSplitterLayout::checkSanity(AnchorSanityOption options) const
     if (!m_doSanityChecks || m_inCtor)
         return true;
 
-    auto check = [this, options] (Item *item, Qt::Orientation orientation) {
-        int numSide1 = 0;
-        int numSide2 = 0;
-        const auto &anchors = this->anchors(orientation, /*includeStatic=*/ true);
-        for (Anchor *anchor : anchors) {
-            if (anchor->containsItem(item, Anchor::Side1))
-                numSide1++;
-            if (anchor->containsItem(item, Anchor::Side2))
-                numSide2++;
-        }
+    // How many anchors of each orientation have the item on Side1 and Side2. Counted in a single
+    // pass over the anchors, instead of asking every anchor about every item.
+    QHash<const Item*, QPair<int, int>> memberships[2]; // Indexed by Qt::Orientation - 1
+    for (Anchor *anchor : qAsConst(m_anchors)) {
+        QHash<const Item*, QPair<int, int>> &counts = memberships[anchor->orientation() - 1];
+        for (Item *item : anchor->items(Anchor::Side1))
+            counts[item].first++;
+        for (Item *item : anchor->items(Anchor::Side2))
+            counts[item].second++;
+    }
+
+    auto check = [this, options, &memberships] (Item *item, Qt::Orientation orientation) {
+        const QPair<int, int> counts = memberships[orientation - 1].value(item);
+        const int numSide1 = counts.first;
+        const int numSide2 = counts.second;
 
         if (numSide1 != 1 || numSide2 != 1) {
+            const auto &anchors = this->anchors(orientation, /*includeStatic=*/ true);
             dumpDebug();
             qWarning() << "MultiSplitterLayout::checkSanity:" << "Problem detected! while processing"
                        << orientation << "anchors"
@@ -1254,6 +1304,23 @@ bool MultiSplitterLayout::checkSanity(AnchorSanityOption options) const
         }
     }
 
+    {
+        // Check that the memoized cumulative min lengths were invalidated when needed.
+        // The expected values are computed without the cache, which is left as is.
+        QHash<const Anchor*, int> side1Memo;
+        QHash<const Anchor*, int> side2Memo;
+        for (Anchor *anchor : qAsConst(m_anchors)) {
+            const QPair<int, int> cached = { anchor->cumulativeMinLength(Anchor::Side1), anchor->cumulativeMinLength(Anchor::Side2) };
+            const QPair<int, int> expected = { anchor->freshCumulativeMinLength(Anchor::Side1, side1Memo),
+                                               anchor->freshCumulativeMinLength(Anchor::Side2, side2Memo) };
+            if (cached != expected) {
+                qWarning() << Q_FUNC_INFO << "Stale cumulative min length for" << anchor
+                           << cached << "; expected=" << expected;
+                return false;
+            }
+        }
+    }
+
     // Check that no widget intersects with an anchor
     if (options & AnchorSanity_Intersections) {
         for (Item *item: items()) {
@@ -1317,9 +1384,183 @@ bool MultiSplitterLayout::checkSanity(AnchorSanityOption options) const
         return false;
     }
 */
+
+    if (options == AnchorSanity_All) {
+        // Everything was verified, start tracking changes from here
+        m_touchedAnchors.clear();
+        m_touchedItems.clear();
+    }
+
     return true;
 }
 
+bool MultiSplitterLayout::checkSanityOfTouched(AnchorSanityOption options) const
+{
+    if (!m_doSanityChecks || m_inCtor)
+        return true;
+
+    if (!m_touchTrackingEnabled)
+        return checkSanity(options);
+
+    // Same as in checkSanity(), but only the touched anchors are counted. The item's own anchors are
+    // added below. Any other anchor gaining the item was touched by Anchor::addItem().
+    QHash<const Item*, QPair<int, int>> memberships[2]; // Indexed by Qt::Orientation - 1
+    QSet<Item*> itemsToCheck = m_touchedItems; // Plus the items of the touched anchors
+    for (Anchor *anchor : qAsConst(m_touchedAnchors)) {
+        if (!anchor->isValid()) {
+            dumpDebug();
+            qWarning() << "MultiSplitterLayout::checkSanityOfTouched: invalid anchor" << anchor;
+            return false;
+        }
+
+        QHash<const Item*, QPair<int, int>> &counts = memberships[anchor->orientation() - 1];
+        for (Anchor::Side side : { Anchor::Side1, Anchor::Side2 }) {
+            for (Item *item : anchor->items(side)) {
+                if (!contains(item)) {
+                    dumpDebug();
+                    qWarning() << "MultiSplitterLayout::checkSanityOfTouched: Anchor has" << item << "but multi splitter does not";
+                    return false;
+                }
+
+                if (side == Anchor::Side1)
+                    counts[item].first++;
+                else
+                    counts[item].second++;
+                itemsToCheck.insert(item);
+            }
+        }
+
+        if (anchor->isFollowing() && !qobject_cast<Anchor*>(anchor->followee())) {
+            qWarning() << "MultiSplitterLayout::checkSanityOfTouched: Anchor is following but followee was deleted already";
+            return false;
+        }
+
+        for (Anchor *follower : anchor->followers()) {
+            if (follower->followee() != anchor) {
+                qWarning() << "MultiSplitterLayout::checkSanityOfTouched: Anchor" << anchor
+                           << "has follower" << follower << "which follows" << follower->followee();
+                return false;
+            }
+        }
+
+        if (options & AnchorSanity_Followers) {
+            const bool hasItemsOnBothSides = anchor->hasNonPlaceholderItems(Anchor::Side1) && anchor->hasNonPlaceholderItems(Anchor::Side2);
+            if (!anchor->isStatic() && !anchor->isFollowing() && !hasItemsOnBothSides && anchor->followers().isEmpty()) {
+                qWarning() << "Non static anchor should have items on both sides unless it's following or being followed" << anchor;
+            }
+        }
+    }
+
+    for (Item *item : qAsConst(itemsToCheck)) {
+        if (!contains(item)) // Not in this layout anymore, nothing to verify
+            continue;
+
+        const AnchorGroup &group = item->anchorGroup();
+        for (Qt::Orientation orientation : { Qt::Vertical, Qt::Horizontal }) {
+            QPair<int, int> counts = memberships[orientation - 1].value(item);
+            Anchor *side1Anchor = group.anchorAtSide(Anchor::Side2, orientation); // Has the item on its Side1
+            Anchor *side2Anchor = group.anchorAtSide(Anchor::Side1, orientation);
+            for (Anchor *anchor : { side1Anchor, side2Anchor }) {
+                if (!anchor || m_touchedAnchors.contains(anchor) || (anchor == side2Anchor && anchor == side1Anchor))
+                    continue;
+
+                if (anchor->containsItem(item, Anchor::Side1))
+                    counts.first++;
+                if (anchor->containsItem(item, Anchor::Side2))
+                    counts.second++;
+            }
+
+            if (counts.first != 1 || counts.second != 1) {
+                dumpDebug();
+                qWarning() << "MultiSplitterLayout::checkSanityOfTouched: Problem detected! while processing"
+                           << orientation << "anchors"
+                           << "; numSide1=" << counts.first
+                           << "; numSide2=" << counts.second
+                           << "; item=" << item;
+                return false;
+            }
+        }
+
+        if (item->isPlaceholder())
+            continue;
+
+        if ((options & AnchorSanity_WidgetInvalidSizes) && (item->width() <= 0 || item->height() <= 0)) {
+            dumpDebug();
+            qWarning() << "MultiSplitterLayout::checkSanityOfTouched: Invalid size for widget" << item << item->size();
+            return false;
+        }
+
+        if (options & AnchorSanity_Intersections) {
+            for (Anchor *a : { group.left, group.top, group.right, group.bottom }) {
+                if (a && item->geometry().intersects(a->geometry())) {
+                    dumpDebug();
+                    qWarning() << "MultiSplitterLayout::checkSanityOfTouched: Widget" << item << "with rect" << item->geometry()
+                               << "Intersects anchor" << a << "with rect" << a->geometry();
+                    return false;
+                }
+            }
+        }
+
+        if ((options & AnchorSanity_WidgetGeometry) && group.itemSize() != item->size()) {
+            qWarning() << "MultiSplitterLayout::checkSanityOfTouched: Invaild item size" << item->size() << group.itemSize();
+            return false;
+        }
+
+        if (options & AnchorSanity_WidgetMinSizes) {
+            if (item->width() < item->minLength(Qt::Vertical) || item->height() < item->minLength(Qt::Horizontal)) {
+                dumpDebug();
+                qWarning() << "MultiSplitterLayout::checkSanityOfTouched: Widget has size=" << item->size()
+                           << "but minimum is" << item->minimumSize() << item;
+                return false;
+            }
+        }
+    }
+
+    if (options == AnchorSanity_All) {
+        m_touchedAnchors.clear();
+        m_touchedItems.clear();
+    }
+
+    return true;
+}
+
+bool MultiSplitterLayout::verifySanity(AnchorSanityOption options) const
+{
+    ++m_numVerifications;
+    if (m_fullSanityCheckInterval > 0 && m_numVerifications % m_fullSanityCheckInterval == 0)
+        return checkSanity(options);
+
+    return checkSanityOfTouched(options);
+}
+
+void MultiSplitterLayout::setFullSanityCheckInterval(int interval)
+{
+    if (interval < 0) {
+        qWarning() << Q_FUNC_INFO << "Invalid interval" << interval;
+        return;
+    }
+
+    m_fullSanityCheckInterval = interval;
+}
+
+void MultiSplitterLayout::setTouchTrackingEnabled(bool enabled)
+{
+    if (enabled == m_touchTrackingEnabled)
+        return;
+
+    m_touchTrackingEnabled = enabled;
+    m_touchedAnchors.clear();
+    m_touchedItems.clear();
+
+    if (enabled) {
+        // Nothing was tracked until now, so the first incremental check looks at everything
+        for (Anchor *anchor : qAsConst(m_anchors))
+            m_touchedAnchors.insert(anchor);
+        for (Item *item : qAsConst(m_items))
+            m_touchedItems.insert(item);
+    }
+}
+
 void MultiSplitterLayout::ensureHasAvailableSize(QSize needed)
 {
     const QSize availableSize = this->availableSize();
@@ -1338,6 +1579,7 @@ void MultiSplitterLayout::ensureHasAvailableSize(QSize needed)
 
 void MultiSplitterLayout::restorePlaceholder(Item *item)
 {
+    LayoutTransaction transaction(this);
     AnchorGroup anchorGroup = item->anchorGroup();
 
     const QSize availableSize = this->availableSize();
@@ -1363,8 +1605,12 @@ void MultiSplitterLayout::restorePlaceholder(Item *item)
         return;
     }
 
-    clearAnchorsFollowing();
-    QHash<Anchor*,Anchor*> anchorsThatWillFollowOthers = anchorsShouldFollow();
+    // Only the anchors we're about to move need to stop following. The others are reconciled by
+    // updateAnchorFollowing() at the end. Their followers move along meanwhile.
+    Anchor::List seeds = anchorGroup.anchors();
+    for (Anchor *anchor : qAsConst(seeds))
+        anchor->setFollowee(nullptr);
+    QHash<Anchor*, Anchor*> nearestCache[2]; // Indexed by Side1 and Side2
 
     if (!anchorsFollowing.contains(anchorGroup.top) && !anchorsFollowing.contains(anchorGroup.bottom)) {
         anchorGroup.top->updateItemSizes();
@@ -1381,15 +1627,16 @@ void MultiSplitterLayout::restorePlaceholder(Item *item)
         Anchor *side1Anchor = anchorGroup.anchorAtSide(Anchor::Side1, orientation); // returns the left if vertical, otherwise top
         Anchor *side2Anchor = anchorGroup.anchorAtSide(Anchor::Side2, orientation); // returns the right if vertical, otherwise bottom
 
-        if (anchorsThatWillFollowOthers.contains(side1Anchor)) {
-            Anchor *followee = anchorsThatWillFollowOthers.value(side1Anchor);
+        if (Anchor *followee = anchorShouldFollow(side1Anchor, nearestCache)) {
+            followee->setFollowee(nullptr); // We'll move it
             side1Anchor->setFollowee(followee);
-
+            seeds.push_back(followee);
             side1Anchor = followee;
         }
-        if (anchorsThatWillFollowOthers.contains(side2Anchor)) {
-            Anchor *followee = anchorsThatWillFollowOthers.value(side2Anchor);
+        if (Anchor *followee = anchorShouldFollow(side2Anchor, nearestCache)) {
+            followee->setFollowee(nullptr); // We'll move it
             side2Anchor->setFollowee(followee);
+            seeds.push_back(followee);
             side2Anchor = followee;
         }
 
@@ -1451,7 +1698,7 @@ void MultiSplitterLayout::restorePlaceholder(Item *item)
     }
     item->endBlockPropagateGeo();
 
-    updateAnchorFollowing();
+    updateAnchorFollowing(seeds);
 }
 
 void MultiSplitterLayout::unrefOldPlaceholders(const Frame::List &framesBeingAdded) const
@@ -1544,25 +1791,42 @@ void MultiSplitterLayout::updateAnchorsFromTo(Anchor *oldAnchor, Anchor *newAnch
     }
 }
 
-void MultiSplitterLayout::clearAnchorsFollowing()
+void MultiSplitterLayout::updateAnchorFollowing(const Anchor::List &seeds, const AnchorGroup &groupBeingRemoved)
 {
-    for (Anchor *anchor : qAsConst(m_anchors))
-        anchor->setFollowee(nullptr);
-}
+    LayoutTransaction transaction(this);
+    Anchor::List anchors = anchorsAffectedBy(seeds);
+    QSet<Anchor*> visited;
+    for (Anchor *anchor : qAsConst(anchors))
+        visited.insert(anchor);
+    QHash<Anchor*, Anchor*> followees;
+    QHash<Anchor*, Anchor*> nearestCache[2]; // Indexed by Side1 and Side2
 
-void MultiSplitterLayout::updateAnchorFollowing(const AnchorGroup &groupBeingRemoved)
-{
-    clearAnchorsFollowing();
+    for (int i = 0; i < anchors.size(); ++i) {
+        Anchor *anchor = anchors.at(i);
+        Anchor *toFollow = anchorShouldFollow(anchor, nearestCache);
+        followees.insert(anchor, toFollow);
 
-    for (Anchor *anchor : qAsConst(m_anchors)) {
-        if (anchor->isStatic())
-            continue;
+        // Whether the new followee follows us back is decided by both, so it's looked at too
+        if (toFollow && !toFollow->isStatic() && !visited.contains(toFollow)) {
+            visited.insert(toFollow);
+            anchors.push_back(toFollow);
+        }
+    }
 
-        if (anchor->onlyHasPlaceholderItems(Anchor::Side2)) {
-            Anchor *toFollow = anchor->findNearestAnchorWithItems(Anchor::Side2);
-            if (toFollow->followee() != anchor) {
+    // Unfollow first, so no cycle exists while the new followees are set
+    for (Anchor *anchor : qAsConst(anchors)) {
+        if (followees.value(anchor) != anchor->followee())
+            anchor->setFollowee(nullptr);
+    }
+
+    for (Anchor *anchor : qAsConst(anchors)) {
+        Anchor *toFollow = followees.value(anchor);
+        if (toFollow == anchor->followee())
+            continue; // Followers are moved along with their followee, there's nothing to do
 
-                if (!toFollow->isStatic() && groupBeingRemoved.containsAnchor(anchor, Anchor::Side1)) {
+        if (toFollow && !toFollow->isStatic()) {
+            if (anchor->onlyHasPlaceholderItems(Anchor::Side2)) {
+                if (groupBeingRemoved.containsAnchor(anchor, Anchor::Side1)) {
                     // A group is being removed, instead of simply shifting the left/top anchor all the way, let's make it use half the space
                     if (toFollow->onlyHasPlaceholderItems(Anchor::Side1)) { // Means it can move!
                         const int delta = toFollow->position() - anchor->position() - anchor->thickness();
@@ -1572,77 +1836,125 @@ void MultiSplitterLayout::updateAnchorFollowing(const AnchorGroup &groupBeingRem
                         }
                     }
                 }
-
-                anchor->setFollowee(toFollow);
-            }
-        } else if (anchor->onlyHasPlaceholderItems(Anchor::Side1)) {
-            Anchor *toFollow = anchor->findNearestAnchorWithItems(Anchor::Side1);
-            if (toFollow->followee() != anchor) {
-
-                if (!toFollow->isStatic() && groupBeingRemoved.containsAnchor(anchor, Anchor::Side2)) {
-                    // A group is being removed, instead of simply shifting the right/bottom anchor all the way, let's make it use half the space
-                    if (toFollow->onlyHasPlaceholderItems(Anchor::Side2)) { // Means it can move!
-                        const int delta = anchor->position() - toFollow->position() - toFollow->thickness();
-                        const int halfDelta = int(delta / 2.0);
-                        if (halfDelta > 0) {
-                            toFollow->setPosition(toFollow->position() + halfDelta);
-                        }
+            } else if (groupBeingRemoved.containsAnchor(anchor, Anchor::Side2)) {
+                // A group is being removed, instead of simply shifting the right/bottom anchor all the way, let's make it use half the space
+                if (toFollow->onlyHasPlaceholderItems(Anchor::Side2)) { // Means it can move!
+                    const int delta = anchor->position() - toFollow->position() - toFollow->thickness();
+                    const int halfDelta = int(delta / 2.0);
+                    if (halfDelta > 0) {
+                        toFollow->setPosition(toFollow->position() + halfDelta);
                     }
                 }
-
-                anchor->setFollowee(toFollow);
             }
         }
+
+        anchor->setFollowee(toFollow);
     }
 }
 
-QHash<Anchor*, Anchor*> MultiSplitterLayout::anchorsShouldFollow() const
+Anchor::List MultiSplitterLayout::anchorsAffectedBy(const Anchor::List &seeds) const
 {
-    QHash<Anchor*, Anchor*> followers;
+    Anchor::List affected;
+    QSet<Anchor*> visited;
+    auto visit = [&affected, &visited] (Anchor *anchor) {
+        if (anchor && !visited.contains(anchor)) {
+            visited.insert(anchor);
+            affected.push_back(anchor);
+        }
+    };
 
-    for (Anchor *anchor : m_anchors) {
-        if (anchor->isStatic())
-            continue;
+    for (Anchor *seed : seeds)
+        visit(seed);
+    const int numSeeds = affected.size();
 
-        if (anchor->onlyHasPlaceholderItems(Anchor::Side2)) {
-            Anchor *toFollow = anchor->findNearestAnchorWithItems(Anchor::Side2);
-            if (followers.value(toFollow) != anchor)
-                followers.insert(anchor, toFollow);
-        } else if (anchor->onlyHasPlaceholderItems(Anchor::Side1)) {
-            Anchor *toFollow = anchor->findNearestAnchorWithItems(Anchor::Side1);
-            if (followers.value(toFollow) != anchor)
-                followers.insert(anchor, toFollow);
+    for (int i = 0; i < affected.size(); ++i) {
+        Anchor *anchor = affected.at(i);
+        visit(anchor->followee());
+        for (Anchor *follower : anchor->followers())
+            visit(follower);
+
+        // A search towards Side2 arrives through our Side1 items, and only continues past us if we have
+        // no items at Side2. The seeds changed, so the searches arriving at them are always affected.
+        for (Anchor::Side side : { Anchor::Side1, Anchor::Side2 }) {
+            if (i >= numSeeds && anchor->hasNonPlaceholderItems(Anchor::oppositeSide(side)))
+                continue;
+
+            for (Item *item : anchor->items(side))
+                visit(item->anchorAtSide(side, anchor->orientation()));
         }
     }
 
-    return followers;
+    return affected;
 }
 
-void MultiSplitterLayout::insertAnchor(Anchor *anchor)
+Anchor *MultiSplitterLayout::anchorShouldFollow(Anchor *anchor, QHash<Anchor*, Anchor*> nearestCache[2]) const
 {
-    m_anchors.append(anchor);
+    auto nearest = [this, nearestCache] (Anchor *a) -> Anchor* {
+        if (a->isStatic())
+            return nullptr;
+        if (a->onlyHasPlaceholderItems(Anchor::Side2))
+            return findNearestAnchorWithItems(a, Anchor::Side2, nearestCache[1]);
+        if (a->onlyHasPlaceholderItems(Anchor::Side1))
+            return findNearestAnchorWithItems(a, Anchor::Side1, nearestCache[0]);
+        return nullptr;
+    };
+
+    Anchor *toFollow = nearest(anchor);
+    if (toFollow && nearest(toFollow) == anchor) {
+        // Both would follow each other, the one coming first in m_anchors wins, like anchorsShouldFollow().
+        // Rare enough that the linear lookups don't matter.
+        if (m_anchors.indexOf(toFollow) < m_anchors.indexOf(anchor))
+            return nullptr;
+    }
+
+    return toFollow;
 }
 
-const ItemList MultiSplitterLayout::items() const
+QHash<Anchor*, Anchor*> MultiSplitterLayout::anchorsShouldFollow() const
 {
-    return m_items;
+    QHash<Anchor*, Anchor*> followers;
+    QHash<Anchor*, Anchor*> nearestCache[2]; // Indexed by Side1 and Side2
+
+    for (Anchor *anchor : m_anchors) {
+        if (Anchor *toFollow = anchorShouldFollow(anchor, nearestCache))
+            followers.insert(anchor, toFollow);
+    }
+
+    return followers;
 }
 
-bool MultiSplitterLayout::eventFilter(QObject *o, QEvent *e)
+Anchor *MultiSplitterLayout::findNearestAnchorWithItems(Anchor *anchor, Anchor::Side side, QHash<Anchor*, Anchor*> &cache) const
 {
-    if (m_inDestructor || e->spontaneous() || !m_multiSplitter)
-        return false;
+    if (Anchor *cached = cache.value(anchor))
+        return cached;
 
-    if (!m_multiSplitter->isVisible()) {
-        // The whole MultiSplitter isn't visible, don't bother. It probably even is being hidden by ~QMainWindow().
-        return false;
-    }
+    Anchor *candidate = nullptr;
+    for (Item *item : anchor->items(side)) {
+        Anchor *a = item->anchorAtSide(side, anchor->orientation());
+        if (!a->hasNonPlaceholderItems(side))
+            a = findNearestAnchorWithItems(a, side, cache);
 
-    QWidget *w = qobject_cast<QWidget*>(o);
-    if (!w || !w->testAttribute(Qt::WA_WState_ExplicitShowHide)) {
-        // We only care about explicit show/hide by the developer
-        return false;
+        if (!candidate || (side == Anchor::Side1 && a->position() > candidate->position()) || (side == Anchor::Side2 && a->position() < candidate->position()) ) {
+            candidate = a;
+        }
     }
 
-    return false;
+    if (!candidate)
+        candidate = staticAnchor(side, anchor->orientation());
+
+    Q_ASSERT(candidate->isStatic() || candidate->hasNonPlaceholderItems(side));
+    cache.insert(anchor, candidate);
+    return candidate;
+}
+
+void MultiSplitterLayout::insertAnchor(Anchor *anchor)
+{
+    m_anchors.append(anchor);
+    markTouched(anchor);
+    invalidateStructure();
+}
+
+const ItemList MultiSplitterLayout::items() const
+{
+    return m_items;
 }
@@ -38,13 +38,18 @@
 #include "KDDockWidgets.h"
 #include "Item_p.h"
 #include "Frame_p.h"
+#include "SpatialIndex_p.h"
 
 #include <QPointer>
+#include <QSet>
+
+#include <memory>
 
 namespace KDDockWidgets {
 
 class MultiSplitterWidget;
 class Length;
+struct LayoutEngineSnapshot;
 
 /**
  * Returns the width of the widget if orientation is Vertical, the height otherwise.
@@ -182,6 +187,7 @@ public:
 
     /**
      * @brief Returns the visible Item at pos @p p.
+     * Doesn't scan all items, but looks them up in a spatial index.
      */
     Item *itemAt(QPoint p) const;
 
@@ -340,6 +346,36 @@ public:
 
     bool checkSanity(AnchorSanityOption o = AnchorSanity_All) const;
 
+    /**
+     * @brief Cheap version of checkSanity() which only looks at the anchors and items touched since
+     * the previous successful verification. Its cost is proportional to what changed, not to the
+     * size of the layout.
+     *
+     * Invariants that aren't local, like an item intersecting an unrelated anchor or a stale
+     * cumulative min length, are only caught by checkSanity().
+     *
+     * Without touch tracking, see setTouchTrackingEnabled(), this is the same as checkSanity().
+     */
+    bool checkSanityOfTouched(AnchorSanityOption o = AnchorSanity_All) const;
+
+    /**
+     * @brief Tiered verification, to call after each mutation.
+     * Runs checkSanityOfTouched(), except every fullSanityCheckInterval() calls, where a full
+     * checkSanity() is done instead.
+     */
+    bool verifySanity(AnchorSanityOption o = AnchorSanity_All) const;
+
+    ///@brief sets how often verifySanity() does a full check. 1 means always and 0 means never.
+    void setFullSanityCheckInterval(int);
+    int fullSanityCheckInterval() const { return m_fullSanityCheckInterval; }
+
+    /**
+     * @brief Enables remembering which anchors and items changed, for checkSanityOfTouched().
+     * Only enabled by default in developer builds, otherwise markTouched() does nothing.
+     */
+    void setTouchTrackingEnabled(bool);
+    bool isTouchTrackingEnabled() const { return m_touchTrackingEnabled; }
+
     void restorePlaceholder(Item *item);
 
     /**
@@ -359,6 +395,9 @@ public:
      */
     Item *itemForFrame(const Frame *frame) const;
 
+    ///@brief returns the Item holding the MainWindow's central frame, if any
+    Item *centralFrameItem() const { return m_centralFrameItem; }
+
     /**
      * @brief returns the frames contained in @p frameOrMultiSplitter
      * If frameOrMultiSplitter is a Frame, it returns a list of 1 element, with that frame
@@ -442,7 +481,6 @@ Q_SIGNALS:
     void minimumSizeChanged(QSize);
 
 public:
-    bool eventFilter(QObject *o, QEvent *e) override;
     AnchorGroup anchorsForPos(QPoint pos) const;
     AnchorGroup staticAnchorGroup() const;
     Anchor::List anchors(Qt::Orientation, bool includeStatic = false, bool includePlaceholders = true) const;
@@ -451,6 +489,68 @@ public:
 
     void setDoSanityChecks(bool);
 
+    /**
+     * @brief Starts a transaction.
+     *
+     * Until the matching commitTransaction() only the model changes (Anchor and Item geometries),
+     * the separators and Frames are only moved once, when the outermost transaction is committed.
+     * Transactions can be nested.
+     */
+    void beginTransaction();
+
+    /**
+     * @brief Commits the transaction started with beginTransaction().
+     * If it's the outermost one, every dirty separator and Frame gets its final geometry.
+     */
+    void commitTransaction();
+
+    ///@brief returns whether a transaction is in progress
+    bool isInTransaction() const { return m_transactionDepth > 0; }
+
+    /**
+     * @brief Invalidates the Anchor::cumulativeMinLength() cache.
+     * Called whenever an item's minimum size or the topology of the anchor graph changes.
+     */
+    void invalidateCumulativeMinLengths() const { ++m_cumulativeMinLengthGeneration; }
+
+    ///@brief Anchors compare this with the generation of their cached cumulative min length
+    quint64 cumulativeMinLengthGeneration() const { return m_cumulativeMinLengthGeneration; }
+
+    /**
+     * @brief Called whenever anchors or items are added or removed, or they're linked differently.
+     * Invalidates the cumulative min lengths and the LayoutEngineSnapshot.
+     */
+    void invalidateStructure()
+    {
+        ++m_structureGeneration;
+        invalidateCumulativeMinLengths();
+    }
+
+    ///@brief A LayoutEngineSnapshot is reused while this doesn't change
+    quint64 structureGeneration() const { return m_structureGeneration; }
+
+    /**
+     * @brief Lends the snapshot kept from the previous LayoutEngineAdapter.
+     * Returns nullptr if there's none, or if the structure changed since it was taken.
+     */
+    std::unique_ptr<LayoutEngineSnapshot> takeEngineSnapshot();
+
+    ///@brief Gives back the snapshot, for the next LayoutEngineAdapter
+    void returnEngineSnapshot(std::unique_ptr<LayoutEngineSnapshot>);
+
+    ///@brief Remembers that @p anchor or @p item changed, so checkSanityOfTouched() looks at it
+    void markTouched(Anchor *anchor)
+    {
+        if (m_touchTrackingEnabled)
+            m_touchedAnchors.insert(anchor);
+    }
+
+    void markTouched(Item *item)
+    {
+        if (m_touchTrackingEnabled)
+            m_touchedItems.insert(item);
+    }
+
 private:
     friend struct AnchorGroup;
     friend class Item;
@@ -531,10 +631,30 @@ private:
      */
     void updateAnchorsFromTo(Anchor *oldAnchor, Anchor *newAnchor);
 
-    void clearAnchorsFollowing();
-    void updateAnchorFollowing(const AnchorGroup &groupBeingRemoved = {});
+    /**
+     * @brief Makes anchors that only have placeholders at one side follow the nearest anchor with items.
+     *
+     * @p seeds are the anchors of the item that was added, removed, or turned into or from a placeholder.
+     * Only the anchors reachable from them through placeholders are looked at, see anchorsAffectedBy(),
+     * and only the ones whose followee changed are touched.
+     */
+    void updateAnchorFollowing(const Anchor::List &seeds, const AnchorGroup &groupBeingRemoved = {});
+
+    /**
+     * @brief Returns @p seeds plus every anchor whose search for the nearest anchor with items walks
+     * into one of them. Their followers and followees are included too, as they might swap roles.
+     */
+    Anchor::List anchorsAffectedBy(const Anchor::List &seeds) const;
+
+    ///@brief Returns the anchor @p anchor should follow, or nullptr. Same result as anchorsShouldFollow().value(anchor)
+    Anchor *anchorShouldFollow(Anchor *anchor, QHash<Anchor*, Anchor*> nearestCache[2]) const;
+
+    ///@brief The mapping for every anchor. Only used to verify the incremental updates.
     QHash<Anchor *, Anchor *> anchorsShouldFollow() const;
 
+    ///@brief Same as Anchor::findNearestAnchorWithItems(), but memoized in @p cache, for when asking about every anchor
+    Anchor *findNearestAnchorWithItems(Anchor *anchor, Anchor::Side side, QHash<Anchor*, Anchor*> &cache) const;
+
     /**
      * Positions the static anchors at their correct places. Called when the MultiSplitter is resized.
      * left and top anchor are at position 0, while right/bottom are at position= width/height.
@@ -547,7 +667,6 @@ private:
      * all widgets.
      **/
     void redistributeSpace(QSize oldSize, QSize newSize);
-    void redistributeSpace_recursive(Anchor *fromAnchor, int minAnchorPos);
 
     /**
      * Returns the width (if orientation = Horizontal), or height that is occupied by anchors.
@@ -566,14 +685,21 @@ private:
      */
     void propagateResize(int delta, Anchor *fromAnchor, Anchor::Side direction);
 
-    // Helper function for propagateResize()
-    void collectPaths(QVector<Anchor::List> &paths, Anchor *fromAnchor, Anchor::Side direction);
-
 
     // convenience for the unit-tests
     // Moves the widget's bottom or right anchor, to resize it.
     void resizeItem(Frame *frame, int newSize, Qt::Orientation);
 
+    ///@brief Keeps m_itemIndex, m_itemsByFrame and m_framesByItem up to date with the item
+    void indexItem(Item *);
+    void unindexItem(Item *);
+    void indexFrame(Item *);
+
+    ///@brief Called by Anchor and Item when their widget geometry is deferred by a transaction
+    void addDirtyAnchor(Anchor *);
+    void addDirtyItem(Item *);
+    void addMovedAnchor(Anchor *);
+
     MultiSplitterWidget *const m_multiSplitter;
     Anchor::List m_anchors;
 
@@ -593,6 +719,49 @@ private:
     QPointer<Anchor> m_anchorBeingDragged;
     QSize m_contentSize;
     QSize m_extraUselessSpace = {0, 0};
+    int m_transactionDepth = 0;
+    mutable quint64 m_cumulativeMinLengthGeneration = 1; // The cache is mutable, so is its generation
+    quint64 m_structureGeneration = 0;
+    std::unique_ptr<LayoutEngineSnapshot> m_engineSnapshot;
+    SpatialIndex<Item> m_itemIndex;
+    QHash<const Frame*, Item*> m_itemsByFrame;
+    QHash<const Item*, const Frame*> m_framesByItem; // Has every item, with nullptr for placeholders
+    QPointer<Item> m_centralFrameItem;
+    QVector<QPointer<Anchor>> m_dirtyAnchors;
+    QVector<QPointer<Item>> m_dirtyItems;
+    QVector<QPointer<Anchor>> m_movedAnchors; // Emit positionChanged() when the transaction commits
+
+    // Changed since the last successful verification, see checkSanityOfTouched()
+    mutable QSet<Anchor*> m_touchedAnchors;
+    mutable QSet<Item*> m_touchedItems;
+    mutable int m_numVerifications = 0;
+    int m_fullSanityCheckInterval = 16;
+#if defined(DOCKS_DEVELOPER_MODE)
+    bool m_touchTrackingEnabled = true;
+#else
+    bool m_touchTrackingEnabled = false;
+#endif
+};
+
+/**
+ * @brief RAII helper calling MultiSplitterLayout::beginTransaction() and commitTransaction()
+ */
+struct LayoutTransaction
+{
+    explicit LayoutTransaction(MultiSplitterLayout *layout)
+        : m_layout(layout)
+    {
+        layout->beginTransaction();
+    }
+
+    ~LayoutTransaction()
+    {
+        if (m_layout) // The layout might have been deleted meanwhile
+            m_layout->commitTransaction();
+    }
+
+    const QPointer<MultiSplitterLayout> m_layout;
+    Q_DISABLE_COPY(LayoutTransaction)
 };
 
 inline QDebug operator<<(QDebug d, const AnchorGroup &group) {
@@ -0,0 +1,150 @@
+/*
+  This file is part of KDDockWidgets.
+
+  Copyright (C) 2018-2019 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com
+  Author: Sérgio Martins <sergio.martins@kdab.com>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef KD_MULTISPLITTER_SPATIALINDEX_P_H
+#define KD_MULTISPLITTER_SPATIALINDEX_P_H
+
+#include <QHash>
+#include <QPoint>
+#include <QRect>
+#include <QVector>
+
+namespace KDDockWidgets {
+
+/**
+ * @brief A uniform grid over the rects of T, for hit-testing by position.
+ *
+ * Each rect is registered in every cell it overlaps, so a point query only looks at the few rects
+ * in a single cell. update() only touches the cells that a rect entered or left, which makes moving
+ * a separator cheap: the neighbouring items only change cells when they cross a cell boundary.
+ */
+template <typename T>
+class SpatialIndex
+{
+public:
+    explicit SpatialIndex(int cellSize = 128)
+        : m_cellSize(cellSize)
+    {
+    }
+
+    ///@brief Inserts @p t, or moves it if it's already indexed
+    void update(T *t, QRect rect)
+    {
+        const auto it = m_rects.constFind(t);
+        const QRect oldCells = it == m_rects.cend() ? QRect() : cellsFor(*it);
+        const QRect newCells = cellsFor(rect);
+        m_rects.insert(t, rect);
+
+        if (oldCells == newCells)
+            return;
+
+        forEachCell(oldCells, [this, t, newCells] (int x, int y) {
+            if (!newCells.contains(x, y)) {
+                const quint64 key = cellKey(x, y);
+                auto cell = m_cells.find(key);
+                if (cell != m_cells.end()) {
+                    cell->removeOne(t);
+                    if (cell->isEmpty())
+                        m_cells.erase(cell);
+                }
+            }
+        });
+
+        forEachCell(newCells, [this, t, oldCells] (int x, int y) {
+            if (!oldCells.contains(x, y))
+                m_cells[cellKey(x, y)].push_back(t);
+        });
+    }
+
+    void remove(T *t)
+    {
+        update(t, QRect());
+        m_rects.remove(t);
+    }
+
+    void clear()
+    {
+        m_cells.clear();
+        m_rects.clear();
+    }
+
+    bool contains(T *t) const { return m_rects.contains(t); }
+    int count() const { return m_rects.size(); }
+
+    ///@brief returns the rect @p t was indexed with
+    QRect rect(T *t) const { return m_rects.value(t); }
+
+    ///@brief returns the first indexed T whose rect contains @p p and which satisfies @p accept
+    template <typename Predicate>
+    T *at(QPoint p, Predicate accept) const
+    {
+        const auto cell = m_cells.constFind(cellKey(cellCoordinate(p.x()), cellCoordinate(p.y())));
+        if (cell == m_cells.cend())
+            return nullptr;
+
+        for (T *t : *cell) {
+            if (m_rects.value(t).contains(p) && accept(t))
+                return t;
+        }
+
+        return nullptr;
+    }
+
+private:
+    int cellCoordinate(int v) const
+    {
+        // Rounds towards negative infinity, so negative coordinates don't share cell 0
+        return v >= 0 ? v / m_cellSize : -((-v - 1) / m_cellSize) - 1;
+    }
+
+    QRect cellsFor(QRect r) const
+    {
+        if (!r.isValid())
+            return {};
+
+        return QRect(QPoint(cellCoordinate(r.left()), cellCoordinate(r.top())),
+                     QPoint(cellCoordinate(r.right()), cellCoordinate(r.bottom())));
+    }
+
+    template <typename Func>
+    static void forEachCell(QRect cells, Func func)
+    {
+        if (!cells.isValid())
+            return;
+
+        for (int x = cells.left(); x <= cells.right(); ++x) {
+            for (int y = cells.top(); y <= cells.bottom(); ++y)
+                func(x, y);
+        }
+    }
+
+    static quint64 cellKey(int x, int y)
+    {
+        return (quint64(quint32(x)) << 32) | quint32(y);
+    }
+
+    const int m_cellSize;
+    QHash<quint64, QVector<T*>> m_cells;
+    QHash<T*, QRect> m_rects;
+};
+
+}
+
+#endif
@@ -133,8 +133,8 @@ int main(int argc, char **argv)
                 window->addDockWidget(listDockWidget.at(i-1), static_cast<Location>(position), listDockWidget.at(i), static_cast<AddingOption>(addingOption));
             }
         }
-        dropArea->checkSanity();
-        std::cout << "dropArea->checkSanity();" << std::endl << std::endl;
+        dropArea->verifySanity();
+        std::cout << "dropArea->verifySanity();" << std::endl << std::endl;
     }
 
     window->show();
@@ -0,0 +1,130 @@
+/*
+  This file is part of KDDockWidgets.
+
+  Copyright (C) 2018-2019 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com
+  Author: Sérgio Martins <sergio.martins@kdab.com>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Validates saved layout files without creating any widget, for triaging layouts from bug reports.
+// Usage: layoutinspector [--jobs N] [--quiet] file...
+
+#include "LayoutSaver_p.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QVector>
+
+#include <iostream>
+
+using namespace KDDockWidgets;
+
+namespace {
+
+struct Result
+{
+    QString fileName;
+    QString readError;
+    LayoutReport report;
+};
+
+class InspectJob : public QRunnable
+{
+public:
+    explicit InspectJob(Result *result)
+        : m_result(result)
+    {
+    }
+
+    void run() override
+    {
+        QFile file(m_result->fileName);
+        if (!file.open(QIODevice::ReadOnly)) {
+            m_result->readError = file.errorString();
+            return;
+        }
+
+        m_result->report = LayoutReport::fromData(file.readAll());
+    }
+
+private:
+    Result *const m_result;
+};
+
+}
+
+static void print(const Result &result, bool quiet)
+{
+    const LayoutReport &report = result.report;
+    if (!result.readError.isEmpty()) {
+        std::cout << "ERROR " << qPrintable(result.fileName) << ": " << qPrintable(result.readError) << std::endl;
+    } else if (!report.isValid()) {
+        std::cout << "INVALID " << qPrintable(result.fileName) << std::endl;
+        for (const QString &error : report.errors)
+            std::cout << "    " << qPrintable(error) << std::endl;
+    } else if (!quiet) {
+        std::cout << "OK " << qPrintable(result.fileName)
+                  << ": version=" << report.formatVersion
+                  << "; mainWindows=" << report.numMainWindows
+                  << "; floatingWindows=" << report.numFloatingWindows
+                  << "; floatingDockWidgets=" << report.numFloatingDockWidgets
+                  << "; anchors=" << report.numAnchors
+                  << "; frames=" << report.numFrames
+                  << "; dockWidgets=" << report.numDockWidgets << std::endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Validates layouts saved by KDDockWidgets::LayoutSaver"));
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("jobs"), QStringLiteral("number of files to process in parallel"), QStringLiteral("count")));
+    parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("quiet"), QStringLiteral("only print invalid files")));
+    parser.addPositionalArgument(QStringLiteral("files"), QStringLiteral("layout files to check"), QStringLiteral("file..."));
+    parser.process(app);
+
+    const QStringList fileNames = parser.positionalArguments();
+    if (fileNames.isEmpty())
+        parser.showHelp(1);
+
+    QThreadPool pool;
+    if (parser.isSet(QStringLiteral("jobs")))
+        pool.setMaxThreadCount(qMax(1, parser.value(QStringLiteral("jobs")).toInt()));
+
+    // Each job fills its own slot, so results are printed in the order of the arguments
+    QVector<Result> results(fileNames.size());
+    for (int i = 0, end = fileNames.size(); i < end; ++i) {
+        results[i].fileName = fileNames.at(i);
+        pool.start(new InspectJob(&results[i]));
+    }
+    pool.waitForDone();
+
+    const bool quiet = parser.isSet(QStringLiteral("quiet"));
+    int numInvalid = 0;
+    for (const Result &result : qAsConst(results)) {
+        print(result, quiet);
+        if (!result.readError.isEmpty() || !result.report.isValid())
+            numInvalid++;
+    }
+
+    std::cout << results.size() << " files, " << numInvalid << " invalid" << std::endl;
+    return numInvalid == 0 ? 0 : 1;
+}
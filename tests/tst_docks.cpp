@@ -31,8 +31,12 @@
 #include "WindowBeingDragged_p.h"
 #include "Utils_p.h"
 #include "LayoutSaver.h"
+#include "LayoutSaver_p.h"
+#include "EventRouter_p.h"
+#include "DragController_p.h"
 #include "TabWidget_p.h"
 #include "multisplitter/MultiSplitterWidget_p.h"
+#include "multisplitter/LayoutEngineAdapter_p.h"
 #include "LastPosition_p.h"
 #include "utils.h"
 
@@ -337,6 +341,34 @@ private Q_SLOTS:
     void tst_invalidLayoutAfterRestore();
     void tst_samePositionAfterHideRestore();
     void tst_anchorFollowingItselfAssert();
+    void tst_layoutEngine();
+    void tst_layoutEngineAdapter();
+    void tst_layoutTransaction();
+    void tst_propagateResize();
+    void tst_cumulativeMinLengthCache();
+    void tst_spatialIndex();
+    void tst_layoutIndices();
+    void tst_redistributeSpace();
+    void tst_redistributeSpaceBenchmark_data();
+    void tst_redistributeSpaceBenchmark();
+    void tst_incrementalFollowers();
+    void tst_followerPropagation();
+    void tst_tieredSanityCheck();
+    void tst_layoutSaverFormat();
+    void tst_layoutFile();
+    void tst_bulkRestore();
+    void tst_diffRestore();
+    void tst_perspectives();
+    void tst_autoSave();
+    void tst_layoutJournal();
+    void tst_layoutReport();
+    void tst_dockWidgetFactory();
+    void tst_lazyTabContent();
+    void tst_registryLookup();
+    void tst_eventRouter();
+    void tst_dragMoveCoalescing();
+    void tst_hoverSnapshot();
+    void tst_dragControllerStates();
 private:
     void tst_restoreEmpty(); // TODO. Disabled for now, save/restore needs to support placeholders
     void tst_restoreCrash(); // TODO. Disabled for now, save/restore needs to support placeholders
@@ -4137,6 +4169,1889 @@ void TestDocks::tst_samePositionAfterHideRestore()
     QCOMPARE(geo2, dock2->frame()->geometry());
 }
 
+static LayoutEngine createEngineWithRow(int count, int itemLength, int itemMinLength)
+{
+    // Lays out count items side by side, without creating any widget
+    const int staticThickness = Anchor::thickness(/*static=*/true);
+    const int thickness = Anchor::thickness(/*static=*/false);
+    const int height = 100;
+    const int width = 2 * staticThickness + count * itemLength + (count - 1) * thickness;
+
+    LayoutEngine engine;
+    engine.setContentsSize(QSize(width, height));
+    const int left = engine.addAnchor(Qt::Vertical, staticThickness, LayoutEngine::AnchorType_Side1Static, 0);
+    const int top = engine.addAnchor(Qt::Horizontal, staticThickness, LayoutEngine::AnchorType_Side1Static, 0);
+    const int right = engine.addAnchor(Qt::Vertical, staticThickness, LayoutEngine::AnchorType_Side2Static, width - 1);
+    const int bottom = engine.addAnchor(Qt::Horizontal, staticThickness, LayoutEngine::AnchorType_Side2Static, height - 1);
+    engine.setFromTo(left, top, bottom);
+    engine.setFromTo(right, top, bottom);
+    engine.setFromTo(top, left, right);
+    engine.setFromTo(bottom, left, right);
+
+    int previousAnchor = left;
+    for (int i = 0; i < count; ++i) {
+        const int x = staticThickness + i * (itemLength + thickness);
+        const int item = engine.addItem(QRect(x, staticThickness, itemLength, height - 2 * staticThickness),
+                                        QSize(itemMinLength, itemMinLength));
+        int nextAnchor = right;
+        if (i < count - 1) {
+            const int position = x + itemLength;
+            nextAnchor = engine.addAnchor(Qt::Vertical, thickness, LayoutEngine::AnchorType_Normal,
+                                          position, (position * 1.0) / width);
+            engine.setFromTo(nextAnchor, top, bottom);
+        }
+
+        engine.addItemToAnchor(previousAnchor, item, LayoutEngine::Side2);
+        engine.addItemToAnchor(nextAnchor, item, LayoutEngine::Side1);
+        engine.addItemToAnchor(top, item, LayoutEngine::Side2);
+        engine.addItemToAnchor(bottom, item, LayoutEngine::Side1);
+        previousAnchor = nextAnchor;
+    }
+
+    return engine;
+}
+
+static bool engineIsConsistent(const LayoutEngine &engine)
+{
+    // Checks that items are between their anchors and respect their min size
+    for (int i = 0; i < engine.itemCount(); ++i) {
+        const LayoutEngine::ItemNode &item = engine.item(i);
+        if (item.isPlaceholder)
+            continue;
+
+        const QRect geo = item.geometry;
+        if (geo.left() != engine.anchor(item.left).position + engine.thickness(item.left) ||
+            geo.top() != engine.anchor(item.top).position + engine.thickness(item.top) ||
+            geo.right() != engine.anchor(item.right).position - 1 ||
+            geo.bottom() != engine.anchor(item.bottom).position - 1) {
+            qWarning() << "Item" << i << "isn't between its anchors" << geo;
+            return false;
+        }
+
+        if (geo.width() < item.minSize.width() || geo.height() < item.minSize.height()) {
+            qWarning() << "Item" << i << "is smaller than its min size" << geo << item.minSize;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void TestDocks::tst_layoutEngine()
+{
+    // Tests the engine alone, no widgets involved
+    const int count = 1000;
+    const int itemLength = 20;
+    const int itemMinLength = 10;
+    const int staticThickness = Anchor::thickness(/*static=*/true);
+    const int thickness = Anchor::thickness(/*static=*/false);
+    LayoutEngine engine = createEngineWithRow(count, itemLength, itemMinLength);
+    QVERIFY(engineIsConsistent(engine));
+
+    const QSize minSize = engine.minimumSize();
+    QCOMPARE(minSize.width(), 2 * staticThickness + count * itemMinLength + (count - 1) * thickness);
+    QCOMPARE(minSize.height(), 2 * staticThickness + itemMinLength);
+
+    for (int i = 0; i < engine.anchorCount(); ++i) {
+        if (engine.anchor(i).isStatic())
+            continue;
+        const QPair<int, int> bounds = engine.boundPositions(i);
+        QVERIFY(bounds.first <= engine.anchor(i).position);
+        QVERIFY(bounds.second >= engine.anchor(i).position);
+    }
+
+    // The offset pushes the items away from the anchor, without moving it
+    const int firstAnchor = engine.item(0).right;
+    const int firstAnchorPos = engine.anchor(firstAnchor).position;
+    engine.setPositionOffset(firstAnchor, 2);
+    QCOMPARE(engine.anchor(firstAnchor).position, firstAnchorPos);
+    QCOMPARE(engine.item(0).geometry.right(), firstAnchorPos - 3);
+    QCOMPARE(engine.item(1).geometry.left(), firstAnchorPos + thickness + 2);
+    engine.setPositionOffset(firstAnchor, 0);
+    QVERIFY(engineIsConsistent(engine));
+
+    // Grow
+    const QSize oldSize = engine.contentsSize();
+    engine.resize(QSize(oldSize.width() * 2, oldSize.height()));
+    QVERIFY(engineIsConsistent(engine));
+    QVERIFY(engine.item(count / 2).geometry.width() > itemLength);
+
+    // Shrink to the minimum. All items are at their min size now
+    engine.resize(minSize);
+    QVERIFY(engineIsConsistent(engine));
+    QCOMPARE(engine.item(count / 2).geometry.width(), itemMinLength);
+}
+
+void TestDocks::tst_layoutEngineAdapter()
+{
+    EnsureTopLevelsDeleted e;
+    auto m = createMainWindow(QSize(800, 500), MainWindowOption_None);
+    auto dock1 = createDockWidget(QStringLiteral("dock1"), new QPushButton(QStringLiteral("one")));
+    auto dock2 = createDockWidget(QStringLiteral("dock2"), new QPushButton(QStringLiteral("two")));
+    auto dock3 = createDockWidget(QStringLiteral("dock3"), new QPushButton(QStringLiteral("three")));
+    m->addDockWidget(dock1, Location_OnLeft);
+    m->addDockWidget(dock2, Location_OnRight);
+    m->addDockWidget(dock3, Location_OnBottom);
+    MultiSplitterLayout *layout = m->multiSplitterLayout();
+
+    {
+        // The snapshot has the same constraints as the layout
+        LayoutEngineAdapter adapter(layout);
+        const LayoutEngine &engine = adapter.engine();
+        QCOMPARE(engine.minimumSize(), layout->minimumSize());
+        for (Anchor *anchor : layout->anchors()) {
+            if (anchor->isStatic())
+                continue;
+            const QPair<int, int> bounds = engine.boundPositions(adapter.indexOf(anchor));
+            QCOMPARE(bounds.first, layout->boundPositionsForAnchor(anchor).first);
+            QCOMPARE(bounds.second, layout->boundPositionsForAnchor(anchor).second);
+        }
+    }
+
+    {
+        // Solve in the engine and apply to the widgets
+        LayoutEngineAdapter adapter(layout);
+        Anchor *anchor = layout->itemForFrame(dock1->frame())->anchorAtSide(Anchor::Side2, Qt::Vertical);
+        const int newPosition = anchor->position() + 10;
+        adapter.engine().setAnchorPosition(adapter.indexOf(anchor), newPosition);
+        QSignalSpy positionSpy(anchor, &Anchor::positionChanged);
+        adapter.apply();
+
+        QCOMPARE(anchor->position(), newPosition);
+        QCOMPARE(positionSpy.count(), 1);
+        QCOMPARE(positionSpy.at(0).at(0).toInt(), newPosition);
+        QCOMPARE(anchor->separatorWidget()->geometry(), anchor->geometry());
+        for (Item *item : layout->items()) {
+            QCOMPARE(item->geometry(), adapter.engine().item(adapter.indexOf(item)).geometry);
+            QCOMPARE(item->frame()->geometry(), item->geometry());
+        }
+        QVERIFY(layout->checkSanity());
+    }
+
+    {
+        // Resizing the engine gives the same result as resizing the layout
+        LayoutEngineAdapter adapter(layout);
+        const QSize newSize = layout->contentsSize() + QSize(200, 100);
+        adapter.engine().resize(newSize);
+        layout->setContentsSize(newSize);
+
+        for (Anchor *anchor : layout->anchors())
+            QCOMPARE(adapter.engine().anchor(adapter.indexOf(anchor)).position, anchor->position());
+        for (Item *item : layout->items())
+            QCOMPARE(adapter.engine().item(adapter.indexOf(item)).geometry, item->geometry());
+    }
+
+    {
+        // The snapshot is reused, with fresh positions, until the structure changes
+        const LayoutEngine *engine = nullptr;
+        {
+            LayoutEngineAdapter adapter(layout);
+            engine = &adapter.engine();
+        }
+
+        Anchor *anchor = layout->itemForFrame(dock1->frame())->anchorAtSide(Anchor::Side2, Qt::Vertical);
+        anchor->setPosition(anchor->position() - 20);
+        {
+            LayoutEngineAdapter adapter(layout);
+            QVERIFY(&adapter.engine() == engine);
+            QCOMPARE(adapter.engine().anchor(adapter.indexOf(anchor)).position, anchor->position());
+            for (Item *item : layout->items())
+                QCOMPARE(adapter.engine().item(adapter.indexOf(item)).geometry, item->geometry());
+        }
+
+        auto dock4 = createDockWidget(QStringLiteral("dock4"), new QPushButton(QStringLiteral("four")));
+        m->addDockWidget(dock4, Location_OnTop);
+        LayoutEngineAdapter adapter(layout);
+        QCOMPARE(adapter.engine().itemCount(), layout->items().size());
+        QVERIFY(adapter.indexOf(layout->itemForFrame(dock4->frame())) != -1);
+    }
+}
+
+void TestDocks::tst_layoutTransaction()
+{
+    EnsureTopLevelsDeleted e;
+    auto m = createMainWindow(QSize(800, 500), MainWindowOption_None);
+    auto dock1 = createDockWidget(QStringLiteral("dock1"), new QPushButton(QStringLiteral("one")));
+    auto dock2 = createDockWidget(QStringLiteral("dock2"), new QPushButton(QStringLiteral("two")));
+    m->addDockWidget(dock1, Location_OnLeft);
+    m->addDockWidget(dock2, Location_OnRight);
+    MultiSplitterLayout *layout = m->multiSplitterLayout();
+    Item *item1 = layout->itemForFrame(dock1->frame());
+    Anchor *anchor = item1->anchorAtSide(Anchor::Side2, Qt::Vertical);
+    const QRect oldFrameGeo = dock1->frame()->geometry();
+    const QRect oldSeparatorGeo = anchor->separatorWidget()->geometry();
+
+    layout->beginTransaction();
+    QVERIFY(layout->isInTransaction());
+    anchor->setPosition(anchor->position() + 10);
+    anchor->setPosition(anchor->position() + 10);
+
+    // Only the model changed
+    QVERIFY(item1->geometry() != oldFrameGeo);
+    QCOMPARE(dock1->frame()->geometry(), oldFrameGeo);
+    QCOMPARE(anchor->separatorWidget()->geometry(), oldSeparatorGeo);
+
+    layout->commitTransaction();
+    QVERIFY(!layout->isInTransaction());
+    QCOMPARE(dock1->frame()->geometry(), item1->geometry());
+    QCOMPARE(anchor->separatorWidget()->geometry(), anchor->geometry());
+    for (Item *item : layout->items())
+        QCOMPARE(item->frame()->geometry(), item->geometry());
+    QVERIFY(layout->checkSanity());
+}
+
+// The previous propagateResize() implementation, which enumerated every path, minus the logging.
+// The DAG based one only differs in two ways:
+// - Anchors with the same shortest path length are moved in topological order instead of path order.
+// - An anchor contributes at most once. Here, one already at its bound is retried by the longer paths.
+static void legacyCollectPaths(QVector<Anchor::List> &paths, Anchor *fromAnchor, Anchor::Side direction)
+{
+    if (fromAnchor->isStatic())
+        return;
+
+    if (paths.isEmpty())
+        paths.push_back({});
+
+    const int currentPathIndex = paths.size() - 1;
+    paths[currentPathIndex].push_back(fromAnchor);
+
+    const ItemList items = fromAnchor->items(direction);
+    for (int i = 0, end = items.size(); i < end; ++i) {
+        Anchor *nextAnchor = items[i]->anchorAtSide(direction, fromAnchor->orientation());
+        if (i > 0) {
+            Anchor::List newPath = paths[currentPathIndex];
+            paths.push_back(newPath);
+        }
+        legacyCollectPaths(paths, nextAnchor, direction);
+    }
+}
+
+static Anchor::List legacyRemoveSmallestPath(QVector<Anchor::List> &paths)
+{
+    Anchor::List smallestPath;
+    int indexOfSmallest = 0;
+    for (int i = 0, end = paths.size(); i < end; ++i) {
+        const Anchor::List path = paths.at(i);
+        if (path.size() <= smallestPath.size() || smallestPath.isEmpty()) {
+            smallestPath = path;
+            indexOfSmallest = i;
+        }
+    }
+
+    paths.removeAt(indexOfSmallest);
+    return smallestPath;
+}
+
+void TestDocks::tst_propagateResize()
+{
+    EnsureTopLevelsDeleted e;
+
+    // It's a lambda as boundPositionForAnchor() is only accessible to TestDocks
+    auto legacyPropagateResize = [] (MultiSplitterLayout *layout, int delta, Anchor *fromAnchor, Anchor::Side direction) {
+        if (delta == 0 || fromAnchor->isStatic())
+            return;
+
+        QVector<Anchor::List> paths;
+        legacyCollectPaths(paths, fromAnchor, direction);
+
+        Anchor::List anchorsThatAlreadyContributed;
+        anchorsThatAlreadyContributed.push_back(fromAnchor);
+
+        while (!paths.isEmpty()) {
+            Anchor::List smallestPath = legacyRemoveSmallestPath(paths);
+            if (smallestPath.size() <= 1)
+                continue;
+
+            const bool towardsSide1 = direction == Anchor::Side1;
+            const bool towardsSide2 = !towardsSide1;
+            const int sign = towardsSide1 ? -1 : 1;
+            const int contributionPerAnchor = (delta / (smallestPath.size() - 1)) * sign;
+            if (qAbs(contributionPerAnchor) < 5)
+                continue;
+
+            for (int i = 1, end = smallestPath.size(); i < end; ++i) {
+                Anchor *a = smallestPath.at(i);
+                if (!anchorsThatAlreadyContributed.contains(a)) {
+                    const int bound = layout->boundPositionForAnchor(a, direction);
+                    int newPosition = a->position() + contributionPerAnchor;
+                    if ((towardsSide1 && newPosition < bound) ||
+                        (towardsSide2 && newPosition > bound)) {
+                        newPosition = bound;
+                    }
+
+                    if (a->position() != newPosition) {
+                        a->setPosition(newPosition);
+                        anchorsThatAlreadyContributed.push_back(a);
+                    }
+                }
+            }
+        }
+    };
+
+    auto createRow = [] (DockWidget::List &docks) {
+        auto m = createMainWindow(QSize(1000, 500), MainWindowOption_None);
+        for (int i = 0; i < 4; ++i) {
+            auto dock = createDockWidget(QStringLiteral("dock%1").arg(i), new QPushButton(QStringLiteral("%1").arg(i)));
+            m->addDockWidget(dock, Location_OnRight);
+            docks.push_back(dock);
+        }
+        return m;
+    };
+
+    DockWidget::List docks1;
+    DockWidget::List docks2;
+    auto m1 = createRow(docks1);
+    auto m2 = createRow(docks2);
+    MultiSplitterLayout *layout1 = m1->multiSplitterLayout();
+    MultiSplitterLayout *layout2 = m2->multiSplitterLayout();
+
+    const int delta = 60;
+    legacyPropagateResize(layout1, delta, layout1->itemForFrame(docks1.at(0)->frame())->anchorAtSide(Anchor::Side2, Qt::Vertical), Anchor::Side2);
+    layout2->propagateResize(delta, layout2->itemForFrame(docks2.at(0)->frame())->anchorAtSide(Anchor::Side2, Qt::Vertical), Anchor::Side2);
+
+    for (int i = 0; i < docks1.size(); ++i) {
+        Item *item1 = layout1->itemForFrame(docks1.at(i)->frame());
+        Item *item2 = layout2->itemForFrame(docks2.at(i)->frame());
+        QCOMPARE(item1->geometry(), item2->geometry());
+    }
+    QVERIFY(layout2->checkSanity());
+
+    // A grid, which used to explode the number of paths. The first column is split, so the
+    // paths going through an anchor have different lengths.
+    const int gridSize = 6;
+    auto createGrid = [] (QVector<DockWidget::List> &columns) {
+        auto m = createMainWindow(QSize(1500, 1500), MainWindowOption_None);
+        for (int column = 0; column < gridSize; ++column) {
+            DockWidget::List docks;
+            DockWidget *above = nullptr;
+            for (int row = 0; row < gridSize; ++row) {
+                auto dock = createDockWidget(QStringLiteral("%1-%2").arg(column).arg(row), Qt::green);
+                if (above)
+                    m->addDockWidget(dock, Location_OnBottom, above);
+                else
+                    m->addDockWidget(dock, Location_OnRight);
+                above = dock;
+                docks.push_back(dock);
+            }
+            columns.push_back(docks);
+        }
+
+        // Splits the first column, so the anchors right of it have more paths
+        m->addDockWidget(createDockWidget(QStringLiteral("split"), Qt::red), Location_OnRight, columns.at(0).at(2));
+        return m;
+    };
+
+    QVector<DockWidget::List> columns3;
+    QVector<DockWidget::List> columns4;
+    auto m3 = createGrid(columns3);
+    auto m4 = createGrid(columns4);
+    MultiSplitterLayout *layout3 = m3->multiSplitterLayout();
+    MultiSplitterLayout *layout4 = m4->multiSplitterLayout();
+
+    auto compareGrids = [&] {
+        for (int column = 0; column < gridSize; ++column) {
+            for (int row = 0; row < gridSize; ++row) {
+                Item *item3 = layout3->itemForFrame(columns3.at(column).at(row)->frame());
+                Item *item4 = layout4->itemForFrame(columns4.at(column).at(row)->frame());
+                if (item3->geometry() != item4->geometry()) {
+                    qWarning() << "Mismatch at" << column << row << item3->geometry() << item4->geometry();
+                    return false;
+                }
+            }
+        }
+        return true;
+    };
+
+    QVERIFY(compareGrids());
+    for (Anchor::Side direction : { Anchor::Side2, Anchor::Side1 }) {
+        for (Qt::Orientation orientation : { Qt::Vertical, Qt::Horizontal }) {
+            Item *item3 = layout3->itemForFrame(columns3.at(2).at(2)->frame());
+            Item *item4 = layout4->itemForFrame(columns4.at(2).at(2)->frame());
+            legacyPropagateResize(layout3, 50, item3->anchorAtSide(direction, orientation), direction);
+            layout4->propagateResize(50, item4->anchorAtSide(direction, orientation), direction);
+            QVERIFY(compareGrids());
+        }
+    }
+    QVERIFY(layout4->checkSanity());
+
+    m4->addDockWidget(createDockWidget(QStringLiteral("left"), Qt::red), Location_OnLeft);
+    m4->addDockWidget(createDockWidget(QStringLiteral("top"), Qt::red), Location_OnTop);
+    QVERIFY(layout4->checkSanity());
+}
+
+void TestDocks::tst_cumulativeMinLengthCache()
+{
+    EnsureTopLevelsDeleted e;
+    auto m = createMainWindow(QSize(800, 500), MainWindowOption_None);
+    auto dock1 = createDockWidget(QStringLiteral("dock1"), new QPushButton(QStringLiteral("one")));
+    auto dock2 = createDockWidget(QStringLiteral("dock2"), new QPushButton(QStringLiteral("two")));
+    m->addDockWidget(dock1, Location_OnLeft);
+    m->addDockWidget(dock2, Location_OnRight);
+    MultiSplitterLayout *layout = m->multiSplitterLayout();
+    Anchor *anchor = layout->itemForFrame(dock1->frame())->anchorAtSide(Anchor::Side2, Qt::Vertical);
+
+    // Querying, like when dragging a separator, doesn't invalidate
+    const quint64 generation = layout->cumulativeMinLengthGeneration();
+    const int minLength = anchor->cumulativeMinLength(Anchor::Side1);
+    layout->boundPositionsForAnchor(anchor);
+    QCOMPARE(anchor->cumulativeMinLength(Anchor::Side1), minLength);
+    QCOMPARE(layout->cumulativeMinLengthGeneration(), generation);
+
+    // Topology changes do
+    auto dock3 = createDockWidget(QStringLiteral("dock3"), new QPushButton(QStringLiteral("three")));
+    m->addDockWidget(dock3, Location_OnLeft);
+    QVERIFY(layout->cumulativeMinLengthGeneration() != generation);
+    QVERIFY(anchor->cumulativeMinLength(Anchor::Side1) > minLength);
+    const quint64 generationBeforeCheck = layout->cumulativeMinLengthGeneration();
+    QVERIFY(layout->checkSanity()); // Also compares every cached value against a fresh one
+    QCOMPARE(layout->cumulativeMinLengthGeneration(), generationBeforeCheck); // Without throwing the cache away
+    QHash<const Anchor*, int> memo;
+    QCOMPARE(anchor->freshCumulativeMinLength(Anchor::Side1, memo), anchor->cumulativeMinLength(Anchor::Side1));
+
+    // And so do placeholders, which have no min size
+    dock3->close();
+    QCOMPARE(anchor->cumulativeMinLength(Anchor::Side1), minLength);
+    QVERIFY(layout->checkSanity());
+}
+
+void TestDocks::tst_spatialIndex()
+{
+    {
+        // The grid itself
+        int a = 0, b = 0;
+        SpatialIndex<int> index(100);
+        auto acceptAll = [] (int *) { return true; };
+        index.update(&a, QRect(-50, -50, 300, 100));
+        index.update(&b, QRect(0, 60, 100, 100));
+        QCOMPARE(index.at(QPoint(-10, -10), acceptAll), &a);
+        QCOMPARE(index.at(QPoint(240, 40), acceptAll), &a);
+        QCOMPARE(index.at(QPoint(50, 100), acceptAll), &b);
+        QVERIFY(!index.at(QPoint(500, 500), acceptAll));
+
+        index.update(&a, QRect(400, 400, 200, 200));
+        QVERIFY(!index.at(QPoint(-10, -10), acceptAll));
+        QCOMPARE(index.at(QPoint(500, 500), acceptAll), &a);
+
+        index.remove(&b);
+        QVERIFY(!index.at(QPoint(50, 100), acceptAll));
+        QCOMPARE(index.count(), 1);
+    }
+
+    EnsureTopLevelsDeleted e;
+    auto m = createMainWindow(QSize(800, 500), MainWindowOption_None);
+    auto dock1 = createDockWidget(QStringLiteral("dock1"), new QPushButton(QStringLiteral("one")));
+    auto dock2 = createDockWidget(QStringLiteral("dock2"), new QPushButton(QStringLiteral("two")));
+    auto dock3 = createDockWidget(QStringLiteral("dock3"), new QPushButton(QStringLiteral("three")));
+    m->addDockWidget(dock1, Location_OnLeft);
+    m->addDockWidget(dock2, Location_OnRight);
+    m->addDockWidget(dock3, Location_OnBottom);
+    MultiSplitterLayout *layout = m->multiSplitterLayout();
+    DropArea *dropArea = m->dropArea();
+
+    auto checkHits = [layout, dropArea] {
+        for (Item *item : layout->items()) {
+            if (item->isPlaceholder())
+                continue;
+            const QRect geo = item->geometry();
+            for (QPoint p : { geo.center(), geo.topLeft(), geo.bottomRight() }) {
+                if (layout->itemAt(p) != item)
+                    return false;
+                if (dropArea->frameContainingPos(dropArea->mapToGlobal(p)) != item->frame())
+                    return false;
+            }
+        }
+        return true;
+    };
+
+    QVERIFY(checkHits());
+
+    // The index follows the anchors
+    Item *item1 = layout->itemForFrame(dock1->frame());
+    Anchor *anchor = item1->anchorAtSide(Anchor::Side2, Qt::Vertical);
+    anchor->setPosition(anchor->position() + 150);
+    QVERIFY(checkHits());
+    QVERIFY(!layout->itemAt(anchor->geometry().center()));
+
+    // And removals
+    dock2->close();
+    QVERIFY(checkHits());
+    QVERIFY(layout->checkSanity());
+}
+
+void TestDocks::tst_layoutIndices()
+{
+    EnsureTopLevelsDeleted e;
+    auto m = createMainWindow(); // Has a central frame
+    auto dock1 = createDockWidget(QStringLiteral("dock1"), new QPushButton(QStringLiteral("one")));
+    auto dock2 = createDockWidget(QStringLiteral("dock2"), new QPushButton(QStringLiteral("two")));
+    m->addDockWidget(dock1, Location_OnLeft);
+    m->addDockWidget(dock2, Location_OnBottom);
+    DropArea *dropArea = m->dropArea();
+    MultiSplitterLayout *layout = m->multiSplitterLayout();
+
+    Item *centralItem = dropArea->centralFrame();
+    QVERIFY(centralItem);
+    QVERIFY(centralItem->frame()->isCentralFrame());
+
+    auto checkIndices = [layout] {
+        for (Item *item : layout->items()) {
+            if (!layout->contains(item))
+                return false;
+            if (Frame *frame = item->frame()) {
+                if (layout->itemForFrame(frame) != item || !layout->contains(frame))
+                    return false;
+            }
+
+            for (Qt::Orientation o : { Qt::Vertical, Qt::Horizontal }) {
+                if (!item->anchorAtSide(Anchor::Side1, o)->containsItem(item, Anchor::Side2) ||
+                    !item->anchorAtSide(Anchor::Side2, o)->containsItem(item, Anchor::Side1))
+                    return false;
+            }
+        }
+        return true;
+    };
+
+    QVERIFY(checkIndices());
+
+    // Placeholders have no frame, until restored
+    Item *item1 = layout->itemForFrame(dock1->frame());
+    Frame *oldFrame = dock1->frame();
+    dock1->close();
+    QVERIFY(item1->isPlaceholder());
+    QVERIFY(!layout->itemForFrame(oldFrame));
+    QVERIFY(layout->contains(item1));
+    QVERIFY(checkIndices());
+
+    dock1->morphIntoFloatingWindow();
+    dock1->setFloating(false); // Restores the placeholder
+    QCOMPARE(layout->itemForFrame(dock1->frame()), item1);
+    QVERIFY(checkIndices());
+
+    // Removal
+    QPointer<Item> item2 = layout->itemForFrame(dock2->frame());
+    QPointer<Frame> frame2 = dock2->frame();
+    delete dock2;
+    QVERIFY(waitForDeleted(frame2));
+    QVERIFY(!item2 || !layout->contains(item2.data()));
+    QVERIFY(!layout->itemForFrame(frame2.data()));
+    QVERIFY(checkIndices());
+    QCOMPARE(dropArea->centralFrame(), centralItem);
+    QVERIFY(layout->checkSanity());
+}
+
+static std::unique_ptr<MainWindow> createGridMainWindow(int gridSize, QSize windowSize)
+{
+    // gridSize columns, each one with gridSize docks stacked vertically
+    auto m = createMainWindow(windowSize, MainWindowOption_None);
+    for (int column = 0; column < gridSize; ++column) {
+        DockWidget *above = nullptr;
+        for (int row = 0; row < gridSize; ++row) {
+            auto dock = createDockWidget(QStringLiteral("%1-%2").arg(column).arg(row), Qt::green);
+            if (above)
+                m->addDockWidget(dock, Location_OnBottom, above);
+            else
+                m->addDockWidget(dock, Location_OnRight);
+            above = dock;
+        }
+    }
+
+    return m;
+}
+
+void TestDocks::tst_redistributeSpace()
+{
+    EnsureTopLevelsDeleted e;
+    auto m = createGridMainWindow(4, QSize(1000, 1000));
+    MultiSplitterLayout *layout = m->multiSplitterLayout();
+
+    QHash<Anchor*, qreal> percentages;
+    for (Anchor *anchor : layout->anchors())
+        percentages.insert(anchor, anchor->positionPercentage());
+
+    // Each anchor is positioned once, so each item is resized once, and not once per anchor it touches
+    QHash<Item*, int> geometryChanges;
+    QObject counterContext; // Destroyed before geometryChanges
+    for (Item *item : layout->items()) {
+        connect(item, &Item::geometryChanged, &counterContext, [item, &geometryChanges] {
+            ++geometryChanges[item];
+        });
+    }
+
+    // Shrink and grow back, proportions are kept
+    const QSize originalSize = layout->contentsSize();
+    layout->setContentsSize(originalSize - QSize(100, 100));
+    QCOMPARE(geometryChanges.size(), layout->items().size());
+    for (int count : qAsConst(geometryChanges))
+        QCOMPARE(count, 1);
+
+    QVERIFY(layout->checkSanity());
+    layout->setContentsSize(originalSize);
+    QVERIFY(layout->checkSanity());
+
+    for (Anchor *anchor : layout->anchors()) {
+        if (!anchor->isStatic() && !anchor->isFollowing())
+            QCOMPARE(anchor->positionPercentage(), percentages.value(anchor));
+    }
+
+    // The engine agrees with the layout
+    LayoutEngineAdapter adapter(layout);
+    const QSize newSize = originalSize + QSize(300, 100);
+    adapter.engine().resize(newSize);
+    layout->setContentsSize(newSize);
+    for (Anchor *anchor : layout->anchors())
+        QCOMPARE(adapter.engine().anchor(adapter.indexOf(anchor)).position, anchor->position());
+}
+
+void TestDocks::tst_redistributeSpaceBenchmark_data()
+{
+    QTest::addColumn<int>("gridSize");
+    QTest::newRow("2x2") << 2;
+    QTest::newRow("4x4") << 4;
+    QTest::newRow("8x8") << 8;
+}
+
+void TestDocks::tst_redistributeSpaceBenchmark()
+{
+    // Resize cost should grow linearly with the number of anchors
+    QFETCH(int, gridSize);
+    EnsureTopLevelsDeleted e;
+    auto m = createGridMainWindow(gridSize, QSize(1600, 1600));
+    MultiSplitterLayout *layout = m->multiSplitterLayout();
+    const QSize size1 = layout->contentsSize();
+    const QSize size2 = size1 + QSize(100, 100);
+
+    bool grow = true;
+    QBENCHMARK {
+        layout->setContentsSize(grow ? size2 : size1);
+        grow = !grow;
+    }
+
+    QVERIFY(layout->checkSanity());
+}
+
+void TestDocks::tst_incrementalFollowers()
+{
+    EnsureTopLevelsDeleted e;
+    auto m = createMainWindow(QSize(800, 500), MainWindowOption_None);
+    auto dock1 = createDockWidget(QStringLiteral("dock1"), new QPushButton(QStringLiteral("one")));
+    auto dock2 = createDockWidget(QStringLiteral("dock2"), new QPushButton(QStringLiteral("two")));
+    auto dock3 = createDockWidget(QStringLiteral("dock3"), new QPushButton(QStringLiteral("three")));
+    auto dock4 = createDockWidget(QStringLiteral("dock4"), new QPushButton(QStringLiteral("four")));
+    m->addDockWidget(dock1, Location_OnLeft);
+    m->addDockWidget(dock2, Location_OnRight);
+    m->addDockWidget(dock3, Location_OnRight);
+    m->addDockWidget(dock4, Location_OnBottom);
+    MultiSplitterLayout *layout = m->multiSplitterLayout();
+
+    dock2->close();
+    QVERIFY(layout->checkSanity());
+    const Anchor::List verticalFollowers = [layout] {
+        Anchor::List result;
+        for (Anchor *anchor : layout->anchors(Qt::Vertical)) {
+            if (anchor->isFollowing())
+                result.push_back(anchor);
+        }
+        return result;
+    }();
+    QVERIFY(!verticalFollowers.isEmpty());
+
+    // Toggling an unrelated dock doesn't touch the existing followers
+    QVector<QSharedPointer<QSignalSpy>> spies;
+    for (Anchor *anchor : verticalFollowers)
+        spies.push_back(QSharedPointer<QSignalSpy>(new QSignalSpy(anchor, &Anchor::followeeChanged)));
+
+    Item *item4 = layout->itemForFrame(dock4->frame());
+    Anchor *anchorAbove4 = item4->anchorAtSide(Anchor::Side1, Qt::Horizontal);
+    dock4->close();
+    QVERIFY(anchorAbove4->isFollowing());
+    QVERIFY(layout->checkSanity());
+
+    for (const QSharedPointer<QSignalSpy> &spy : qAsConst(spies))
+        QCOMPARE(spy->count(), 0);
+    for (Anchor *anchor : verticalFollowers) {
+        QVERIFY(anchor->isFollowing());
+        QCOMPARE(anchor->position(), anchor->followee()->position());
+    }
+
+    // The mapping is the same as a full recompute
+    const QHash<Anchor*, Anchor*> expected = layout->anchorsShouldFollow();
+    for (Anchor *anchor : layout->anchors())
+        QCOMPARE(anchor->followee(), expected.value(anchor));
+
+    // Only the anchors reachable through placeholders were looked at
+    const Anchor::List affected = layout->anchorsAffectedBy(item4->anchorGroup().anchors());
+    QVERIFY(affected.contains(anchorAbove4));
+    for (Anchor *anchor : verticalFollowers)
+        QVERIFY(!affected.contains(anchor));
+
+    // Restoring a placeholder unfollows its own anchors, and the anchors they'll follow, while the
+    // anchors following them keep following and move along. The result is the same as a full recompute.
+    auto m2 = createMainWindow(QSize(800, 500), MainWindowOption_None);
+    auto dock5 = createDockWidget(QStringLiteral("dock5"), new QPushButton(QStringLiteral("five")));
+    auto dock6 = createDockWidget(QStringLiteral("dock6"), new QPushButton(QStringLiteral("six")));
+    auto dock7 = createDockWidget(QStringLiteral("dock7"), new QPushButton(QStringLiteral("seven")));
+    auto dock8 = createDockWidget(QStringLiteral("dock8"), new QPushButton(QStringLiteral("eight")));
+    m2->addDockWidget(dock5, Location_OnLeft);
+    m2->addDockWidget(dock6, Location_OnRight);
+    m2->addDockWidget(dock7, Location_OnRight);
+    m2->addDockWidget(dock8, Location_OnRight);
+    MultiSplitterLayout *layout2 = m2->multiSplitterLayout();
+    Item *item6 = layout2->itemForFrame(dock6->frame());
+    Item *item7 = layout2->itemForFrame(dock7->frame());
+    Anchor *anchorLeftOf6 = item6->anchorAtSide(Anchor::Side1, Qt::Vertical);
+    Anchor *anchorBetween6And7 = item6->anchorAtSide(Anchor::Side2, Qt::Vertical);
+
+    dock6->close();
+    dock7->close();
+    QVERIFY(layout2->checkSanity());
+    QVERIFY(anchorBetween6And7->isFollowing());
+
+    dock7->show();
+    QVERIFY(!item7->isPlaceholder());
+    QVERIFY(layout2->checkSanity());
+    // dock6 is still a placeholder, so one of its anchors follows the other
+    QVERIFY(anchorBetween6And7->followee() == anchorLeftOf6 || anchorLeftOf6->followee() == anchorBetween6And7);
+
+    const QHash<Anchor*, Anchor*> expected2 = layout2->anchorsShouldFollow();
+    for (Anchor *anchor : layout2->anchors()) {
+        QCOMPARE(anchor->followee(), expected2.value(anchor));
+        if (anchor->isFollowing())
+            QCOMPARE(anchor->position(), anchor->followee()->position());
+    }
+
+    dock6->show();
+    QVERIFY(layout2->checkSanity());
+    for (Anchor *anchor : layout2->anchors())
+        QVERIFY(!anchor->isFollowing());
+}
+
+void TestDocks::tst_followerPropagation()
+{
+    EnsureTopLevelsDeleted e;
+    auto m = createMainWindow(QSize(1000, 500), MainWindowOption_None);
+    auto dock1 = createDockWidget(QStringLiteral("dock1"), new QPushButton(QStringLiteral("one")));
+    auto dock2 = createDockWidget(QStringLiteral("dock2"), new QPushButton(QStringLiteral("two")));
+    auto dock3 = createDockWidget(QStringLiteral("dock3"), new QPushButton(QStringLiteral("three")));
+    auto dock4 = createDockWidget(QStringLiteral("dock4"), new QPushButton(QStringLiteral("four")));
+    auto dock5 = createDockWidget(QStringLiteral("dock5"), new QPushButton(QStringLiteral("five")));
+    m->addDockWidget(dock1, Location_OnLeft);
+    m->addDockWidget(dock2, Location_OnRight);
+    m->addDockWidget(dock3, Location_OnRight);
+    m->addDockWidget(dock4, Location_OnRight);
+    m->addDockWidget(dock5, Location_OnRight);
+    MultiSplitterLayout *layout = m->multiSplitterLayout();
+
+    // Three placeholders in a row, so the anchors between them form a chain of followers
+    dock2->close();
+    dock3->close();
+    dock4->close();
+    QVERIFY(layout->checkSanity());
+
+    Anchor *chainEnd = nullptr;
+    for (Anchor *anchor : layout->anchors(Qt::Vertical)) {
+        if (anchor->followee() && anchor->followee()->isFollowing()) {
+            chainEnd = anchor->endFollowee();
+            break;
+        }
+    }
+    QVERIFY(chainEnd);
+    QVERIFY(!chainEnd->isStatic());
+
+    // followers() is the reverse of followee()
+    for (Anchor *anchor : layout->anchors()) {
+        for (Anchor *follower : anchor->followers())
+            QCOMPARE(follower->followee(), anchor);
+        if (Anchor *followee = anchor->followee())
+            QVERIFY(followee->followers().contains(anchor));
+    }
+
+    // Moving the end of the chain moves every follower, directly or not
+    const int newPosition = chainEnd->position() - 20;
+    chainEnd->setPosition(newPosition);
+    QCOMPARE(chainEnd->position(), newPosition);
+    int numFollowers = 0;
+    for (Anchor *anchor : layout->anchors(Qt::Vertical)) {
+        if (anchor != chainEnd && anchor->endFollowee() == chainEnd) {
+            QCOMPARE(anchor->position(), newPosition);
+            numFollowers++;
+        }
+    }
+    QVERIFY(numFollowers >= 2);
+    QVERIFY(layout->checkSanity());
+
+    // Deleting a follower's followee doesn't leave dangling entries behind
+    dock5->close();
+    QVERIFY(layout->checkSanity());
+    for (Anchor *anchor : layout->anchors()) {
+        for (Anchor *follower : anchor->followers())
+            QCOMPARE(follower->followee(), anchor);
+    }
+}
+
+void TestDocks::tst_tieredSanityCheck()
+{
+    EnsureTopLevelsDeleted e;
+    auto m = createMainWindow(QSize(800, 500), MainWindowOption_None);
+    auto dock1 = createDockWidget(QStringLiteral("dock1"), new QPushButton(QStringLiteral("one")));
+    auto dock2 = createDockWidget(QStringLiteral("dock2"), new QPushButton(QStringLiteral("two")));
+    auto dock3 = createDockWidget(QStringLiteral("dock3"), new QPushButton(QStringLiteral("three")));
+    m->addDockWidget(dock1, Location_OnLeft);
+    m->addDockWidget(dock2, Location_OnRight);
+    MultiSplitterLayout *layout = m->multiSplitterLayout();
+
+    // Tracking is only on by default in developer builds. Once enabled, everything is to be verified.
+    layout->setTouchTrackingEnabled(false);
+    layout->markTouched(layout->itemForFrame(dock1->frame()));
+    QVERIFY(layout->m_touchedItems.isEmpty());
+    layout->setTouchTrackingEnabled(true);
+    QCOMPARE(layout->m_touchedItems.size(), layout->items().size());
+    QCOMPARE(layout->m_touchedAnchors.size(), layout->anchors().size());
+
+    // A full check verifies everything, so nothing is left to verify incrementally
+    QVERIFY(layout->checkSanity());
+    QVERIFY(layout->m_touchedAnchors.isEmpty());
+    QVERIFY(layout->m_touchedItems.isEmpty());
+
+    // Only what the mutation changed is tracked
+    m->addDockWidget(dock3, Location_OnBottom);
+    Item *item3 = layout->itemForFrame(dock3->frame());
+    QVERIFY(layout->m_touchedItems.contains(item3));
+    QVERIFY(layout->m_touchedAnchors.contains(item3->anchorGroup().top));
+    QVERIFY(layout->checkSanityOfTouched());
+    QVERIFY(layout->m_touchedAnchors.isEmpty());
+    QVERIFY(layout->m_touchedItems.isEmpty());
+
+    // Corruption in a touched anchor is caught without looking at the whole layout
+    Anchor *intruder = item3->anchorGroup().top;
+    QVERIFY(intruder->containsItem(item3, Anchor::Side2));
+    intruder->m_side1Items.push_back(item3);
+    intruder->m_side1ItemSet.insert(item3);
+    layout->markTouched(intruder);
+    {
+        SetExpectedWarning sew(QStringLiteral("MultiSplitterLayout::checkSanityOfTouched"));
+        QVERIFY(!layout->checkSanityOfTouched());
+    }
+    intruder->m_side1Items.removeOne(item3);
+    intruder->m_side1ItemSet.remove(item3);
+    QVERIFY(layout->checkSanityOfTouched());
+
+    // verifySanity() does a full check every fullSanityCheckInterval() calls
+    layout->setFullSanityCheckInterval(2);
+    QCOMPARE(layout->fullSanityCheckInterval(), 2);
+    for (int i = 0; i < 4; ++i)
+        QVERIFY(layout->verifySanity());
+    QVERIFY(layout->checkSanity());
+}
+
+void TestDocks::tst_layoutSaverFormat()
+{
+    EnsureTopLevelsDeleted e;
+    QByteArray compact;
+    QByteArray legacy;
+    int numAnchors = 0;
+    {
+        auto m = createMainWindow();
+        auto dock1 = createDockWidget(QStringLiteral("dock1"), new QPushButton(QStringLiteral("one")));
+        auto dock2 = createDockWidget(QStringLiteral("dock2"), new QPushButton(QStringLiteral("two")));
+        auto dock3 = createDockWidget(QStringLiteral("dock3"), new QPushButton(QStringLiteral("three")));
+        m->addDockWidget(dock1, Location_OnLeft);
+        m->addDockWidget(dock2, Location_OnRight);
+        dock2->addDockWidgetAsTab(dock3);
+        numAnchors = m->multiSplitterLayout()->anchors().size();
+
+        LayoutSaver saver;
+        compact = saver.serializeLayout();
+        legacy = saver.serializeLayout_legacy();
+    }
+
+    QVERIFY(compact.startsWith("KDDL"));
+    QVERIFY(compact.size() * 4 < legacy.size());
+
+    // Both formats restore the same layout
+    for (const QByteArray &data : { legacy, compact }) {
+        auto m = createMainWindow();
+        auto dock1 = createDockWidget(QStringLiteral("dock1"), new QPushButton(QStringLiteral("one")));
+        auto dock2 = createDockWidget(QStringLiteral("dock2"), new QPushButton(QStringLiteral("two")));
+        auto dock3 = createDockWidget(QStringLiteral("dock3"), new QPushButton(QStringLiteral("three")));
+
+        LayoutSaver saver;
+        saver.restoreLayout(data);
+        QVERIFY(m->dropArea()->checkSanity());
+        QCOMPARE(m->multiSplitterLayout()->anchors().size(), numAnchors);
+        QVERIFY(!dock1->isFloating());
+        QVERIFY(!dock2->isFloating());
+        QCOMPARE(dock2->frame(), dock3->frame());
+        QVERIFY(dock1->frame() != dock2->frame());
+    }
+
+    // A truncated stream is rejected before anything is closed
+    {
+        auto m = createMainWindow();
+        auto dock1 = createDockWidget(QStringLiteral("dock1"), new QPushButton(QStringLiteral("one")));
+        m->addDockWidget(dock1, Location_OnLeft);
+
+        SetExpectedWarning sew(QStringLiteral("Layout data is corrupted"));
+        LayoutSaver saver;
+        saver.restoreLayout(compact.left(compact.size() - 3));
+        QVERIFY(dock1->isVisible());
+        QVERIFY(m->dropArea()->checkSanity());
+    }
+
+    // So are unknown anchor types and orientations, several static flags, and a static anchor with
+    // the wrong orientation. The top anchor is written first: Type_TopStatic, Qt::Horizontal,
+    // position 0, from the left anchor (2) and to the right one (3), zigzag encoded.
+    const int topAnchorOffset = compact.indexOf(QByteArray::fromHex("0401000406"));
+    QVERIFY(topAnchorOffset != -1);
+    for (const char *hex : { "05", "10", "0403", "0402" }) {
+        QByteArray corrupted = compact;
+        const QByteArray replacement = QByteArray::fromHex(hex);
+        corrupted.replace(topAnchorOffset, replacement.size(), replacement);
+        QVERIFY(!LayoutReport::fromData(corrupted).isValid());
+
+        auto m = createMainWindow();
+        auto dock1 = createDockWidget(QStringLiteral("dock1"), new QPushButton(QStringLiteral("one")));
+        m->addDockWidget(dock1, Location_OnLeft);
+
+        SetExpectedWarning sew(QStringLiteral("Layout data is corrupted"));
+        LayoutSaver saver;
+        saver.restoreLayout(corrupted);
+        QVERIFY(dock1->isVisible());
+        QVERIFY(m->dropArea()->checkSanity());
+    }
+}
+
+void TestDocks::tst_layoutFile()
+{
+    EnsureTopLevelsDeleted e;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.filePath(QStringLiteral("layout.bin"));
+    {
+        auto m = createMainWindow();
+        auto dock1 = createDockWidget(QStringLiteral("dock1"), new QPushButton(QStringLiteral("one")));
+        auto dock2 = createDockWidget(QStringLiteral("dock2"), new QPushButton(QStringLiteral("two")));
+        m->addDockWidget(dock1, Location_OnLeft);
+        m->addDockWidget(dock2, Location_OnBottom);
+
+        LayoutSaver saver;
+        QVERIFY(saver.saveToFile(fileName));
+
+        QFile file(fileName);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        QCOMPARE(file.readAll(), saver.serializeLayout());
+    }
+
+    // A failed save reports it and doesn't leave anything behind
+    {
+        LayoutSaver saver;
+        SetExpectedWarning sew(QStringLiteral("Failed to open"));
+        QVERIFY(!saver.saveToFile(dir.filePath(QStringLiteral("missing/layout.bin"))));
+        QVERIFY(!QFile::exists(dir.filePath(QStringLiteral("missing/layout.bin"))));
+    }
+
+    {
+        auto m = createMainWindow();
+        auto dock1 = createDockWidget(QStringLiteral("dock1"), new QPushButton(QStringLiteral("one")));
+        auto dock2 = createDockWidget(QStringLiteral("dock2"), new QPushButton(QStringLiteral("two")));
+        LayoutSaver saver;
+        QVERIFY(saver.restoreFromFile(fileName));
+        QVERIFY(m->dropArea()->checkSanity());
+        QVERIFY(!dock1->isFloating());
+        QVERIFY(!dock2->isFloating());
+    }
+
+    {
+        // Restoring from a device, instead of a file name
+        auto m = createMainWindow();
+        auto dock1 = createDockWidget(QStringLiteral("dock1"), new QPushButton(QStringLiteral("one")));
+        auto dock2 = createDockWidget(QStringLiteral("dock2"), new QPushButton(QStringLiteral("two")));
+        QFile file(fileName);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        LayoutSaver saver;
+        QVERIFY(saver.restoreLayout(&file));
+        QVERIFY(m->dropArea()->checkSanity());
+        QVERIFY(!dock1->isFloating());
+        QVERIFY(!dock2->isFloating());
+    }
+}
+
+void TestDocks::tst_bulkRestore()
+{
+    EnsureTopLevelsDeleted e;
+    QHash<QString, QRect> geometries;
+    QByteArray saved;
+    int numAnchors = 0;
+    {
+        auto m = createGridMainWindow(3, QSize(900, 900));
+        for (DockWidget *dock : DockRegistry::self()->dockwidgets())
+            geometries.insert(dock->name(), dock->frame()->geometry());
+        numAnchors = m->multiSplitterLayout()->anchors().size();
+
+        LayoutSaver saver;
+        saved = saver.serializeLayout();
+    }
+
+    auto m = createMainWindow(QSize(900, 900), MainWindowOption_None);
+    for (auto it = geometries.cbegin(), end = geometries.cend(); it != end; ++it)
+        createDockWidget(it.key(), Qt::green);
+
+    // Any out of bounds position or squeezed item would warn, and warnings are fatal
+    LayoutSaver saver;
+    QVERIFY(saver.restoreLayout(saved));
+    MultiSplitterLayout *layout = m->multiSplitterLayout();
+    QVERIFY(!layout->isInTransaction());
+    QVERIFY(layout->checkSanity());
+    QCOMPARE(layout->anchors().size(), numAnchors);
+
+    for (DockWidget *dock : DockRegistry::self()->dockwidgets()) {
+        QVERIFY(!dock->isFloating());
+        QCOMPARE(dock->frame()->geometry(), geometries.value(dock->name()));
+    }
+}
+
+void TestDocks::tst_diffRestore()
+{
+    EnsureTopLevelsDeleted e;
+    auto m = createGridMainWindow(2, QSize(800, 800));
+    MultiSplitterLayout *layout = m->multiSplitterLayout();
+
+    QHash<QString, QRect> geometries;
+    QHash<QString, QPointer<Frame>> frames;
+    for (DockWidget *dock : DockRegistry::self()->dockwidgets()) {
+        geometries.insert(dock->name(), dock->frame()->geometry());
+        frames.insert(dock->name(), dock->frame());
+    }
+
+    LayoutSaver saver;
+    const QByteArray saved = saver.serializeLayout();
+    const Anchor::List anchors = layout->anchors();
+
+    Anchor *separator = nullptr;
+    for (Anchor *anchor : anchors) {
+        if (!anchor->isStatic() && anchor->isVertical())
+            separator = anchor;
+    }
+    QVERIFY(separator);
+    const int oldPosition = separator->position();
+    separator->setPosition(oldPosition + 20);
+
+    // Same structure, only the separator moved: Frames and Anchors are reused
+    QVERIFY(saver.restoreLayout(saved));
+    QVERIFY(layout->checkSanity());
+    QCOMPARE(layout->anchors(), anchors);
+    QCOMPARE(separator->position(), oldPosition);
+    for (DockWidget *dock : DockRegistry::self()->dockwidgets()) {
+        QVERIFY(!dock->isFloating());
+        QCOMPARE(dock->frame(), frames.value(dock->name()).data());
+        QCOMPARE(dock->frame()->geometry(), geometries.value(dock->name()));
+    }
+
+    // Different structure: the layout is rebuilt, but Frames holding the same dock widgets are kept
+    auto extra = createDockWidget(QStringLiteral("extra"), Qt::blue);
+    m->addDockWidget(extra, Location_OnBottom);
+    QPointer<Frame> extraFrame = extra->frame();
+    QVERIFY(saver.restoreLayout(saved));
+    QVERIFY(layout->checkSanity());
+    QVERIFY(!extra->isVisible());
+    QVERIFY(!extra->frame());
+    QTRY_VERIFY(!extraFrame);
+    QCOMPARE(layout->visibleCount(), frames.size());
+    for (auto it = frames.cbegin(), end = frames.cend(); it != end; ++it) {
+        DockWidget *dock = DockRegistry::self()->dockByName(it.key());
+        QCOMPARE(dock->frame(), it.value().data());
+        QCOMPARE(dock->frame()->geometry(), geometries.value(it.key()));
+    }
+
+    delete extra;
+}
+
+void TestDocks::tst_perspectives()
+{
+    EnsureTopLevelsDeleted e;
+    auto m = createMainWindow(QSize(800, 500), MainWindowOption_None);
+    auto dock1 = createDockWidget(QStringLiteral("dock1"), Qt::green);
+    auto dock2 = createDockWidget(QStringLiteral("dock2"), Qt::red);
+    m->addDockWidget(dock1, Location_OnLeft);
+    m->addDockWidget(dock2, Location_OnRight);
+
+    MultiSplitterLayout *layout = m->multiSplitterLayout();
+    Anchor *separator = layout->itemForFrame(dock1->frame())->anchorGroup().right;
+    QVERIFY(!separator->isStatic());
+    QPointer<Frame> frame1 = dock1->frame();
+    QPointer<Frame> frame2 = dock2->frame();
+    const int position = separator->position();
+
+    PerspectiveManager manager;
+    manager.savePerspective(QStringLiteral("edit"));
+    separator->setPosition(position + 50);
+    manager.savePerspective(QStringLiteral("debug"));
+    QCOMPARE(manager.perspectives(), QStringList({ QStringLiteral("debug"), QStringLiteral("edit") }));
+    QCOMPARE(manager.currentPerspective(), QStringLiteral("debug"));
+
+    // Same structure, so switching only moves the separator
+    QVERIFY(manager.switchToPerspective(QStringLiteral("edit")));
+    QCOMPARE(manager.currentPerspective(), QStringLiteral("edit"));
+    QCOMPARE(separator->position(), position);
+    QCOMPARE(dock1->frame(), frame1.data());
+    QCOMPARE(dock2->frame(), frame2.data());
+    QVERIFY(layout->checkSanity());
+
+    QVERIFY(manager.switchToPerspective(QStringLiteral("debug")));
+    QCOMPARE(separator->position(), position + 50);
+    QCOMPARE(dock1->frame(), frame1.data());
+
+    QVERIFY(!manager.switchToPerspective(QStringLiteral("review")));
+    QCOMPARE(manager.currentPerspective(), QStringLiteral("debug"));
+
+    // Perspectives round-trip through their serialized form
+    const QByteArray serialized = manager.serializePerspective(QStringLiteral("edit"));
+    QVERIFY(!serialized.isEmpty());
+    QVERIFY(manager.serializePerspective(QStringLiteral("review")).isEmpty());
+    QVERIFY(manager.addPerspective(QStringLiteral("review"), serialized));
+    QVERIFY(manager.switchToPerspective(QStringLiteral("review")));
+    QCOMPARE(separator->position(), position);
+
+    manager.removePerspective(QStringLiteral("review"));
+    QVERIFY(!manager.containsPerspective(QStringLiteral("review")));
+    QVERIFY(manager.currentPerspective().isEmpty());
+
+    // Different structures: Frames are kept even while the current perspective doesn't need them
+    auto dock3 = createDockWidget(QStringLiteral("dock3"), Qt::blue);
+    m->addDockWidget(dock3, Location_OnBottom);
+    QPointer<Frame> frame3 = dock3->frame();
+    manager.savePerspective(QStringLiteral("review"));
+
+    QVERIFY(manager.switchToPerspective(QStringLiteral("edit")));
+    QVERIFY(layout->checkSanity());
+    QVERIFY(!dock3->isVisible());
+    QVERIFY(!dock3->frame());
+    QVERIFY(frame3);
+    QCOMPARE(dock1->frame(), frame1.data());
+    QCOMPARE(dock2->frame(), frame2.data());
+
+    QVERIFY(manager.switchToPerspective(QStringLiteral("review")));
+    QVERIFY(layout->checkSanity());
+    QVERIFY(dock3->isVisible());
+    QCOMPARE(dock3->frame(), frame3.data());
+    QCOMPARE(dock1->frame(), frame1.data());
+    QCOMPARE(dock2->frame(), frame2.data());
+
+    // Pooled Frames aren't top-levels
+    QVERIFY(manager.switchToPerspective(QStringLiteral("edit")));
+    QVERIFY(frame3);
+    QVERIFY(!frame3->isWindow());
+    QVERIFY(!qApp->topLevelWidgets().contains(frame3));
+    QVERIFY(manager.switchToPerspective(QStringLiteral("review")));
+    QCOMPARE(dock3->frame(), frame3.data());
+
+    // FloatingWindows which are rebuilt are pooled too, hidden and unregistered
+    auto dock4 = createDockWidget(QStringLiteral("dock4"), Qt::yellow);
+    auto dock5 = createDockWidget(QStringLiteral("dock5"), Qt::cyan);
+    QPointer<FloatingWindow> fw = dock4->morphIntoFloatingWindow();
+    nestDockWidget(dock5, fw->dropArea(), nullptr, Location_OnRight);
+    QPointer<Frame> frame4 = dock4->frame();
+    manager.savePerspective(QStringLiteral("floating"));
+
+    QVERIFY(manager.switchToPerspective(QStringLiteral("review")));
+    QVERIFY(!waitForDeleted(fw, 200));
+    QVERIFY(!fw->isVisible());
+    QVERIFY(!DockRegistry::self()->nestedwindows().contains(fw));
+    QVERIFY(!dock4->isVisible());
+    QVERIFY(frame4);
+    QVERIFY(!frame4->isWindow());
+
+    QVERIFY(manager.switchToPerspective(QStringLiteral("floating")));
+    QVERIFY(fw->isVisible());
+    QVERIFY(DockRegistry::self()->nestedwindows().contains(fw));
+    QCOMPARE(dock4->window(), static_cast<QWidget*>(fw.data()));
+    QCOMPARE(dock5->window(), static_cast<QWidget*>(fw.data()));
+    QCOMPARE(dock4->frame(), frame4.data());
+    QVERIFY(fw->dropArea()->checkSanity());
+    delete fw;
+}
+
+void TestDocks::tst_autoSave()
+{
+    EnsureTopLevelsDeleted e;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.filePath(QStringLiteral("layout.bin"));
+    auto readFile = [fileName] {
+        QFile file(fileName);
+        return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+    };
+
+    auto m = createMainWindow(QSize(800, 500), MainWindowOption_None);
+    auto dock1 = createDockWidget(QStringLiteral("dock1"), Qt::green);
+    auto dock2 = createDockWidget(QStringLiteral("dock2"), Qt::red);
+    m->addDockWidget(dock1, Location_OnLeft);
+    m->addDockWidget(dock2, Location_OnRight);
+    LayoutSaver saver;
+
+    {
+        LayoutAutoSaver autoSaver(fileName);
+        QCOMPARE(autoSaver.fileName(), fileName);
+        autoSaver.setDelay(10000);
+
+        // A burst of changes is saved once, and only after the delay or on flush
+        autoSaver.scheduleSave();
+        autoSaver.scheduleSave();
+        QVERIFY(autoSaver.isSavePending());
+        QVERIFY(!QFile::exists(fileName));
+        autoSaver.flush();
+        QVERIFY(!autoSaver.isSavePending());
+        QCOMPARE(readFile(), saver.serializeLayout());
+
+        Anchor *separator = m->multiSplitterLayout()->itemForFrame(dock1->frame())->anchorGroup().right;
+        separator->setPosition(separator->position() + 50);
+        autoSaver.setDelay(10);
+        autoSaver.scheduleSave();
+        QTRY_COMPARE(readFile(), saver.serializeLayout());
+
+        // Destroying the autosaver flushes what's pending
+        separator->setPosition(separator->position() - 20);
+        autoSaver.setDelay(10000);
+        autoSaver.scheduleSave();
+    }
+
+    QCOMPARE(readFile(), saver.serializeLayout());
+}
+
+void TestDocks::tst_layoutJournal()
+{
+    EnsureTopLevelsDeleted e;
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.filePath(QStringLiteral("layout.bin"));
+    auto readFile = [] (const QString &name) {
+        QFile file(name);
+        return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+    };
+
+    QHash<QString, QRect> geometries;
+    {
+        auto m = createMainWindow(QSize(800, 500), MainWindowOption_None);
+        auto dock1 = createDockWidget(QStringLiteral("dock1"), Qt::green);
+        auto dock2 = createDockWidget(QStringLiteral("dock2"), Qt::red);
+        auto dock3 = createDockWidget(QStringLiteral("dock3"), Qt::blue);
+        m->addDockWidget(dock1, Location_OnLeft);
+        m->addDockWidget(dock2, Location_OnRight);
+        m->addDockWidget(dock3, Location_OnBottom);
+
+        LayoutJournal journal(fileName);
+        QVERIFY(journal.record()); // No snapshot yet, so it compacts
+        QCOMPARE(journal.journalSize(), 0);
+        const QByteArray snapshot = readFile(fileName);
+        QVERIFY(!snapshot.isEmpty());
+        const int headerSize = readFile(journal.journalFileName()).size();
+
+        // Moving a separator appends a single small record, the snapshot isn't touched. Moving it
+        // again before record() replaces the queued record.
+        Anchor *separator = m->multiSplitterLayout()->itemForFrame(dock1->frame())->anchorGroup().right;
+        separator->setPosition(separator->position() + 30);
+        separator->setPosition(separator->position() + 20);
+        QVERIFY(journal.record());
+        QCOMPARE(journal.journalSize(), 1);
+        QCOMPARE(readFile(fileName), snapshot);
+        QVERIFY(readFile(journal.journalFileName()).size() - headerSize < snapshot.size());
+
+        QVERIFY(journal.record());
+        QCOMPARE(journal.journalSize(), 1);
+
+        // A structural change rewrites only that window's anchors
+        QPointer<Frame> frame3 = dock3->frame();
+        dock1->addDockWidgetAsTab(dock3);
+        dock1->frame()->setCurrentTabIndex(0);
+        QVERIFY(waitForDeleted(frame3));
+        QVERIFY(journal.record());
+        QCOMPARE(journal.journalSize(), 2);
+        QCOMPARE(readFile(fileName), snapshot);
+
+        for (DockWidget *dock : { dock1, dock2, dock3 })
+            geometries.insert(dock->name(), dock->frame()->geometry());
+    }
+
+    {
+        auto m = createMainWindow(QSize(800, 500), MainWindowOption_None);
+        auto dock1 = createDockWidget(QStringLiteral("dock1"), Qt::green);
+        auto dock2 = createDockWidget(QStringLiteral("dock2"), Qt::red);
+        auto dock3 = createDockWidget(QStringLiteral("dock3"), Qt::blue);
+
+        LayoutJournal journal(fileName);
+        QVERIFY(journal.restore());
+        QVERIFY(m->dropArea()->checkSanity());
+        QCOMPARE(dock1->frame(), dock3->frame());
+        QCOMPARE(dock1->frame()->currentTabIndex(), 0);
+        for (DockWidget *dock : { dock1, dock2, dock3 })
+            QCOMPARE(dock->frame()->geometry(), geometries.value(dock->name()));
+
+        // Past the threshold, record() folds the journal back into the snapshot
+        journal.setCompactionThreshold(1);
+        QVERIFY(journal.record());
+        QCOMPARE(journal.journalSize(), 0);
+        Anchor *separator = m->multiSplitterLayout()->itemForFrame(dock1->frame())->anchorGroup().right;
+        separator->setPosition(separator->position() - 20);
+        QVERIFY(journal.record());
+        QCOMPARE(journal.journalSize(), 1);
+        separator->setPosition(separator->position() - 20);
+        QVERIFY(journal.record());
+        QCOMPARE(journal.journalSize(), 0);
+
+        // Floating a dock widget adds a window, which records can't express
+        journal.setCompactionThreshold(256);
+        const QByteArray snapshot = readFile(fileName);
+        dock2->setFloating(true);
+        QVERIFY(journal.record());
+        QCOMPARE(journal.journalSize(), 0);
+        QVERIFY(readFile(fileName) != snapshot);
+        delete dock2->window();
+    }
+}
+
+void TestDocks::tst_layoutReport()
+{
+    EnsureTopLevelsDeleted e;
+    auto m = createGridMainWindow(2, QSize(800, 800));
+    LayoutSaver saver;
+    const QByteArray saved = saver.serializeLayout();
+
+    const LayoutReport report = LayoutReport::fromData(saved);
+    QVERIFY(report.isValid());
+    QCOMPARE(report.formatVersion, 2);
+    QCOMPARE(report.numMainWindows, 1);
+    QCOMPARE(report.numFloatingWindows, 0);
+    QCOMPARE(report.numFloatingDockWidgets, 0);
+    QCOMPARE(report.numAnchors, m->multiSplitterLayout()->anchors().size());
+    QCOMPARE(report.numFrames, 4);
+    QCOMPARE(report.numDockWidgets, 4);
+
+    QCOMPARE(LayoutReport::fromData(saver.serializeLayout_legacy()).formatVersion, 1);
+    QVERIFY(LayoutReport::fromData(saver.serializeLayout_legacy()).isValid());
+
+    const LayoutReport truncated = LayoutReport::fromData(saved.left(saved.size() / 2));
+    QVERIFY(!truncated.isValid());
+
+    // The same dock widget in two frames of the same window, and twice in the same frame
+    auto encoded = [] (const QString &name) {
+        QByteArray result;
+        QDataStream ds(&result, QIODevice::WriteOnly);
+        ds << name;
+        return result;
+    };
+
+    const DockWidget::List docks = DockRegistry::self()->dockwidgets();
+    QByteArray twoFrames = saver.serializeLayout_legacy();
+    twoFrames.replace(encoded(docks.at(1)->name()), encoded(docks.at(0)->name()));
+    const LayoutReport twoFramesReport = LayoutReport::fromData(twoFrames);
+    QVERIFY(!twoFramesReport.isValid());
+    QCOMPARE(twoFramesReport.errors.filter(QStringLiteral("is in both")).size(), 1);
+
+    auto tab1 = createDockWidget(QStringLiteral("tab1"), Qt::blue);
+    auto tab2 = createDockWidget(QStringLiteral("tab2"), Qt::blue);
+    m->addDockWidget(tab1, Location_OnBottom);
+    tab1->addDockWidgetAsTab(tab2);
+    QVERIFY(LayoutReport::fromData(saver.serializeLayout_legacy()).isValid());
+
+    QByteArray sameFrame = saver.serializeLayout_legacy();
+    sameFrame.replace(encoded(tab2->name()), encoded(tab1->name()));
+    const LayoutReport sameFrameReport = LayoutReport::fromData(sameFrame);
+    QVERIFY(!sameFrameReport.isValid());
+    QCOMPARE(sameFrameReport.errors.filter(QStringLiteral("is twice in")).size(), 1);
+}
+
+static int s_numFactoryCalls = 0;
+static DockWidget *lazyDockWidgetFactory(const QString &name)
+{
+    s_numFactoryCalls++;
+    auto dock = new DockWidget(name);
+    dock->setWidget(new QPushButton(name));
+    return dock;
+}
+
+void TestDocks::tst_dockWidgetFactory()
+{
+    EnsureTopLevelsDeleted e;
+    struct FactoryGuard {
+        ~FactoryGuard() { LayoutSaver::setDockWidgetFactory(nullptr); }
+    } factoryGuard;
+
+    QByteArray saved;
+    QRect hiddenGeometry;
+    {
+        auto m = createMainWindow(QSize(800, 500), MainWindowOption_None);
+        auto dock1 = createDockWidget(QStringLiteral("dock1"), Qt::green);
+        auto dock2 = createDockWidget(QStringLiteral("dock2"), Qt::red);
+        auto dock3 = createDockWidget(QStringLiteral("dock3"), Qt::blue);
+        auto dock4 = createDockWidget(QStringLiteral("dock4"), Qt::yellow);
+        m->addDockWidget(dock1, Location_OnLeft);
+        dock1->addDockWidgetAsTab(dock4);
+        dock1->frame()->setCurrentTabIndex(0);
+        dock3->setGeometry(QRect(100, 100, 300, 200));
+        dock3->close();
+        hiddenGeometry = dock3->geometry();
+
+        LayoutSaver saver;
+        saved = saver.serializeLayout();
+        delete dock2;
+        delete dock3;
+    }
+
+    auto m = createMainWindow(QSize(800, 500), MainWindowOption_None);
+    LayoutSaver::setDockWidgetFactory(lazyDockWidgetFactory);
+    QVERIFY(LayoutSaver::dockWidgetFactory() == lazyDockWidgetFactory);
+    s_numFactoryCalls = 0;
+
+    // The current tab and the visible floating dock widget are created. The other tab only gets a
+    // placeholder and the hidden one isn't created at all.
+    LayoutSaver saver;
+    QVERIFY(saver.restoreLayout(saved));
+    QCOMPARE(s_numFactoryCalls, 2);
+    DockWidget *dock1 = DockRegistry::self()->dockByName(QStringLiteral("dock1"));
+    DockWidget *dock2 = DockRegistry::self()->dockByName(QStringLiteral("dock2"));
+    QVERIFY(dock1);
+    QVERIFY(dock2);
+    QCOMPARE(dock1->window(), m.get());
+    QVERIFY(dock2->isFloating());
+    QVERIFY(dock2->isVisible());
+    QVERIFY(!DockRegistry::self()->dockByName(QStringLiteral("dock3")));
+
+    Frame *frame = dock1->frame();
+    QCOMPARE(frame->dockWidgetCount(), 2);
+    QVERIFY(DockRegistry::self()->isPlaceholder(frame->dockWidgetAt(1)));
+    QCOMPARE(frame->dockWidgetAt(1)->name(), QStringLiteral("dock4"));
+
+    // Placeholders and pending geometries are saved as the dock widgets they stand for
+    const LayoutReport report = LayoutReport::fromData(saver.serializeLayout());
+    QVERIFY(report.isValid());
+    QCOMPARE(report.numFloatingDockWidgets, 2);
+    QCOMPARE(report.numDockWidgets, 4);
+
+    // The placeholder is replaced once its tab becomes current
+    frame->setCurrentTabIndex(1);
+    QTRY_COMPARE(s_numFactoryCalls, 3);
+    DockWidget *dock4 = DockRegistry::self()->dockByName(QStringLiteral("dock4"));
+    QVERIFY(dock4);
+    QVERIFY(!DockRegistry::self()->isPlaceholder(dock4));
+    QCOMPARE(dock4->frame(), frame);
+    QCOMPARE(frame->dockWidgetCount(), 2);
+    QCOMPARE(frame->dockWidgetAt(1), dock4);
+    QCOMPARE(frame->currentTabIndex(), 1);
+
+    // The hidden one gets its geometry once it's asked for
+    DockWidget *dock3 = DockRegistry::self()->dockByNameOrCreate(QStringLiteral("dock3"));
+    QVERIFY(dock3);
+    QCOMPARE(s_numFactoryCalls, 4);
+    QVERIFY(!dock3->isVisible());
+    QCOMPARE(dock3->geometry(), hiddenGeometry);
+    QCOMPARE(DockRegistry::self()->dockByNameOrCreate(QStringLiteral("dock3")), dock3);
+    QCOMPARE(s_numFactoryCalls, 4);
+
+    LayoutSaver::setDockWidgetFactory(nullptr);
+    QVERIFY(!DockRegistry::self()->dockByNameOrCreate(QStringLiteral("dock5")));
+    delete dock2;
+    delete dock3;
+    m.reset();
+
+    // Pending geometries survive the registry, which is deleted whenever it becomes empty
+    LayoutSaver::setDockWidgetFactory(lazyDockWidgetFactory);
+    DockRegistry::self()->setPendingFloatingGeometry(QStringLiteral("dock5"), hiddenGeometry);
+    createMainWindow(QSize(800, 500), MainWindowOption_None).reset();
+    DockWidget *dock5 = DockRegistry::self()->dockByNameOrCreate(QStringLiteral("dock5"));
+    QVERIFY(dock5);
+    QCOMPARE(dock5->geometry(), hiddenGeometry);
+    delete dock5;
+}
+
+static int s_numLazyWidgets = 0;
+static QWidget *lazyWidgetFactory(DockWidget *dock)
+{
+    s_numLazyWidgets++;
+    return new QPushButton(dock->name());
+}
+
+void TestDocks::tst_lazyTabContent()
+{
+    EnsureTopLevelsDeleted e;
+    s_numLazyWidgets = 0;
+    auto m = createMainWindow(QSize(800, 500), MainWindowOption_None);
+    auto dock1 = new DockWidget(QStringLiteral("dock1"));
+    auto dock2 = new DockWidget(QStringLiteral("dock2"));
+    auto dock3 = new DockWidget(QStringLiteral("dock3"));
+    for (DockWidget *dock : { dock1, dock2, dock3 }) {
+        dock->setWidgetFactory(lazyWidgetFactory);
+        QVERIFY(!dock->widget());
+    }
+    QCOMPARE(s_numLazyWidgets, 0);
+
+    m->addDockWidget(dock1, Location_OnLeft);
+    QTRY_VERIFY(dock1->widget());
+    QCOMPARE(s_numLazyWidgets, 1);
+
+    // Tabs which were never current don't have content
+    Frame *frame = dock1->frame();
+    frame->addWidget(dock2);
+    frame->addWidget(dock3);
+    QCOMPARE(frame->currentTabIndex(), 0);
+    QVERIFY(!dock2->widget());
+    QVERIFY(!dock3->widget());
+
+    frame->setCurrentTabIndex(1);
+    QTRY_VERIFY(dock2->widget());
+    QVERIFY(dock2->widget()->isVisible());
+    QVERIFY(!dock3->widget());
+    QCOMPARE(s_numLazyWidgets, 2);
+
+    // Hidden content is unloaded after the timeout, unless vetoed
+    dock1->setWidgetUnloadPolicy(10, [] (DockWidget *, QWidget *) { return false; });
+    dock2->setWidgetUnloadPolicy(10);
+    frame->setCurrentTabIndex(0);
+    QTRY_VERIFY(!dock2->widget());
+    frame->setCurrentTabIndex(1);
+    QTRY_VERIFY(dock2->widget());
+    QCOMPARE(s_numLazyWidgets, 3);
+    QTest::qWait(50);
+    QVERIFY(dock1->widget());
+}
+
+void TestDocks::tst_registryLookup()
+{
+    EnsureTopLevelsDeleted e;
+    DockRegistry *registry = DockRegistry::self();
+    const int numDocks = 100;
+    DockWidget::List docks;
+    for (int i = 0; i < numDocks; ++i)
+        docks.push_back(new DockWidget(QStringLiteral("dock-%1").arg(i)));
+
+    for (DockWidget *dock : qAsConst(docks))
+        QCOMPARE(registry->dockByName(dock->name()), dock);
+    QCOMPARE(registry->dockwidgets(), docks);
+
+    // Removing keeps the registration order, also once removed entries are compacted
+    for (int i = numDocks - 2; i >= 0; i -= 2) {
+        delete docks.at(i);
+        docks.removeAt(i);
+    }
+    QCOMPARE(registry->dockwidgets(), docks);
+    QVERIFY(!registry->dockByName(QStringLiteral("dock-0")));
+    QCOMPARE(registry->dockByName(QStringLiteral("dock-1")), docks.at(0));
+
+    // With duplicate names the first registered one wins
+    DockWidget *duplicate = nullptr;
+    {
+        SetExpectedWarning sew(QStringLiteral("already exists"));
+        duplicate = new DockWidget(QStringLiteral("dock-1"));
+    }
+    QCOMPARE(registry->dockByName(QStringLiteral("dock-1")), docks.at(0));
+    delete docks.takeFirst();
+    QCOMPARE(registry->dockByName(QStringLiteral("dock-1")), duplicate);
+    delete duplicate;
+    QVERIFY(!registry->dockByName(QStringLiteral("dock-1")));
+
+    auto m = createMainWindow();
+    QCOMPARE(registry->mainWindowByName(QStringLiteral("MyMainWindow")), m.get());
+    m.reset();
+
+    qDeleteAll(docks);
+}
+
+void TestDocks::tst_eventRouter()
+{
+    EnsureTopLevelsDeleted e;
+    EventRouter *router = EventRouter::instance();
+
+    auto m = createMainWindow();
+    auto dock = createDockWidget(QStringLiteral("dock1"), new QPushButton(QStringLiteral("one")));
+    m->addDockWidget(dock, Location_OnLeft);
+    Frame *frame = dock->frame();
+    QVERIFY(router->hasRoute(frame, frame->layoutItem(), EventRouter::ParentChangeEvents));
+    QVERIFY(!router->hasRoute(frame, frame->layoutItem(), EventRouter::MouseEvents));
+
+    QWidget receiver;
+    EventFilter pressFilter(QEvent::MouseButtonPress);
+    EventFilter userFilter(QEvent::User);
+    router->addRoute(&receiver, &pressFilter, EventRouter::MouseEvents);
+    router->addRoute(&receiver, &userFilter, EventRouter::EventTypes(EventRouter::MouseEvents) | EventRouter::MoveEvents);
+    QVERIFY(router->hasRoute(&receiver, &userFilter, EventRouter::MoveEvents));
+    QVERIFY(!router->hasRoute(&receiver, &pressFilter, EventRouter::MoveEvents));
+
+    QMouseEvent press(QEvent::MouseButtonPress, QPoint(1, 1), Qt::LeftButton, Qt::LeftButton, Qt::NoModifier);
+    qApp->sendEvent(&receiver, &press);
+    QVERIFY(pressFilter.m_got);
+
+    // Event types nobody routes don't reach the listeners
+    QEvent userEvent(QEvent::User);
+    qApp->sendEvent(&receiver, &userEvent);
+    QVERIFY(!userFilter.m_got);
+
+    router->removeRoute(&receiver, &pressFilter);
+    pressFilter.m_got = false;
+    qApp->sendEvent(&receiver, &press);
+    QVERIFY(!pressFilter.m_got);
+
+    // Routes go away with their listener
+    auto listener = new EventFilter(QEvent::MouseButtonPress);
+    router->addRoute(&receiver, listener, EventRouter::MouseEvents);
+    QVERIFY(router->hasRoute(&receiver, listener, EventRouter::MouseEvents));
+    delete listener;
+    QVERIFY(!router->hasRoute(&receiver, listener, EventRouter::MouseEvents));
+
+    // And with their receiver, without affecting the listener's other routes
+    auto receiver2 = new QWidget();
+    router->addRoute(receiver2, &pressFilter, EventRouter::MouseEvents);
+    router->addRoute(&receiver, &pressFilter, EventRouter::MouseEvents);
+    delete receiver2;
+    QVERIFY(!router->hasRoute(receiver2, &pressFilter, EventRouter::MouseEvents));
+    pressFilter.m_got = false;
+    qApp->sendEvent(&receiver, &press);
+    QVERIFY(pressFilter.m_got);
+}
+
+void TestDocks::tst_dragMoveCoalescing()
+{
+    // Mouse moves arriving faster than a frame are coalesced, only the last one is processed
+    EnsureTopLevelsDeleted e;
+    auto m = createMainWindow(QSize(900, 500), MainWindowOption_None);
+    auto dock1 = createDockWidget(QStringLiteral("dock1"), Qt::green);
+    auto dock2 = createDockWidget(QStringLiteral("dock2"), Qt::red);
+    auto dock3 = createDockWidget(QStringLiteral("dock3"), Qt::yellow);
+    m->addDockWidget(dock1, Location_OnLeft);
+    m->addDockWidget(dock2, Location_OnRight);
+    m->addDockWidget(dock3, Location_OnRight);
+    Frame *frame1 = dock1->frame();
+    Frame *frame2 = dock2->frame();
+    Frame *frame3 = dock3->frame();
+
+    auto dock4 = createDockWidget(QStringLiteral("dock4"), Qt::blue);
+    FloatingWindow *fw = dock4->morphIntoFloatingWindow();
+    QWidget *titleBar = fw->actualTitleBar();
+    DropIndicatorOverlayInterface *overlay = m->dropArea()->dropIndicatorOverlay();
+
+    auto sendMove = [titleBar] (QPoint globalPos) {
+        QCursor::setPos(globalPos);
+        QMouseEvent ev(QEvent::MouseMove, titleBar->mapFromGlobal(globalPos), titleBar->window()->mapFromGlobal(globalPos), globalPos,
+                       Qt::LeftButton, Qt::LeftButton, Qt::NoModifier);
+        qApp->sendEvent(titleBar, &ev);
+    };
+
+    auto centerOf = [] (Frame *frame) {
+        return frame->mapToGlobal(frame->rect().center());
+    };
+
+    // Start dragging and let the drag settle over frame1
+    drag(titleBar, titleBar->mapToGlobal(QPoint(10, 10)), centerOf(frame1), ButtonAction_Press);
+    QTest::qWait(100);
+    QCOMPARE(overlay->hoveredFrame(), frame1);
+
+    QVector<Frame *> hoveredFrames;
+    connect(overlay, &DropIndicatorOverlayInterface::hoveredFrameChanged, overlay, [&hoveredFrames] (Frame *frame) {
+        hoveredFrames.push_back(frame);
+    });
+
+    // A burst without returning to the event loop. The first move is processed right away, the
+    // ones in between are dropped and the last one is processed on the next frame.
+    sendMove(centerOf(frame1) + QPoint(0, 20));
+    sendMove(centerOf(frame2));
+    sendMove(centerOf(frame2) + QPoint(0, 20));
+    sendMove(centerOf(frame3));
+    QVERIFY(hoveredFrames.isEmpty());
+    QTRY_COMPARE(hoveredFrames, QVector<Frame *>({ frame3 }));
+    QCOMPARE(overlay->hoveredFrame(), frame3);
+
+    // Releasing right after a move that is still pending drops at the final position
+    const QPoint dropPos = overlay->posForIndicator(DropIndicatorOverlayInterface::DropLocation_OutterBottom);
+    sendMove(frame1->mapToGlobal(QPoint(5, 5)));
+    sendMove(dropPos);
+    releaseOn(dropPos, titleBar);
+    QVERIFY(!dock4->isFloating());
+    QCOMPARE(dock4->window(), m.get());
+    QVERIFY(dock4->frame()->geometry().top() > frame1->geometry().bottom());
+    QVERIFY(dock4->frame()->geometry().top() > frame3->geometry().bottom());
+}
+
+void TestDocks::tst_hoverSnapshot()
+{
+    // The windows which can be hovered are looked up when the drag starts, and again only after
+    // a window is shown, hidden, moved or resized
+    EnsureTopLevelsDeleted e;
+    auto m = createMainWindow(QSize(800, 500), MainWindowOption_None);
+    auto dock1 = createDockWidget(QStringLiteral("dock1"), Qt::green);
+    auto dock2 = createDockWidget(QStringLiteral("dock2"), Qt::red);
+    m->addDockWidget(dock1, Location_OnLeft);
+    m->addDockWidget(dock2, Location_OnRight);
+    Frame *frame1 = dock1->frame();
+    Frame *frame2 = dock2->frame();
+
+    auto dock3 = createDockWidget(QStringLiteral("dock3"), Qt::blue);
+    FloatingWindow *fw = dock3->morphIntoFloatingWindow();
+    QWidget *titleBar = fw->actualTitleBar();
+    DropIndicatorOverlayInterface *overlay = m->dropArea()->dropIndicatorOverlay();
+    DragController *dc = DragController::instance();
+
+    auto moveTo = [titleBar] (QPoint globalPos) {
+        QCursor::setPos(globalPos);
+        QMouseEvent ev(QEvent::MouseMove, titleBar->mapFromGlobal(globalPos), titleBar->window()->mapFromGlobal(globalPos), globalPos,
+                       Qt::LeftButton, Qt::LeftButton, Qt::NoModifier);
+        qApp->sendEvent(titleBar, &ev);
+        QTest::qWait(50); // More than a frame, so the move isn't coalesced with the next one
+    };
+
+    const QPoint center1 = frame1->mapToGlobal(frame1->rect().center());
+    const QPoint center2 = frame2->mapToGlobal(frame2->rect().center());
+    drag(titleBar, titleBar->mapToGlobal(QPoint(10, 10)), center1, ButtonAction_Press);
+    QTest::qWait(100);
+    QVERIFY(dc->isDragging());
+    QCOMPARE(overlay->hoveredFrame(), frame1);
+    const int numSnapshots = dc->dbg_numHoverSnapshots();
+    QVERIFY(numSnapshots > 0);
+
+    // Hovering shows and moves the drop indicators, which aren't hover candidates
+    moveTo(center2);
+    moveTo(center1 + QPoint(0, 20));
+    moveTo(overlay->posForIndicator(DropIndicatorOverlayInterface::DropLocation_Left));
+    moveTo(center2 + QPoint(0, 20));
+    QCOMPARE(overlay->hoveredFrame(), frame2);
+    QCOMPARE(dc->dbg_numHoverSnapshots(), numSnapshots);
+
+    // A window shown during the drag is picked up by the next move
+    auto window = new QWidget();
+    window->setGeometry(m->geometry().right() + 50, m->geometry().top(), 100, 100);
+    window->show();
+    QVERIFY(QTest::qWaitForWindowExposed(window));
+    moveTo(center1);
+    QCOMPARE(dc->dbg_numHoverSnapshots(), numSnapshots + 1);
+    moveTo(center2);
+    QCOMPARE(dc->dbg_numHoverSnapshots(), numSnapshots + 1);
+
+    // So is one which moved
+    window->move(window->pos() + QPoint(10, 10));
+    moveTo(center1);
+    QCOMPARE(dc->dbg_numHoverSnapshots(), numSnapshots + 2);
+
+    const QPoint dropPos = overlay->posForIndicator(DropIndicatorOverlayInterface::DropLocation_OutterBottom);
+    moveTo(dropPos);
+    releaseOn(dropPos, titleBar);
+    QVERIFY(!dc->isDragging());
+    QCOMPARE(dock3->window(), m.get());
+    delete window;
+}
+
+void TestDocks::tst_dragControllerStates()
+{
+    EnsureTopLevelsDeleted e;
+    auto m = createMainWindow(QSize(800, 500), MainWindowOption_None);
+    auto dock1 = createDockWidget(QStringLiteral("dock1"), Qt::green);
+    m->addDockWidget(dock1, Location_OnLeft);
+    DropIndicatorOverlayInterface *overlay = m->dropArea()->dropIndicatorOverlay();
+
+    DragController *dc = DragController::instance();
+    QCOMPARE(dc->dbg_state(), DragController::State_None);
+    QSignalSpy droppedSpy(dc, &DragController::dropped);
+    QSignalSpy canceledSpy(dc, &DragController::dragCanceled);
+
+    // The states are created once, events only look them up
+    const QVector<StateBase *> states = { dc->dbg_stateObject(DragController::State_None),
+                                          dc->dbg_stateObject(DragController::State_PreDrag),
+                                          dc->dbg_stateObject(DragController::State_Dragging) };
+    const int numStateObjects = dc->findChildren<StateBase *>().size();
+    auto verifyStatesReused = [dc, &states, numStateObjects] {
+        for (int i = DragController::State_None; i <= DragController::State_Dragging; ++i) {
+            if (dc->dbg_stateObject(DragController::State(i)) != states.at(i))
+                return false;
+        }
+
+        return dc->findChildren<StateBase *>().size() == numStateObjects;
+    };
+
+    // onExit() of the old state runs before onEntry() of the new one, which is when the window
+    // being dragged is created and released
+    QStringList transitions;
+    for (StateBase *s : states) {
+        const QString name = QString::fromLatin1(s->metaObject()->className()).section(QStringLiteral("::"), -1);
+        connect(s, &StateBase::entered, s, [&transitions, dc, name] {
+            transitions << (dc->isDragging() ? name + QStringLiteral(" entered, dragging") : name + QStringLiteral(" entered"));
+        });
+        connect(s, &StateBase::exited, s, [&transitions, dc, name] {
+            transitions << (dc->isDragging() ? name + QStringLiteral(" exited, dragging") : name + QStringLiteral(" exited"));
+        });
+    }
+
+    const QStringList dragTransitions = { QStringLiteral("StateNone exited"),
+                                          QStringLiteral("StatePreDrag entered"),
+                                          QStringLiteral("StatePreDrag exited"),
+                                          QStringLiteral("StateDragging entered, dragging"),
+                                          QStringLiteral("StateDragging exited, dragging"),
+                                          QStringLiteral("StateNone entered") };
+
+    auto moveTo = [] (QPoint globalPos, QWidget *receiver) {
+        QCursor::setPos(globalPos);
+        QMouseEvent ev(QEvent::MouseMove, receiver->mapFromGlobal(globalPos), receiver->window()->mapFromGlobal(globalPos), globalPos,
+                       Qt::LeftButton, Qt::LeftButton, Qt::NoModifier);
+        qApp->sendEvent(receiver, &ev);
+        QTest::qWait(50);
+    };
+
+    // Press, move past the threshold, drag and drop
+    auto dock2 = createDockWidget(QStringLiteral("dock2"), Qt::red);
+    QWidget *titleBar = dock2->morphIntoFloatingWindow()->actualTitleBar();
+    const QPoint pressPos = titleBar->mapToGlobal(QPoint(10, 10));
+    pressOn(pressPos, titleBar);
+    QCOMPARE(dc->dbg_state(), DragController::State_PreDrag);
+
+    moveTo(pressPos + QPoint(1, 0), titleBar);
+    QCOMPARE(dc->dbg_state(), DragController::State_PreDrag);
+    QVERIFY(!dc->isDragging());
+
+    moveTo(pressPos + QPoint(QApplication::startDragDistance() + 1, 0), titleBar);
+    QCOMPARE(dc->dbg_state(), DragController::State_Dragging);
+    QVERIFY(dc->isDragging());
+
+    moveTo(dock1->frame()->mapToGlobal(dock1->frame()->rect().center()), titleBar);
+    const QPoint dropPos = overlay->posForIndicator(DropIndicatorOverlayInterface::DropLocation_OutterRight);
+    moveTo(dropPos, titleBar);
+    releaseOn(dropPos, titleBar);
+    QCOMPARE(droppedSpy.count(), 1);
+    QCOMPARE(canceledSpy.count(), 0);
+    QCOMPARE(dc->dbg_state(), DragController::State_None);
+    QVERIFY(!dc->isDragging());
+    QCOMPARE(dock2->window(), m.get());
+    QCOMPARE(transitions, dragTransitions);
+    QVERIFY(verifyStatesReused());
+
+    // Releasing before the threshold cancels
+    transitions.clear();
+    auto dock3 = createDockWidget(QStringLiteral("dock3"), Qt::blue);
+    FloatingWindow *fw3 = dock3->morphIntoFloatingWindow();
+    titleBar = fw3->actualTitleBar();
+    const QPoint pressPos3 = titleBar->mapToGlobal(QPoint(10, 10));
+    pressOn(pressPos3, titleBar);
+    releaseOn(pressPos3, titleBar);
+    QCOMPARE(canceledSpy.count(), 1);
+    QCOMPARE(dc->dbg_state(), DragController::State_None);
+    QCOMPARE(transitions, QStringList({ QStringLiteral("StateNone exited"),
+                                        QStringLiteral("StatePreDrag entered"),
+                                        QStringLiteral("StatePreDrag exited"),
+                                        QStringLiteral("StateNone entered") }));
+
+    // Releasing outside of any drop area cancels the drag, the window stays floating
+    transitions.clear();
+    pressOn(pressPos3, titleBar);
+    moveTo(pressPos3 + QPoint(QApplication::startDragDistance() + 1, 0), titleBar);
+    QVERIFY(dc->isDragging());
+    const QPoint outside = m->geometry().topRight() + QPoint(200, 0);
+    moveTo(outside, titleBar);
+    releaseOn(outside, titleBar);
+    QCOMPARE(canceledSpy.count(), 2);
+    QCOMPARE(droppedSpy.count(), 1);
+    QCOMPARE(dc->dbg_state(), DragController::State_None);
+    QVERIFY(!dc->isDragging());
+    QVERIFY(dock3->isFloating());
+    QCOMPARE(dock3->window(), static_cast<QWidget *>(fw3));
+    QCOMPARE(transitions, dragTransitions);
+    QVERIFY(verifyStatesReused());
+
+    delete fw3;
+}
+
 // QTest::qWait(50000)
 
 QTEST_MAIN(KDDockWidgets::TestDocks)
@@ -0,0 +1,79 @@
+/*
+  This file is part of KDDockWidgets.
+
+  Copyright (C) 2018-2019 Klarälvdalens Datakonsult AB, a KDAB Group company, info@kdab.com
+  Author: Sérgio Martins <sergio.martins@kdab.com>
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Tests for the EventRouter that need a QApplication to be recreated, which tst_docks can't do
+
+#include "EventRouter_p.h"
+
+#include <QApplication>
+#include <QMoveEvent>
+#include <QtTest/QtTest>
+
+using namespace KDDockWidgets;
+
+namespace {
+
+class MoveCounter : public QObject
+{
+public:
+    bool eventFilter(QObject *, QEvent *e) override
+    {
+        if (e->type() == QEvent::Move)
+            m_count++;
+        return false;
+    }
+
+    int m_count = 0;
+};
+
+}
+
+class TestEventRouter : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void tst_routeWithCurrentApplication();
+};
+
+void TestEventRouter::tst_routeWithCurrentApplication()
+{
+    // Runs once per QApplication instance, so the second run catches a filter left on the destroyed one
+    QObject receiver;
+    MoveCounter listener;
+    EventRouter::instance()->addRoute(&receiver, &listener, EventRouter::MoveEvents);
+
+    QMoveEvent ev(QPoint(1, 1), QPoint(0, 0));
+    QCoreApplication::sendEvent(&receiver, &ev);
+    QCOMPARE(listener.m_count, 1);
+}
+
+int main(int argc, char **argv)
+{
+    int result = 0;
+    for (int i = 0; i < 2; ++i) {
+        QApplication app(argc, argv);
+        TestEventRouter test;
+        result |= QTest::qExec(&test, argc, argv);
+    }
+
+    return result;
+}
+
+#include "tst_eventrouter.moc"
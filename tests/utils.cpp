@@ -92,7 +92,7 @@ std::unique_ptr<MainWindow> KDDockWidgets::Tests::createMainWindow(QVector<DockD
 
         m->addDockWidget(desc.createdDock, desc.loc, relativeTo, desc.option);
         qDebug() << "Added" <<i;
-        layout->checkSanity();
+        layout->verifySanity();
         ++i;
     }
 